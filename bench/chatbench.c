@@ -0,0 +1,937 @@
+/* chat server load generator.
+
+   opens many simulated clients on loopback. each one connects, sends
+   the Client hello, consumes its history and waits for its own join
+   message (join latency). once all are in, a few of them send
+   messages at a fixed total rate; every message carries its send
+   time, so every client that receives it can tell how long the fan-out
+   took. after a warmup the numbers of a measured window are printed
+   as one JSON line on stdout (a summary goes to stderr), so runs
+   against different event loops (server --event-loop) can be
+   collected and compared. see bench/compare.sh.
+
+   the server must be running. give its pid with -p to get its cpu
+   use over the window too. built with USE_SSL, -x connects with TLS
+   (to a server started with --tls-cert), which shows what encryption
+   costs. -z asks the server to compress; the bytes received on the
+   wire, per join and per second, show what that saves. */
+
+#define _GNU_SOURCE
+
+#include "../helpers.h"
+
+#ifdef USE_SSL
+#include "../tls.h"
+#endif
+
+#ifdef HAVE_ZLIB
+#include "../zstream.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+/* connections in their handshake at once, per thread */
+#define CONNECT_BATCH 64
+
+/* give up on clients that did not get in after this long */
+#define CONNECT_TIMEOUT_S 30
+
+/* keep receiving this long after the window, for late deliveries */
+#define DRAIN_S 2
+
+/* most messages one thread sends in one go when behind schedule */
+#define SEND_BURST 256
+
+#define EVENT_BATCH 256
+
+/* ---------- latency histogram ----------
+
+   log-linear: values below HIST_SUB exactly, above that HIST_SUB
+   buckets per power of two (about 3% resolution) */
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} Hist;
+
+static int hist_index(uint64_t v) {
+
+    if (v < HIST_SUB)
+        return (int)v;
+
+    int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+}
+
+/* largest value in bucket i */
+static uint64_t hist_value(int i) {
+
+    if (i < HIST_SUB)
+        return i;
+
+    int shift = i / HIST_SUB - 1;
+    return (((uint64_t)(i % HIST_SUB + HIST_SUB) + 1) << shift) - 1;
+}
+
+static void hist_add(Hist *h, uint64_t v) {
+    h->buckets[hist_index(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void hist_merge(Hist *into, const Hist *h) {
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        into->buckets[i] += h->buckets[i];
+    into->count += h->count;
+    if (h->max > into->max)
+        into->max = h->max;
+}
+
+/* value at quantile q (0..1) */
+static uint64_t hist_quantile(const Hist *h, double q) {
+
+    if (h->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * (h->count - 1)) + 1;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+
+    return h->max;
+}
+
+/* ---------- simulated clients ---------- */
+
+enum {
+    ST_CONNECTING,      /* non-blocking connect in progress */
+    ST_TLS,             /* TLS handshake (-x) */
+    ST_REPLY,           /* reading the answer to the hello's flags */
+    ST_SIZE,            /* reading the history size */
+    ST_HISTORY,         /* skipping the history */
+    ST_JOINING,         /* waiting for our own join message */
+    ST_LIVE,
+    ST_DEAD
+};
+
+typedef struct {
+    int fd;
+    int state;
+    uint64_t connect_ns;        /* when connect() was called */
+    uint64_t rx;                /* bytes received on the wire */
+    char name[MAX_NAME];
+    char joined[MAX_NAME + 16]; /* ":name joined", our join message */
+
+    char size_buf[sizeof(long)];
+    size_t size_got;
+    long hist_left;             /* history bytes still to skip */
+
+    FrameDecoder in;
+
+    char out[64];               /* rest of a frame the socket refused */
+    size_t out_off, out_len;
+#ifdef USE_SSL
+    Tls *tls;
+#endif
+#ifdef HAVE_ZLIB
+    ZIn *zin;                   /* the server compresses (-z) */
+#endif
+} Conn;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    int epfd;
+
+    Conn *conns;
+    int count;
+    int senders;                /* conns[0 .. senders) send */
+    double rate;                /* this thread's messages per second */
+
+    int next_connect;
+    int connecting;
+    int next_sender;
+    uint64_t due_base;          /* sends counted from here */
+    uint64_t now;               /* this loop pass */
+
+    /* results */
+    uint64_t sent;              /* messages stamped in the window */
+    uint64_t sent_total;
+    uint64_t delivered;         /* received messages stamped in the window */
+    uint64_t skipped;           /* sends skipped, socket still full */
+    uint64_t disconnects;       /* live clients that lost the connection */
+    uint64_t join_rx;           /* wire bytes clients got until they were in */
+    uint64_t window_rx;         /* wire bytes received in the window */
+    Hist fanout;
+    Hist join;
+} Worker;
+
+/* options */
+static const char *server_ip = SERVER_IP;
+static int clients = 1000;
+static int senders = 10;
+static double rate = 1000;
+static int duration = 10;
+static int warmup = 2;
+static int threads = 2;
+static int server_pid = -1;
+static const char *label = "";
+static int use_tls;
+static int use_zlib;
+
+/* clients in (live) or given up on, over all threads */
+static atomic_int settled;
+
+/* timeline, set once everyone is in: sending starts at start_ns,
+   the window is [window_ns, end_ns). 0 while connecting. */
+static _Atomic uint64_t start_ns;
+static uint64_t window_ns, end_ns;
+
+static atomic_int stop;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void conn_close(Worker *w, Conn *c) {
+
+    if (c->state == ST_LIVE)
+        w->disconnects++;
+    else if (c->state != ST_DEAD) {
+        w->connecting--;
+        atomic_fetch_add(&settled, 1);
+    }
+
+    if (c->fd >= 0)
+        close(c->fd);
+
+#ifdef USE_SSL
+    tls_free(c->tls);
+    c->tls = NULL;
+#endif
+#ifdef HAVE_ZLIB
+    zin_free(c->zin);
+    c->zin = NULL;
+#endif
+
+    c->fd = -1;
+    c->state = ST_DEAD;
+}
+
+/* send() and recv() on c, through TLS with -x */
+static ssize_t conn_send(Conn *c, const void *buf, size_t len) {
+
+#ifdef USE_SSL
+    if (c->tls) {
+        struct iovec iov = { (void *)buf, len };
+        return tls_sendmsg(c->tls, &iov, 1, 0);
+    }
+#endif
+
+    return send(c->fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+static ssize_t conn_recv_raw(Worker *w, Conn *c, void *buf, size_t len) {
+
+    ssize_t n;
+
+#ifdef USE_SSL
+    if (c->tls)
+        n = tls_recv(c->tls, buf, len);
+    else
+#endif
+    n = recv(c->fd, buf, len, 0);
+
+    /* what the wire carried (TLS adds its record overhead on top) */
+    if (n > 0) {
+        c->rx += n;
+        if (w->now >= window_ns && w->now < end_ns)
+            w->window_rx += n;
+    }
+
+    return n;
+}
+
+/* recv() on c, decompressed with -z */
+static ssize_t conn_recv(Worker *w, Conn *c, void *buf, size_t len) {
+
+#ifdef HAVE_ZLIB
+    if (c->zin) {
+        while (zin_ready(c->zin) == 0) {
+
+            char raw[16384];
+            ssize_t n = conn_recv_raw(w, c, raw, sizeof(raw));
+            if (n <= 0)
+                return n;
+
+            if (zin_feed(c->zin, raw, n) < 0) {
+                errno = EPROTO;
+                return -1;
+            }
+        }
+
+        return zin_take(c->zin, buf, len);
+    }
+#endif
+
+    return conn_recv_raw(w, c, buf, len);
+}
+
+/* input TLS decrypted (or zlib decompressed) already, which epoll
+   does not report */
+static int conn_pending(Conn *c) {
+
+#ifdef HAVE_ZLIB
+    if (c->zin && zin_ready(c->zin) > 0)
+        return 1;
+#endif
+
+#ifdef USE_SSL
+    if (c->tls)
+        return tls_pending(c->tls) > 0;
+#endif
+
+    (void)c;
+    return 0;
+}
+
+static void conn_watch(Worker *w, Conn *c, uint32_t events) {
+
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = c;
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void conn_start(Worker *w, Conn *c) {
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SERVER_PORT);
+    inet_pton(AF_INET, server_ip, &addr.sin_addr);
+
+    w->connecting++;
+    c->state = ST_CONNECTING;
+    c->connect_ns = now_ns();
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0) {
+        conn_close(w, c);
+        return;
+    }
+
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 &&
+        errno != EINPROGRESS) {
+        conn_close(w, c);
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+        conn_close(w, c);
+}
+
+/* send the hello and wait for the history */
+static void conn_hello(Worker *w, Conn *c) {
+
+    Client me;
+    memset(&me, 0, sizeof(me));
+    memcpy(me.name, c->name, sizeof(me.name));
+    snprintf(me.ip, sizeof(me.ip), "%s", server_ip);
+    me.flags = HELLO_PING | (use_zlib ? HELLO_ZLIB : 0);
+
+    /* a fresh socket always has room for the hello */
+    if (conn_send(c, &me, sizeof(me)) != sizeof(me)) {
+        conn_close(w, c);
+        return;
+    }
+
+    conn_watch(w, c, EPOLLIN);
+    c->state = me.flags ? ST_REPLY : ST_SIZE;
+}
+
+#ifdef USE_SSL
+/* more of the TLS handshake; the hello once it is done */
+static void conn_handshake(Worker *w, Conn *c) {
+
+    int want_write;
+    int r = tls_handshake(c->tls, &want_write);
+
+    if (r < 0)
+        conn_close(w, c);
+    else if (r == 0)
+        conn_watch(w, c, want_write ? EPOLLOUT : EPOLLIN);
+    else
+        conn_hello(w, c);
+}
+#endif
+
+/* connected: TLS first with -x, else the hello right away */
+static void conn_connected(Worker *w, Conn *c) {
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+    if (err) {
+        conn_close(w, c);
+        return;
+    }
+
+#ifdef USE_SSL
+    if (use_tls) {
+        c->tls = tls_new(c->fd, 0, NULL);
+        if (!c->tls) {
+            conn_close(w, c);
+            return;
+        }
+        c->state = ST_TLS;
+        conn_handshake(w, c);
+        return;
+    }
+#endif
+
+    conn_hello(w, c);
+}
+
+static void conn_frame(Worker *w, Conn *c, const char *p, size_t len) {
+
+    uint64_t now = now_ns();
+
+    if (c->state == ST_JOINING &&
+        memmem(p, len, c->joined, strlen(c->joined))) {
+
+        hist_add(&w->join, now - c->connect_ns);
+        w->join_rx += c->rx;
+        c->state = ST_LIVE;
+        w->connecting--;
+        atomic_fetch_add(&settled, 1);
+        return;
+    }
+
+    /* "[time]:name → @<send time>\n" */
+    const char *at = memrchr(p, '@', len);
+    if (!at)
+        return;
+
+    char stamp[24];
+    size_t n = len - (at + 1 - p);
+    if (n >= sizeof(stamp))
+        return;
+
+    memcpy(stamp, at + 1, n);
+    stamp[n] = 0;
+
+    uint64_t sent = strtoull(stamp, NULL, 10);
+    if (sent >= window_ns && sent < end_ns && sent <= now) {
+        hist_add(&w->fanout, now - sent);
+        w->delivered++;
+    }
+}
+
+/* push out what is left of the last frame; 0 once nothing is */
+static int conn_flush(Worker *w, Conn *c) {
+
+#ifdef USE_SSL
+    /* a record TLS could not write yet goes first */
+    if (c->tls) {
+        int r = tls_flush(c->tls);
+        if (r != 0) {
+            if (r < 0)
+                conn_close(w, c);
+            return -1;
+        }
+    }
+#endif
+
+    while (c->out_off < c->out_len) {
+        ssize_t n = conn_send(c, c->out + c->out_off, c->out_len - c->out_off);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                conn_close(w, c);
+            return -1;
+        }
+        c->out_off += n;
+    }
+
+    c->out_off = c->out_len = 0;
+    return 0;
+}
+
+/* answer a ping, behind whatever is left of the last frame */
+static void conn_pong(Worker *w, Conn *c) {
+
+    if (c->out_len + FRAME_HEADER_SIZE > sizeof(c->out))
+        return;
+
+    frame_header(c->out + c->out_len, FRAME_PONG, 0);
+    c->out_len += FRAME_HEADER_SIZE;
+    conn_flush(w, c);
+}
+
+/* returns 0 if it got input, -1 if there was none or c is gone */
+static int conn_read(Worker *w, Conn *c) {
+
+    ssize_t n;
+
+    switch (c->state) {
+
+    case ST_REPLY: {
+        uint8_t granted;
+        n = conn_recv(w, c, &granted, 1);
+        if (n <= 0)
+            break;
+
+#ifdef HAVE_ZLIB
+        /* the rest comes compressed */
+        if ((granted & HELLO_ZLIB) && !(c->zin = zin_new())) {
+            conn_close(w, c);
+            return -1;
+        }
+#endif
+
+        c->state = ST_SIZE;
+        return 0;
+    }
+
+    case ST_SIZE:
+        n = conn_recv(w, c, c->size_buf + c->size_got,
+                      sizeof(c->size_buf) - c->size_got);
+        if (n <= 0)
+            break;
+
+        c->size_got += n;
+        if (c->size_got < sizeof(c->size_buf))
+            return 0;
+
+        memcpy(&c->hist_left, c->size_buf, sizeof(c->hist_left));
+        c->state = c->hist_left > 0 ? ST_HISTORY : ST_JOINING;
+        return 0;
+
+    case ST_HISTORY: {
+        char skip[16384];
+        n = conn_recv(w, c, skip, c->hist_left < (long)sizeof(skip)
+                               ? (size_t)c->hist_left : sizeof(skip));
+        if (n <= 0)
+            break;
+
+        c->hist_left -= n;
+        if (c->hist_left == 0)
+            c->state = ST_JOINING;
+        return 0;
+    }
+
+    default: {
+        size_t avail;
+        char *p = frame_decoder_space(&c->in, &avail);
+
+        n = avail ? conn_recv(w, c, p, avail) : -1;
+        if (n <= 0)
+            break;
+
+        frame_decoder_commit(&c->in, n);
+
+        uint8_t type;
+        const char *payload;
+        size_t len;
+        int r;
+
+        while ((r = frame_decoder_next(&c->in, &type, &payload, &len)) > 0) {
+            if (type == FRAME_TEXT)
+                conn_frame(w, c, payload, len);
+            else if (type == FRAME_PING)
+                conn_pong(w, c);
+        }
+
+        if (r < 0) {
+            conn_close(w, c);
+            return -1;
+        }
+        return 0;
+    }
+    }
+
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        conn_close(w, c);
+    return -1;
+}
+
+/* send the messages that are due by now, round robin over our senders */
+static void send_due(Worker *w, uint64_t now) {
+
+    if (w->senders == 0 || now >= end_ns)
+        return;
+
+    uint64_t due = (uint64_t)((now - w->due_base) / 1e9 * w->rate);
+
+    for (int k = 0; k < SEND_BURST && w->sent_total < due; k++) {
+
+        Conn *c = &w->conns[w->next_sender];
+        w->next_sender = (w->next_sender + 1) % w->senders;
+        w->sent_total++;
+
+        if (c->state != ST_LIVE || conn_flush(w, c) < 0) {
+            w->skipped++;
+            continue;
+        }
+
+        uint64_t stamp = now_ns();
+        int len = snprintf(c->out + FRAME_HEADER_SIZE,
+                           sizeof(c->out) - FRAME_HEADER_SIZE,
+                           "@%llu", (unsigned long long)stamp);
+        frame_header(c->out, FRAME_TEXT, len);
+        c->out_len = FRAME_HEADER_SIZE + len;
+
+        if (stamp >= window_ns && stamp < end_ns)
+            w->sent++;
+
+        conn_flush(w, c);
+    }
+
+    /* too far behind to catch up: forget the backlog */
+    if (w->sent_total < due)
+        w->sent_total = due;
+}
+
+static void *worker_main(void *arg) {
+
+    Worker *w = arg;
+    struct epoll_event events[EVENT_BATCH];
+
+    while (!atomic_load(&stop)) {
+
+        /* keep a batch of handshakes going until everyone is in */
+        while (w->next_connect < w->count && w->connecting < CONNECT_BATCH)
+            conn_start(w, &w->conns[w->next_connect++]);
+
+        uint64_t start = atomic_load(&start_ns);
+        int sending = start && w->senders > 0;
+
+        int n = epoll_wait(w->epfd, events, EVENT_BATCH, sending ? 1 : 10);
+        w->now = now_ns();
+
+        for (int e = 0; e < n; e++) {
+
+            Conn *c = events[e].data.ptr;
+
+            if (c->state == ST_CONNECTING)
+                conn_connected(w, c);
+#ifdef USE_SSL
+            else if (c->state == ST_TLS)
+                conn_handshake(w, c);
+#endif
+            else if (c->state != ST_DEAD) {
+                /* TLS may have taken more from the socket than one
+                   read returns */
+                while (conn_read(w, c) == 0 && conn_pending(c))
+                    ;
+            }
+        }
+
+        if (sending) {
+            if (!w->due_base)
+                w->due_base = start;
+            send_due(w, now_ns());
+        }
+    }
+
+    return NULL;
+}
+
+/* cpu time of a process so far, in seconds; -1 if unknown */
+static double process_cpu(int pid) {
+
+    if (pid < 0)
+        return -1;
+
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = 0;
+
+    /* the command name may contain anything, fields follow the last ')' */
+    char *p = strrchr(buf, ')');
+    unsigned long utime, stime;
+    if (!p || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                     &utime, &stime) != 2)
+        return -1;
+
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double self_cpu(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void sleep_until(uint64_t t) {
+    struct timespec ts = { t / 1000000000ull, t % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void print_hist(const char *name, const Hist *h) {
+    printf("\"%s\":{\"count\":%llu,\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,"
+           "\"max\":%.1f}", name, (unsigned long long)h->count,
+           hist_quantile(h, 0.5) / 1e3, hist_quantile(h, 0.99) / 1e3,
+           hist_quantile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+#ifdef USE_SSL
+#define TLS_USAGE "  -x, --tls             connect with TLS (not verified)\n"
+#else
+#define TLS_USAGE ""
+#endif
+
+#ifdef HAVE_ZLIB
+#define ZLIB_USAGE "  -z, --compress        ask the server to compress\n"
+#else
+#define ZLIB_USAGE ""
+#endif
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -a, --address IP      server address (default %s)\n"
+            "  -c, --clients N       simulated clients (default 1000)\n"
+            "  -s, --senders N       of which send messages (default 10)\n"
+            "  -r, --rate N          messages per second, all senders (default 1000)\n"
+            "  -d, --duration S      measured seconds (default 10)\n"
+            "  -w, --warmup S        seconds of sending before that (default 2)\n"
+            "  -T, --threads N       load generator threads (default 2)\n"
+            "  -p, --pid PID         server process, to report its cpu use\n"
+            "  -l, --label TEXT      label of this run in the output\n"
+            TLS_USAGE
+            ZLIB_USAGE,
+            prog, SERVER_IP);
+}
+
+int main(int argc, char **argv) {
+
+    static const struct option options[] = {
+        { "address",  required_argument, NULL, 'a' },
+        { "clients",  required_argument, NULL, 'c' },
+        { "senders",  required_argument, NULL, 's' },
+        { "rate",     required_argument, NULL, 'r' },
+        { "duration", required_argument, NULL, 'd' },
+        { "warmup",   required_argument, NULL, 'w' },
+        { "threads",  required_argument, NULL, 'T' },
+        { "pid",      required_argument, NULL, 'p' },
+        { "label",    required_argument, NULL, 'l' },
+        { "tls",      no_argument,       NULL, 'x' },
+        { "compress", no_argument,       NULL, 'z' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:c:s:r:d:w:T:p:l:xzh", options, NULL)) != -1) {
+        switch (opt) {
+        case 'a': server_ip = optarg; break;
+        case 'c': clients = atoi(optarg); break;
+        case 's': senders = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'w': warmup = atoi(optarg); break;
+        case 'T': threads = atoi(optarg); break;
+        case 'p': server_pid = atoi(optarg); break;
+        case 'l': label = optarg; break;
+        case 'x': use_tls = 1; break;
+        case 'z': use_zlib = 1; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (clients <= 0 || senders < 0 || rate < 0 || duration <= 0 ||
+        warmup < 0 || threads <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+#ifdef USE_SSL
+    if (use_tls && tls_client_init(NULL, 0) < 0)
+        return 1;
+#else
+    if (use_tls) {
+        fprintf(stderr, "built without TLS (make USE_SSL=1)\n");
+        return 1;
+    }
+#endif
+
+#ifndef HAVE_ZLIB
+    if (use_zlib) {
+        fprintf(stderr, "built without zlib\n");
+        return 1;
+    }
+#endif
+
+    if (senders > clients)
+        senders = clients;
+    if (threads > clients)
+        threads = clients;
+
+    /* one descriptor per client */
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+        rl.rlim_cur < (rlim_t)clients + 64) {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)clients + 64
+                      ? rl.rlim_max : (rlim_t)clients + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    /* client g belongs to thread g % threads; the first `senders`
+       clients send, so every thread gets its share of them */
+    Worker *workers = calloc(threads, sizeof(*workers));
+    if (!workers) { perror("calloc"); return 1; }
+
+    for (int t = 0; t < threads; t++) {
+
+        Worker *w = &workers[t];
+        w->id = t;
+        w->count = (clients - t + threads - 1) / threads;
+        w->senders = (senders - t + threads - 1) / threads;
+        w->rate = senders ? rate * w->senders / senders : 0;
+
+        w->epfd = epoll_create1(0);
+        w->conns = calloc(w->count, sizeof(*w->conns));
+        if (w->epfd < 0 || !w->conns) { perror("worker"); return 1; }
+
+        for (int i = 0; i < w->count; i++) {
+            Conn *c = &w->conns[i];
+            c->fd = -1;
+            snprintf(c->name, sizeof(c->name), "bench%d", i * threads + t);
+            snprintf(c->joined, sizeof(c->joined), ":%s joined", c->name);
+            if (frame_decoder_init(&c->in, FRAME_MAX_PAYLOAD) < 0) {
+                perror("frame_decoder_init");
+                return 1;
+            }
+        }
+    }
+
+    for (int t = 0; t < threads; t++)
+        if (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+
+    /* everyone in (or given up on) */
+    uint64_t deadline = now_ns() + CONNECT_TIMEOUT_S * 1000000000ull;
+    while (atomic_load(&settled) < clients && now_ns() < deadline)
+        usleep(10000);
+
+    /* the timeline is published before start_ns */
+    uint64_t start = now_ns();
+    window_ns = start + warmup * 1000000000ull;
+    end_ns = window_ns + duration * 1000000000ull;
+    atomic_store(&start_ns, start);
+
+    sleep_until(window_ns);
+    double server0 = process_cpu(server_pid), self0 = self_cpu();
+
+    sleep_until(end_ns);
+    double server1 = process_cpu(server_pid), self1 = self_cpu();
+
+    sleep_until(end_ns + DRAIN_S * 1000000000ull);
+    atomic_store(&stop, 1);
+
+    Worker all;
+    memset(&all, 0, sizeof(all));
+
+    for (int t = 0; t < threads; t++) {
+        Worker *w = &workers[t];
+        pthread_join(w->thread, NULL);
+
+        all.sent += w->sent;
+        all.delivered += w->delivered;
+        all.skipped += w->skipped;
+        all.disconnects += w->disconnects;
+        all.join_rx += w->join_rx;
+        all.window_rx += w->window_rx;
+        hist_merge(&all.fanout, &w->fanout);
+        hist_merge(&all.join, &w->join);
+    }
+
+    /* everyone else never finished the handshake */
+    uint64_t live = all.join.count;
+    uint64_t expected = all.sent * live;
+
+    printf("{\"label\":\"%s\",\"tls\":%s,\"zlib\":%s,\"clients\":%d,\"live\":%llu,\"failed\":%llu,"
+           "\"senders\":%d,\"rate\":%.0f,\"duration\":%d,"
+           "\"sent\":%llu,\"delivered\":%llu,\"expected\":%llu,"
+           "\"skipped\":%llu,\"disconnects\":%llu,"
+           "\"msgs_per_sec\":%.1f,\"deliveries_per_sec\":%.1f,",
+           label, use_tls ? "true" : "false", use_zlib ? "true" : "false", clients, (unsigned long long)live,
+           (unsigned long long)(clients - live), senders, rate, duration,
+           (unsigned long long)all.sent, (unsigned long long)all.delivered,
+           (unsigned long long)expected, (unsigned long long)all.skipped,
+           (unsigned long long)all.disconnects,
+           all.sent / (double)duration, all.delivered / (double)duration);
+    print_hist("fanout_us", &all.fanout);
+    printf(",");
+    print_hist("join_us", &all.join);
+
+    /* wire bytes: a client's until it was in (the history, mostly),
+       and everyone's per second of the window */
+    printf(",\"join_bytes\":%.0f,\"rx_bytes_per_sec\":%.0f",
+           live ? all.join_rx / (double)live : 0.0,
+           all.window_rx / (double)duration);
+
+    if (server0 >= 0 && server1 >= 0)
+        printf(",\"server_cpu\":%.1f", (server1 - server0) / duration * 100);
+    else
+        printf(",\"server_cpu\":null");
+
+    printf(",\"bench_cpu\":%.1f}\n", (self1 - self0) / duration * 100);
+    fflush(stdout);
+
+    fprintf(stderr,
+            "%s%s%llu/%d clients in, join p99 %.1f ms, %.0f bytes; %.0f msg/s -> "
+            "%.0f deliveries/s (%.2f%% of expected), fan-out p50 %.1f us "
+            "p99 %.1f us p999 %.1f us\n",
+            label, *label ? ": " : "", (unsigned long long)live, clients,
+            hist_quantile(&all.join, 0.99) / 1e6,
+            live ? all.join_rx / (double)live : 0.0, all.sent / (double)duration,
+            all.delivered / (double)duration,
+            expected ? 100.0 * all.delivered / expected : 0.0,
+            hist_quantile(&all.fanout, 0.5) / 1e3,
+            hist_quantile(&all.fanout, 0.99) / 1e3,
+            hist_quantile(&all.fanout, 0.999) / 1e3);
+
+    return live == (uint64_t)clients ? 0 : 2;
+}
@@ -0,0 +1,69 @@
+#!/bin/sh
+# run chatbench against every event loop of ./server in turn and print
+# one JSON line per loop. extra arguments go to chatbench, e.g.
+#
+#   bench/compare.sh -c 1000 -s 10 -r 2000 -d 10 > results.jsonl
+#
+# SERVER_ARGS is passed to the server (e.g. "-t 4"). loops the server
+# cannot run (io_uring without liburing or on an old kernel) are
+# reported as skipped.
+#
+# with TLS=1 (server and chatbench built with `make USE_SSL=1`) every
+# readiness loop runs a second time over TLS with a throwaway
+# self-signed certificate, labelled "<loop>+tls": the difference is
+# what encryption costs.
+#
+# with COMPRESS=1 every readiness loop also runs with the server
+# compressing (chatbench -z), labelled "<loop>+zlib": compare
+# join_bytes, join_us and rx_bytes_per_sec. SERVER_ARGS="-H 1000
+# -b 1048576" makes the history replayed to every join count.
+
+cd "$(dirname "$0")/.." || exit 1
+
+logs=$(mktemp -d)
+certs=$(mktemp -d)
+trap 'rm -rf "$logs" "$certs"' EXIT
+
+if [ "$TLS" = 1 ]; then
+    openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+        -keyout "$certs/key.pem" -out "$certs/cert.pem" 2>/dev/null || exit 1
+fi
+
+# run: label, server options, chatbench options
+run() {
+
+    label=$1
+    server_opts=$2
+    shift 2
+
+    # a fresh log each time, so history replay costs the same
+    rm -rf "$logs"/*
+    ./server -m 100000 -L "$logs" $server_opts $SERVER_ARGS > /dev/null 2>&1 &
+    pid=$!
+    sleep 1
+
+    if ! kill -0 "$pid" 2>/dev/null; then
+        echo "{\"label\":\"$label\",\"skipped\":true}"
+        return
+    fi
+
+    ./bench/chatbench -p "$pid" -l "$label" "$@"
+
+    kill "$pid"
+    wait "$pid" 2>/dev/null
+}
+
+for loop in select poll epoll epoll-et uring; do
+
+    run "$loop" "-e $loop" "$@"
+
+    # the TLS handshake and records run on the readiness loops only
+    if [ "$TLS" = 1 ] && [ "$loop" != uring ]; then
+        run "$loop+tls" "-e $loop -x $certs/cert.pem -k $certs/key.pem" -x "$@"
+    fi
+
+    # io_uring sends queued buffers as they are, it never compresses
+    if [ "$COMPRESS" = 1 ] && [ "$loop" != uring ]; then
+        run "$loop+zlib" "-e $loop" -z "$@"
+    fi
+done
@@ -0,0 +1,101 @@
+/* conntable lookup benchmark.
+
+   fills a ConnTable with N fake connections and measures the average
+   cost of looking one up by fd, next to the linear scan over a plain
+   array that the epoll loop used before. the table's cost should stay
+   flat as N grows; the scan grows with N. */
+
+#include "../conntable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOOKUPS 2000000
+
+typedef struct {
+    int fd;
+    int payload;
+} FakeClient;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void) {
+
+    static const int sizes[] = { 10, 100, 1000, 10000, 100000 };
+
+    printf("%-10s %14s %14s\n", "clients", "table ns/op", "scan ns/op");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+
+        int n = sizes[s];
+
+        FakeClient *clients = malloc(n * sizeof(*clients));
+        int *probe = malloc(LOOKUPS * sizeof(*probe));
+
+        ConnTable t;
+        if (!clients || !probe || conntable_init(&t, n) < 0) {
+            perror("malloc");
+            return 1;
+        }
+
+        /* fds start after stdio, like real sockets */
+        for (int i = 0; i < n; i++) {
+            clients[i].fd = i + 3;
+            clients[i].payload = i;
+            conntable_add(&t, clients[i].fd, &clients[i]);
+        }
+
+        /* remove and re-add a few to exercise swap-with-last */
+        for (int i = 0; i < n; i += 7) {
+            conntable_remove(&t, clients[i].fd);
+            conntable_add(&t, clients[i].fd, &clients[i]);
+        }
+
+        srand(42);
+        for (int i = 0; i < LOOKUPS; i++)
+            probe[i] = rand() % n + 3;
+
+        /* ---- table lookup ---- */
+        long sum = 0;
+        double t0 = now_ns();
+
+        for (int i = 0; i < LOOKUPS; i++) {
+            FakeClient *c = conntable_get(&t, probe[i]);
+            sum += c->payload;
+        }
+
+        double table_ns = (now_ns() - t0) / LOOKUPS;
+
+        /* ---- linear scan (fewer rounds, it is slow) ---- */
+        int scans = LOOKUPS / (n / 10 + 1);
+        double t1 = now_ns();
+
+        for (int i = 0; i < scans; i++) {
+            int k;
+            for (k = 0; k < n; k++) {
+                if (clients[k].fd == probe[i])
+                    break;
+            }
+            sum += clients[k].payload;
+        }
+
+        double scan_ns = (now_ns() - t1) / scans;
+
+        printf("%-10d %14.2f %14.2f\n", n, table_ns, scan_ns);
+
+        /* keep the compiler from dropping the loops */
+        if (sum == 42)
+            printf("\n");
+
+        conntable_free(&t);
+        free(clients);
+        free(probe);
+    }
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+/* timer wheel benchmark.
+
+   N connections, each with one timer set 30 to 90 seconds ahead
+   (a ping or idle timeout); a timer that fires is set again, like a
+   heartbeat. the clock runs in 1 ms ticks, and every tick a few
+   connections get input and move their timer, as a busy chat does.
+   reports the average cost of a tick and of moving a timer, next to
+   checking every connection's deadline each tick, which is what an
+   event loop without timers of its own would do. the wheel's tick
+   should stay flat as N grows; the scan grows with N. */
+
+#include "../timerwheel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* simulated ms, for the wheel and for the scan */
+#define WHEEL_TICKS 600000
+#define SCAN_TICKS  2000
+
+/* connections with input per tick */
+#define INPUTS 8
+
+typedef struct {
+    Timer timer;
+    uint64_t deadline;  /* the same, for the scan */
+    unsigned fired;
+} FakeConn;
+
+static TimerWheel wheel;
+static uint64_t now;
+static unsigned long fired;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* 30 to 90 seconds from now */
+static uint64_t later(void) {
+    return now + 30000 + rand() % 60000;
+}
+
+static void expire(void *arg) {
+
+    FakeConn *c = arg;
+    c->fired++;
+    fired++;
+    timer_set(&wheel, &c->timer, later());
+}
+
+int main(void) {
+
+    static const int sizes[] = { 100, 1000, 10000, 100000 };
+
+    printf("%-10s %14s %14s %14s\n",
+           "timers", "wheel ns/tick", "set ns/op", "scan ns/tick");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+
+        int n = sizes[s];
+
+        FakeConn *conns = calloc(n, sizeof(*conns));
+        if (!conns) {
+            perror("calloc");
+            return 1;
+        }
+
+        srand(42);
+        now = 0;
+        fired = 0;
+        timerwheel_init(&wheel, now);
+
+        for (int i = 0; i < n; i++) {
+            timer_init(&conns[i].timer, expire, &conns[i]);
+            timer_set(&wheel, &conns[i].timer, 1 + rand() % 90000);
+        }
+
+        /* ticks, with a few timers moved by input in between */
+        double set_ns = 0, t0 = now_ns();
+
+        for (int k = 0; k < WHEEL_TICKS; k++) {
+
+            now++;
+
+            double t1 = now_ns();
+            for (int j = 0; j < INPUTS; j++)
+                timer_set(&wheel, &conns[rand() % n].timer, later());
+            set_ns += now_ns() - t1;
+
+            timerwheel_advance(&wheel, now);
+        }
+
+        double wheel_ns = now_ns() - t0 - set_ns;
+        unsigned long wheel_fired = fired;
+
+        /* the same with a deadline per connection, all checked */
+        srand(42);
+        now = 0;
+        fired = 0;
+
+        for (int i = 0; i < n; i++)
+            conns[i].deadline = 1 + rand() % 90000;
+
+        t0 = now_ns();
+
+        for (int k = 0; k < SCAN_TICKS; k++) {
+
+            now++;
+
+            for (int j = 0; j < INPUTS; j++)
+                conns[rand() % n].deadline = later();
+
+            for (int i = 0; i < n; i++) {
+                if (conns[i].deadline <= now) {
+                    conns[i].fired++;
+                    fired++;
+                    conns[i].deadline = later();
+                }
+            }
+        }
+
+        double scan_ns = now_ns() - t0;
+
+        printf("%-10d %14.1f %14.1f %14.1f\n", n,
+               wheel_ns / WHEEL_TICKS,
+               set_ns / ((double)WHEEL_TICKS * INPUTS),
+               scan_ns / SCAN_TICKS);
+
+        /* keep the work from being optimized away */
+        if (wheel_fired == 0 && fired == (unsigned long)-1)
+            printf("\n");
+
+        free(conns);
+    }
+
+    return 0;
+}
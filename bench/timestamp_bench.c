@@ -0,0 +1,62 @@
+/* timestamp formatting benchmark.
+
+   formats LOOPS timestamps the way every chat line used to get one
+   (time() + localtime() + strftime()) and with the cached
+   format_timestamp() in each format. the cached cost should be a
+   small constant, independent of the format. */
+
+#include "../helpers.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define LOOPS 5000000
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void) {
+
+    static const struct { int format; const char *name; } formats[] = {
+        { TS_CHAT, "chat" }, { TS_MS, "ms" },
+        { TS_DATE, "date" }, { TS_ISO, "iso" }
+    };
+
+    char out[TIMESTAMP_MAX];
+    size_t sum = 0;
+
+    printf("%-22s %10s  %s\n", "formatter", "ns/op", "example");
+
+    /* ---- the old way ---- */
+    double t0 = now_ns();
+
+    for (int i = 0; i < LOOPS; i++) {
+        time_t now = time(NULL);
+        struct tm *t = localtime(&now);
+        sum += strftime(out, sizeof(out), "[%H:%M%p]", t);
+    }
+
+    printf("%-22s %10.2f  %s\n", "localtime+strftime",
+           (now_ns() - t0) / LOOPS, out);
+
+    /* ---- cached ---- */
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+
+        double t1 = now_ns();
+
+        for (int i = 0; i < LOOPS; i++)
+            sum += format_timestamp(formats[f].format, out, sizeof(out));
+
+        printf("format_timestamp %-5s %10.2f  %s\n", formats[f].name,
+               (now_ns() - t1) / LOOPS, out);
+    }
+
+    /* keep the compiler from dropping the loops */
+    if (sum == 42)
+        printf("\n");
+
+    return 0;
+}
@@ -1,37 +1,152 @@
 #include "helpers.h"
+#include "poller.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 
-#include <sys/select.h>
-#include <poll.h>
-#include <sys/epoll.h>
+#ifdef USE_SSL
+#include "tls.h"
+#endif
+
+#ifdef HAVE_ZLIB
+#include "zstream.h"
+#endif
 
 /* TODO
 
-command line parameters – server IP/port, name, log file, select/poll/epoll selection.
+command line parameters – server port, name, log file.
 
 command interface – the same /quit, /msg, /nick, /help; parse them locally and do not 
 search for them via the server.
 
-reconnect/timeout implementation – if the connection is lost, try to reconnect several 
-times; timeouts for connect/recv.
+reconnect – if the connection is lost, try to reconnect several times (connect and
+recv already time out, see NET_TIMEOUT).
 
 input editing and history – interactive input with history (readline can be used).
 
-Encryption/authentication – the client should initiate TLS and transmit login/password.
+Authentication – transmit login/password (TLS is there with USE_SSL, see -x).
 
 Visual improvements – colors, notifications, local log (so as not to lose text if the server 
 is down).
 */
 
+/* connecting, and every blocking receive until the chat starts (the
+   TLS handshake, the hello reply, the history), gives up after this
+   many seconds */
+#define NET_TIMEOUT 10
+
+#ifdef USE_SSL
+/* the session with the server, NULL on a plain connection */
+static Tls *tls;
+#endif
+
+#ifdef HAVE_ZLIB
+/* decompresses what the server sends, once it agreed to (HELLO_ZLIB) */
+static ZIn *zin;
+#endif
+
+/* recv() from the server, decrypted with TLS */
+static ssize_t raw_recv(int fd, void *buf, size_t len) {
+
+#ifdef USE_SSL
+    if (tls)
+        return tls_recv(tls, buf, len);
+#endif
+
+    return recv(fd, buf, len, 0);
+}
+
+/* what the server sent, as raw_recv() but decompressed on a
+   compressed connection. history and messages both come this way. */
+static ssize_t net_recv(int fd, void *buf, size_t len) {
+
+#ifdef HAVE_ZLIB
+    if (zin) {
+        /* part of a compressed block decompresses to nothing yet */
+        while (zin_ready(zin) == 0) {
+
+            char raw[16 * BUFFER_SIZE];
+            ssize_t n = raw_recv(fd, raw, sizeof(raw));
+            if (n <= 0)
+                return n;
+
+            if (zin_feed(zin, raw, n) < 0) {
+                errno = EPROTO;
+                return -1;
+            }
+        }
+
+        return zin_take(zin, buf, len);
+    }
+#endif
+
+    return raw_recv(fd, buf, len);
+}
+
+/* exactly len bytes from the server */
+static int net_recv_all(int fd, void *buf, size_t len) {
+
+    for (size_t got = 0; got < len; ) {
+        ssize_t n = net_recv(fd, (char *)buf + got, len - got);
+        if (n <= 0)
+            return -1;
+        got += n;
+    }
+
+    return 0;
+}
+
+/* send all of buf to the server, encrypted with TLS */
+static int net_send(int fd, const void *buf, size_t len) {
+
+#ifdef USE_SSL
+    if (tls) {
+        for (size_t sent = 0; sent < len; ) {
+            struct iovec iov = { (char *)buf + sent, len - sent };
+            ssize_t n = tls_sendmsg(tls, &iov, 1, 0);
+            if (n < 0)
+                return -1;
+            sent += n;
+        }
+        return tls_flush(tls) == 0 ? 0 : -1;
+    }
+#endif
+
+    return send_all(fd, buf, len) < 0 ? -1 : 0;
+}
+
+/* TLS decrypted (or zlib decompressed) more than was read; the
+   socket will not say so */
+static int net_pending(void) {
+
+#ifdef HAVE_ZLIB
+    if (zin && zin_ready(zin) > 0)
+        return 1;
+#endif
+
+#ifdef USE_SSL
+    if (tls)
+        return tls_pending(tls) > 0;
+#endif
+
+    return 0;
+}
+
+/* the history: its size as a long, then its text. on a compressed
+   connection both come decompressed from net_recv(). */
 int receive_file(int fd) {
 
     long filesize;
 
     /* receive file size first */
-    if (recv_all(fd, &filesize, sizeof(filesize)) < 0)
+    if (net_recv_all(fd, &filesize, sizeof(filesize)) < 0)
         return -1;
 
     long received = 0;
@@ -39,11 +154,10 @@ int receive_file(int fd) {
 
     while (received < filesize) {
 
-        ssize_t n = recv(fd, buffer,
-                         (filesize - received > BUFFER_SIZE)
-                         ? BUFFER_SIZE
-                         : filesize - received,
-                         0);
+        ssize_t n = net_recv(fd, buffer,
+                             (filesize - received > BUFFER_SIZE)
+                             ? BUFFER_SIZE
+                             : filesize - received);
 
         if (n <= 0)
             return -1;
@@ -67,381 +181,519 @@ int receive_file(int fd) {
     return 0;
 }
 
-void run_client_select(const char *server_ip) {
-
-    /* create tcp socket */
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) { perror("socket"); exit(1); }
-
-    /* configure server address */
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(SERVER_PORT);
-    //char *server_ip = "192.168.0.103"; 
-    inet_pton(AF_INET, server_ip, &addr.sin_addr);
-
-    /* connect to server */
-    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("connect"); exit(1);
-    }
-
-    /* prepare client struct that will be sent to server */
-    Client me;
-    memset(&me, 0, sizeof(me));
+/* the screen is redrawn at most this often while messages pour in */
+#define RENDER_MS 33
+
+/* more unrendered output than this is drawn at once */
+#define RENDER_MAX (256 * 1024)
+
+#define PROMPT "You: "
+
+/* the terminal: messages received since the last redraw and the
+   line the user is typing. everything that arrives within one
+   wakeup (or one RENDER_MS) is drawn by a single write, together
+   with one prompt, so a busy room costs one redraw per frame
+   instead of one per message, and the typed line stays put. */
+typedef struct {
+    char *out;              /* messages not drawn yet */
+    size_t len, cap;
+    char line[BUFFER_SIZE]; /* what the user typed so far */
+    size_t line_len;
+    int raw;                /* we echo the line (stdin is a terminal) */
+    int esc;                /* inside an escape sequence from the keys */
+    int redraw;             /* the typed line changed */
+    uint64_t last;          /* ms of the last redraw */
+} Screen;
+
+static struct termios saved_tty;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    /* ask user for name */
-    printf("Name: ");
-    fgets(me.name, MAX_NAME, stdin);
+static void restore_tty(void) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_tty);
+}
 
-    /* remove trailing newline */
-    me.name[strcspn(me.name, "\n")] = 0;
+/* key by key input without echo, so the typed line can be redrawn
+   below incoming messages. Ctrl-C arrives as a key too, which lets
+   us put the terminal back on the way out. */
+static int raw_tty(void) {
 
-    /* store server ip (for now we just reuse SERVER_IP) */
-    strcpy(me.ip, SERVER_IP);
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_tty) < 0)
+        return 0;
 
-    /* send client metadata to server */
-    send_all(sock, &me, sizeof(me));
+    struct termios t = saved_tty;
+    t.c_lflag &= ~(ICANON | ECHO | ISIG);
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
 
-    printf("Connected. Start chatting.\n\n");
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &t) < 0)
+        return 0;
 
-    /* receive chat history file */
-    receive_file(sock);
+    atexit(restore_tty);
+    return 1;
+}
 
-    printf("\nYou: ");
-    fflush(stdout);
+/* queue text for the next redraw */
+static void screen_add(Screen *scr, const char *text, size_t len) {
 
-    while (1) {
+    if (scr->len + len > scr->cap) {
+        size_t cap = scr->cap ? scr->cap : 4096;
+        while (cap < scr->len + len)
+            cap *= 2;
 
-        /* prepare fd_set for select */
+        char *out = realloc(scr->out, cap);
+        if (!out)
+            return;
 
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
+        scr->out = out;
+        scr->cap = cap;
+    }
 
-        /* monitor stdin */
-        FD_SET(STDIN_FILENO, &read_fds);
+    memcpy(scr->out + scr->len, text, len);
+    scr->len += len;
+}
 
-        /* monitor socket */
-        FD_SET(sock, &read_fds);
+/* clear the prompt line, print what arrived, draw the prompt and the
+   typed line again: one write */
+static void screen_render(Screen *scr) {
 
-        /* select requires highest fd + 1 */
-        int max_fd = (sock > STDIN_FILENO) ? sock : STDIN_FILENO;
+    struct iovec iov[4] = {
+        { "\r\033[2K", 5 },
+        { scr->out, scr->len },
+        { PROMPT, sizeof(PROMPT) - 1 },
+        { scr->line, scr->raw ? scr->line_len : 0 }
+    };
 
-        /* wait for input from either stdin or socket */
-        if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0)
-            break;
+    writev_all(STDOUT_FILENO, iov, 4);
 
-        /* ---------- user input ---------- */
-        if (FD_ISSET(STDIN_FILENO, &read_fds)) {
+    scr->len = 0;
+    scr->redraw = 0;
+    scr->last = now_ms();
+}
 
-            char buf[BUFFER_SIZE];
+/* how long the loop may sleep: forever with nothing to draw, else
+   until the next redraw is allowed */
+static int screen_wait(const Screen *scr) {
 
-            /* read line from stdin */
-            if (!fgets(buf, sizeof(buf), stdin))
-                break;
+    if (scr->len == 0 && !scr->redraw)
+        return -1;
 
-            /* strip newline */
-            buf[strcspn(buf, "\n")] = 0;
+    uint64_t due = scr->last + RENDER_MS, now = now_ms();
+    return (scr->redraw || scr->len > RENDER_MAX || now >= due)
+           ? 0 : (int)(due - now);
+}
 
-            /* ignore empty messages */
-            if (strlen(buf) == 0) {
-                printf("You: ");
-                fflush(stdout);
-                continue;
-            }
+/* redraw if something waits and it is time (typing never waits) */
+static void screen_update(Screen *scr) {
+    if (screen_wait(scr) == 0)
+        screen_render(scr);
+}
 
-            /* move cursor one line up and clear the old prompt line
-               this removes "You: <message>" */
-            printf("\033[A\r\033[2K");
-            fflush(stdout);
+/* read what the server sent and queue every complete message for
+   the screen, answering pings on the way. one recv may carry several
+   messages or only part of one. returns -1 when the connection is
+   gone. */
+int read_server(int sock, FrameDecoder *in, Screen *scr) {
 
-            /* send raw message to server
-               server will format and broadcast it back */
-            if (send_all(sock, buf, strlen(buf)) < 0)
-                break;
-        }
+    /* with TLS, until nothing decrypted is left over */
+    do {
+        size_t avail;
+        char *p = frame_decoder_space(in, &avail);
 
-        /* ---------- incoming message from server ---------- */
-        if (FD_ISSET(sock, &read_fds)) {
+        ssize_t n = avail ? net_recv(sock, p, avail) : -1;
+        if (n <= 0)
+            return -1;
 
-            char buf[BUFFER_SIZE];
+        frame_decoder_commit(in, n);
 
-            /* read data from server */
-            ssize_t n = recv(sock, buf, sizeof(buf) - 1, 0);
-            if (n <= 0)
-                break;
+        uint8_t type;
+        const char *payload;
+        size_t len;
+        int r;
 
-            buf[n] = '\0';
+        while ((r = frame_decoder_next(in, &type, &payload, &len)) > 0) {
 
-            /* clear current prompt line before printing message */
-            printf("\r\033[2K");
+            /* the server checks we are still here */
+            if (type == FRAME_PING) {
+                char pong[FRAME_HEADER_SIZE];
+                frame_header(pong, FRAME_PONG, 0);
+                if (net_send(sock, pong, sizeof(pong)) < 0)
+                    return -1;
+                continue;
+            }
 
-            /* print formatted message (already includes timestamp and name) */
-            printf("%s", buf);
+            if (type != FRAME_TEXT)
+                continue;
 
-            /* draw new prompt at the bottom */
-            printf("You: ");
-            fflush(stdout);
+            /* formatted message (already includes timestamp and name) */
+            screen_add(scr, payload, len);
         }
-    }
-
-    close(sock);
-}
-
-void run_client_poll(void) {
-    /* create tcp socket */
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) { perror("socket"); exit(1); }
-
-    /* configure server address */
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(SERVER_PORT);
-    inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
-
-    /* connect to server */
-    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("connect"); exit(1);
-    }
 
-    /* prepare client struct that will be sent to server */
-    Client me;
-    memset(&me, 0, sizeof(me));
-
-    /* ask user for name */
-    printf("Name: ");
-    fgets(me.name, MAX_NAME, stdin);
+        if (r < 0)
+            return -1;
 
-    /* remove trailing newline */
-    me.name[strcspn(me.name, "\n")] = 0;
+    } while (net_pending());
 
-    /* store server ip (for now we just reuse SERVER_IP) */
-    strcpy(me.ip, SERVER_IP);
+    return 0;
+}
 
-    /* send client metadata to server */
-    send_all(sock, &me, sizeof(me));
-
-    /* poll two descriptors:
-       0  -> stdin
-       sock -> server socket */
-    struct pollfd fds[2];
-    fds[0].fd = 0;      /* stdin */
-    fds[0].events = POLLIN;
-    fds[1].fd = sock;   /* socket */
-    fds[1].events = POLLIN;
-
-    printf("Connected. Start chatting.\n\n");
-    receive_file(sock);
-    printf("\nYou: ");
-    fflush(stdout);
+/* the line is done: send it. the server formats it and sends it
+   back, so it shows up like everyone else's. returns -1 if the
+   connection is gone. */
+static int send_line(int sock, const char *line, size_t len) {
 
-    while (1) {
+    /* ignore empty messages */
+    if (len == 0)
+        return 0;
 
-        /* wait for input from either stdin or socket */
-        if (poll(fds, 2, -1) < 0)
-            break;
+    char frame[FRAME_HEADER_SIZE + BUFFER_SIZE];
+    if (len > BUFFER_SIZE)
+        len = BUFFER_SIZE;
 
-        /* ---------- user input ---------- */
-        if (fds[0].revents & POLLIN) {
+    frame_header(frame, FRAME_TEXT, len);
+    memcpy(frame + FRAME_HEADER_SIZE, line, len);
 
-            char buf[BUFFER_SIZE];
+    return net_send(sock, frame, FRAME_HEADER_SIZE + len);
+}
 
-            /* read line from stdin */
-            if (!fgets(buf, sizeof(buf), stdin))
-                break;
+/* keys typed in raw mode: edit the line, send it on enter.
+   returns -1 to quit. */
+static int read_keys(int sock, Screen *scr) {
 
-            /* strip newline */
-            buf[strcspn(buf, "\n")] = 0;
+    char keys[256];
+    ssize_t n = read(STDIN_FILENO, keys, sizeof(keys));
+    if (n <= 0)
+        return -1;
 
-            /* ignore empty messages */
-            if (strlen(buf) == 0) {
-                printf("You: ");
-                fflush(stdout);
-                continue;
-            }
+    for (ssize_t k = 0; k < n; k++) {
 
-            /* move cursor one line up and clear the old prompt line
-               this removes "You: <message>" */
-            printf("\033[A\r\033[2K");
-            fflush(stdout);
+        unsigned char ch = keys[k];
 
-            /* send raw message to server
-               server will format and broadcast it back */
-            if (send_all(sock, buf, strlen(buf)) < 0)
-                break;
+        /* arrows and the like: ESC [ ... letter, not supported */
+        if (scr->esc) {
+            if (scr->esc == 1 && ch != '[' && ch != 'O')
+                scr->esc = 0;
+            else if (scr->esc > 1 && ch >= 0x40 && ch <= 0x7E)
+                scr->esc = 0;
+            else
+                scr->esc = 2;
+            continue;
         }
 
-        /* ---------- incoming message from server ---------- */
-        if (fds[1].revents & POLLIN) {
+        scr->redraw = 1;
+
+        if (ch == '\r' || ch == '\n') {
+            if (send_line(sock, scr->line, scr->line_len) < 0)
+                return -1;
+            scr->line_len = 0;
+        } else if (ch == 127 || ch == '\b') {
+            /* a whole utf-8 character */
+            while (scr->line_len > 0 &&
+                   (scr->line[--scr->line_len] & 0xC0) == 0x80)
+                ;
+        } else if (ch == 3 || (ch == 4 && scr->line_len == 0)) {
+            return -1;                          /* Ctrl-C, Ctrl-D */
+        } else if (ch == 21) {
+            scr->line_len = 0;                  /* Ctrl-U */
+        } else if (ch == 27) {
+            scr->esc = 1;
+        } else if (ch >= ' ' && scr->line_len < sizeof(scr->line) - 1) {
+            scr->line[scr->line_len++] = ch;
+        }
+    }
 
-            char buf[BUFFER_SIZE];
+    return 0;
+}
 
-            /* read data from server */
-            ssize_t n = recv(sock, buf, sizeof(buf) - 1, 0);
-            if (n <= 0)
-                break;
+/* a line from stdin that is not a terminal */
+static int read_line(int sock) {
 
-            buf[n] = '\0';
+    char buf[BUFFER_SIZE];
 
-            /* clear current prompt line before printing message */
-            printf("\r\033[2K");
+    if (!fgets(buf, sizeof(buf), stdin))
+        return -1;
 
-            /* print formatted message (already includes timestamp and name) */
-            printf("%s", buf);
+    /* strip newline */
+    buf[strcspn(buf, "\n")] = 0;
 
-            /* draw new prompt at the bottom */
-            printf("You: ");
-            fflush(stdout);
-        }
-    }
-
-    close(sock);
+    return send_line(sock, buf, strlen(buf));
 }
 
-void run_client_epoll(void) {
+void run_client(const char *server_ip, int backend, int use_tls,
+                int compress) {
 
     /* create tcp socket */
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) { perror("socket"); exit(1); }
 
+    /* an unreachable or stuck server is an error, not a hang */
+    struct timeval tv = { NET_TIMEOUT, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
     /* configure server address */
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_port = htons(SERVER_PORT);
-    inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+    if (inet_pton(AF_INET, server_ip, &addr.sin_addr) != 1) {
+        fprintf(stderr, "bad server address: %s\n", server_ip);
+        exit(1);
+    }
 
     /* connect to server */
     if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         perror("connect"); exit(1);
     }
 
+#ifdef USE_SSL
+    /* encrypted before anything else is said */
+    if (use_tls) {
+        int want_write;
+        tls = tls_new(sock, 0, server_ip);
+        if (!tls || tls_handshake(tls, &want_write) != 1) {
+            fprintf(stderr, "TLS handshake with %s failed\n", server_ip);
+            exit(1);
+        }
+    }
+#else
+    (void)use_tls;
+#endif
+
     /* prepare client struct that will be sent to server */
     Client me;
     memset(&me, 0, sizeof(me));
 
     /* ask user for name */
     printf("Name: ");
-    fgets(me.name, MAX_NAME, stdin);
+    if (!fgets(me.name, MAX_NAME, stdin))
+        exit(1);
 
     /* remove trailing newline */
     me.name[strcspn(me.name, "\n")] = 0;
 
     /* store server ip */
-    strcpy(me.ip, SERVER_IP);
+    snprintf(me.ip, sizeof(me.ip), "%s", server_ip);
+
+    /* a quiet connection is pinged, not dropped */
+    me.flags |= HELLO_PING;
+
+#ifdef HAVE_ZLIB
+    if (compress)
+        me.flags |= HELLO_ZLIB;
+#else
+    (void)compress;
+#endif
 
     /* send client metadata to server */
-    send_all(sock, &me, sizeof(me));
+    net_send(sock, &me, sizeof(me));
+
+    /* asked for something: the server says what it agreed to */
+    uint8_t granted = 0;
+    errno = 0;
+    if (me.flags && net_recv_all(sock, &granted, 1) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            fprintf(stderr, "no answer from the server in %d s\n", NET_TIMEOUT);
+        else
+            fprintf(stderr, "connection closed by the server\n");
+        exit(1);
+    }
+
+#ifdef HAVE_ZLIB
+    /* everything from here on is one compressed stream */
+    if (granted & HELLO_ZLIB) {
+        zin = zin_new();
+        if (!zin) { perror("zin_new"); exit(1); }
+    }
+#endif
 
-    printf("Connected. Start chatting.\n\n");
+    int compressed = granted & HELLO_ZLIB;
+    printf("Connected%s. Start chatting.\n\n",
+           use_tls && compressed ? " (TLS, compressed)" :
+           use_tls ? " (TLS)" : compressed ? " (compressed)" : "");
 
+    /* receive chat history file */
     receive_file(sock);
 
-    printf("\nYou: ");
-    fflush(stdout);
+    /* from here on reads follow readiness. the rest of a compressed
+       block or TLS record may take a while on a quiet connection,
+       and that is no reason to give up on it. */
+    struct timeval forever = { 0, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &forever, sizeof(forever));
 
-    /* create epoll instance */
-    int epfd = epoll_create1(0);
-    if (epfd < 0) { perror("epoll_create1"); exit(1); }
+    /* buffered input from the server, split into messages */
+    FrameDecoder in;
+    if (frame_decoder_init(&in, FRAME_MAX_PAYLOAD) < 0) {
+        perror("malloc"); exit(1);
+    }
 
-    struct epoll_event ev;
+    /* watch stdin (NULL) and the socket (its decoder) */
+    Poller *p = poller_new(backend);
+    if (!p) { perror("poller_new"); exit(1); }
 
-    /* register stdin */
-    ev.events = EPOLLIN;
-    ev.data.fd = STDIN_FILENO;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) < 0) {
-        perror("epoll_ctl stdin"); exit(1);
+    if (poller_add(p, STDIN_FILENO, POLLER_IN, NULL) < 0 ||
+        poller_add(p, sock, POLLER_IN, &in) < 0) {
+        perror("poller_add"); exit(1);
     }
 
-    /* register socket */
-    ev.events = EPOLLIN;
-    ev.data.fd = sock;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
-        perror("epoll_ctl sock"); exit(1);
-    }
+    PollerEvent events[2];
 
-    struct epoll_event events[2];
+    Screen scr;
+    memset(&scr, 0, sizeof(scr));
+    scr.raw = raw_tty();
 
-    int running = 1;
+    printf("\n" PROMPT);
+    fflush(stdout);
+
+    /* messages that came in the record with the end of the history */
+    int running = !net_pending() || read_server(sock, &in, &scr) == 0;
 
     while (running) {
 
-        int nfds = epoll_wait(epfd, events, 2, -1);
+        /* wait for input from either stdin or socket, or until
+           received messages may be drawn */
+        int nfds = poller_wait(p, events, 2, screen_wait(&scr));
         if (nfds < 0)
             break;
 
-        for (int i = 0; i < nfds; i++) {
-
-            int current_fd = events[i].data.fd;
+        for (int i = 0; i < nfds && running; i++) {
 
             /* ---------- user input ---------- */
-            if (current_fd == STDIN_FILENO) {
-
-                char buf[BUFFER_SIZE];
+            if (!events[i].ptr) {
 
-                if (!fgets(buf, sizeof(buf), stdin)) {
+                if ((scr.raw ? read_keys(sock, &scr) : read_line(sock)) < 0)
                     running = 0;
-                    break;
-                }
-
-                buf[strcspn(buf, "\n")] = 0;
-
-                if (strlen(buf) == 0) {
-                    printf("You: ");
-                    fflush(stdout);
-                    continue;
-                }
+            }
 
-                /* remove old prompt line */
-                printf("\033[A\r\033[2K");
-                fflush(stdout);
+            /* ---------- incoming message from server ---------- */
+            else {
 
-                if (send_all(sock, buf, strlen(buf)) < 0) {
+                /* read data from server, queue complete messages */
+                if (read_server(sock, &in, &scr) < 0)
                     running = 0;
-                    break;
-                }
             }
+        }
 
-            /* ---------- incoming message ---------- */
-            else if (current_fd == sock) {
-
-                char buf[BUFFER_SIZE];
-
-                ssize_t n = recv(sock, buf, sizeof(buf) - 1, 0);
-                if (n <= 0) {
-                    running = 0;
-                    break;
-                }
+        /* everything this wakeup brought, in one write */
+        screen_update(&scr);
+    }
 
-                buf[n] = '\0';
+    /* what arrived last, and leave the prompt line */
+    screen_render(&scr);
+    printf("\n");
+
+    free(scr.out);
+    poller_free(p);
+    frame_decoder_free(&in);
+#ifdef USE_SSL
+    tls_free(tls);
+#endif
+#ifdef HAVE_ZLIB
+    zin_free(zin);
+#endif
+    close(sock);
+}
 
-                /* clear current prompt line */
-                printf("\r\033[2K");
+#ifdef USE_SSL
+#define TLS_USAGE \
+    "  -x, --tls             connect with TLS\n" \
+    "  -C, --ca FILE         trust the server certificate in FILE (PEM),\n" \
+    "                        e.g. a self-signed one; implies --tls\n"
+#define TLS_OPTIONS "xC:"
+#else
+#define TLS_USAGE ""
+#define TLS_OPTIONS ""
+#endif
+
+#ifdef HAVE_ZLIB
+#define ZLIB_USAGE \
+    "  -n, --no-compress     do not ask the server to compress\n"
+#define ZLIB_OPTIONS "n"
+#else
+#define ZLIB_USAGE ""
+#define ZLIB_OPTIONS ""
+#endif
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options] <server_ip>\n"
+            "  -e, --event-loop NAME select, poll or epoll (default select)\n"
+            TLS_USAGE
+            ZLIB_USAGE,
+            prog);
+}
 
-                printf("%s", buf);
+int main(int argc, char** argv) {
 
-                printf("You: ");
-                fflush(stdout);
+    static const struct option options[] = {
+        { "event-loop", required_argument, NULL, 'e' },
+#ifdef USE_SSL
+        { "tls",        no_argument,       NULL, 'x' },
+        { "ca",         required_argument, NULL, 'C' },
+#endif
+#ifdef HAVE_ZLIB
+        { "no-compress", no_argument,      NULL, 'n' },
+#endif
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    /* select also works when stdin is a file, which epoll refuses */
+    int backend = POLLER_SELECT;
+
+    /* --tls, --ca */
+    int use_tls = 0;
+    const char *ca = NULL;
+
+    /* compression is asked for unless --no-compress */
+    int compress = 1;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "e:" TLS_OPTIONS ZLIB_OPTIONS "h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'e':
+            backend = poller_backend(optarg);
+
+            /* the client reads once per readiness event, which an
+               edge triggered poller would not repeat */
+            if (backend < 0 || backend == POLLER_EPOLL_ET) {
+                usage(argv[0]);
+                return 1;
             }
+            break;
+        case 'C':
+            ca = optarg;
+            use_tls = 1;
+            break;
+        case 'x':
+            use_tls = 1;
+            break;
+        case 'n':
+            compress = 0;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
         }
     }
 
-    close(sock);
-    close(epfd);
-}
-
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        printf("Usage: %s <server_ip>\n", argv[0]);
+    if (optind >= argc) {
+        usage(argv[0]);
         return 1;
     }
 
-    char *server_ip = argv[1];
+#ifdef USE_SSL
+    if (use_tls && tls_client_init(ca, 1) < 0)
+        return 1;
+#else
+    (void)ca;
+#endif
+
+    run_client(argv[optind], backend, use_tls, compress);
 
-    run_client_select(server_ip);
-    // run_client_poll();
-    // run_client_epoll();
-    
     return 0;
-}
\ No newline at end of file
+}
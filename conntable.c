@@ -0,0 +1,96 @@
+#include "conntable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* starting sizes; both arrays double on demand */
+#define INITIAL_ENTRIES 16
+#define INITIAL_FDS     64
+
+int conntable_init(ConnTable *t, int limit) {
+
+    memset(t, 0, sizeof(*t));
+    t->limit = limit;
+
+    t->entries = malloc(INITIAL_ENTRIES * sizeof(*t->entries));
+    t->slot_of_fd = malloc(INITIAL_FDS * sizeof(*t->slot_of_fd));
+
+    if (!t->entries || !t->slot_of_fd) {
+        conntable_free(t);
+        return -1;
+    }
+
+    t->cap = INITIAL_ENTRIES;
+    t->fd_cap = INITIAL_FDS;
+
+    /* -1 everywhere: no fd is in use yet */
+    memset(t->slot_of_fd, 0xFF, INITIAL_FDS * sizeof(*t->slot_of_fd));
+    return 0;
+}
+
+void conntable_free(ConnTable *t) {
+    free(t->entries);
+    free(t->slot_of_fd);
+    memset(t, 0, sizeof(*t));
+}
+
+/* make slot_of_fd large enough to index fd */
+static int grow_fds(ConnTable *t, int fd) {
+
+    int cap = t->fd_cap;
+    while (cap <= fd)
+        cap *= 2;
+
+    int *s = realloc(t->slot_of_fd, cap * sizeof(*s));
+    if (!s)
+        return -1;
+
+    memset(s + t->fd_cap, 0xFF, (cap - t->fd_cap) * sizeof(*s));
+    t->slot_of_fd = s;
+    t->fd_cap = cap;
+    return 0;
+}
+
+int conntable_add(ConnTable *t, int fd, void *ptr) {
+
+    if (fd < 0 || conntable_full(t))
+        return -1;
+
+    if (fd >= t->fd_cap && grow_fds(t, fd) < 0)
+        return -1;
+
+    if (t->slot_of_fd[fd] >= 0)
+        return -1;
+
+    if (t->count == t->cap) {
+        ConnEntry *e = realloc(t->entries, t->cap * 2 * sizeof(*e));
+        if (!e)
+            return -1;
+        t->entries = e;
+        t->cap *= 2;
+    }
+
+    t->entries[t->count].fd = fd;
+    t->entries[t->count].ptr = ptr;
+    t->slot_of_fd[fd] = t->count;
+    t->count++;
+    return 0;
+}
+
+void conntable_remove(ConnTable *t, int fd) {
+
+    if (fd < 0 || fd >= t->fd_cap)
+        return;
+
+    int slot = t->slot_of_fd[fd];
+    if (slot < 0)
+        return;
+
+    /* move the last entry into the hole and fix its fd mapping */
+    ConnEntry last = t->entries[t->count - 1];
+    t->entries[slot] = last;
+    t->slot_of_fd[last.fd] = slot;
+
+    t->slot_of_fd[fd] = -1;
+    t->count--;
+}
@@ -0,0 +1,54 @@
+#ifndef CONNTABLE_H
+#define CONNTABLE_H
+
+#include <stddef.h>
+
+/* growable table of live connections.
+
+   entries are kept dense (swap-with-last on removal) so iterating
+   costs O(count), and a second array indexed by fd gives O(1)
+   lookup. the table only stores pointers: the objects they point to
+   never move, so a pointer is a stable handle that survives any
+   removal, and can be handed to epoll as data.ptr. */
+
+typedef struct {
+    int fd;
+    void *ptr;
+} ConnEntry;
+
+typedef struct {
+    ConnEntry *entries;   /* dense, in no particular order */
+    int count;
+    int cap;
+    int *slot_of_fd;      /* fd → index into entries, -1 if unused */
+    int fd_cap;
+    int limit;            /* most entries allowed */
+} ConnTable;
+
+/* empty table that may grow up to limit entries */
+int  conntable_init(ConnTable *t, int limit);
+void conntable_free(ConnTable *t);
+
+/* insert ptr under fd. returns -1 if full, fd is taken or out of memory */
+int  conntable_add(ConnTable *t, int fd, void *ptr);
+
+/* remove the entry for fd; the last entry moves into its slot */
+void conntable_remove(ConnTable *t, int fd);
+
+/* pointer stored under fd, or NULL */
+static inline void *conntable_get(const ConnTable *t, int fd) {
+    if (fd < 0 || fd >= t->fd_cap || t->slot_of_fd[fd] < 0)
+        return NULL;
+    return t->entries[t->slot_of_fd[fd]].ptr;
+}
+
+/* i-th entry in iteration order, 0 <= i < count */
+static inline void *conntable_at(const ConnTable *t, int i) {
+    return t->entries[i].ptr;
+}
+
+static inline int conntable_full(const ConnTable *t) {
+    return t->count >= t->limit;
+}
+
+#endif
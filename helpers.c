@@ -1,22 +1,22 @@
 #include "helpers.h"
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <time.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <sys/uio.h>
 
 /* TODO
 
 configurable logging – log_info(), log_error() functions with levels and 
 writing to file/stderr.
 
-extended timestamp – show date, seconds, milliseconds, or ISO 
-format.
-
 switch to “manual” terminal mode – for editing the client string.
 
-Universal utilities – set_nonblocking(), parse_args(), etc., to avoid 
-duplication in both modules.
+Universal utilities – parse_args(), etc., to avoid duplication in both 
+modules.
 */
 
 
@@ -76,13 +76,383 @@ ssize_t recv_all(int fd, void *buf, size_t len) {
     return total;
 }
 
+/* write all n buffers to fd, however many writev() calls it takes.
+   what went out is cut off the front of iov, the rest is retried.
+   returns 0 or -1 on error. */
+int writev_all(int fd, struct iovec *iov, int n) {
+
+    while (n > 0) {
+
+        ssize_t s = writev(fd, iov, n);
+
+        if (s < 0) {
+            /* interrupted by signal → retry */
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        /* skip the buffers that are done */
+        while (n > 0 && (size_t)s >= iov->iov_len) {
+            s -= iov->iov_len;
+            iov++;
+            n--;
+        }
+
+        /* and the part of the next one that is */
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + s;
+            iov->iov_len -= s;
+        }
+    }
+
+    return 0;
+}
+
+/* switch fd to non-blocking mode, keeping its other flags */
+int set_nonblocking(int fd) {
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* ---------- timestamps ---------- */
+
+/* everything that stays the same within one second */
+typedef struct {
+    time_t sec;             /* second the text below is for */
+    char chat[16];          /* [HH:MMPM] */
+    size_t chat_len;
+    char hms[16];           /* HH:MM:SS */
+    char date[16];          /* YYYY-MM-DD */
+    char zone[24];          /* +hh:mm */
+} TimestampCache;
+
+/* one per thread, so no locking */
+static _Thread_local TimestampCache ts_cache = { .sec = -1 };
+
+/* redo the cached text for second sec */
+static void ts_refresh(TimestampCache *c, time_t sec) {
+
+    struct tm t;
+    localtime_r(&sec, &t);
+
+    c->chat_len = strftime(c->chat, sizeof(c->chat), "[%H:%M%p]", &t);
+    strftime(c->hms, sizeof(c->hms), "%H:%M:%S", &t);
+    strftime(c->date, sizeof(c->date), "%Y-%m-%d", &t);
+
+    /* strftime's %z has no colon, ISO-8601 wants one */
+    long off = t.tm_gmtoff / 60;
+    char sign = off < 0 ? '-' : '+';
+    if (off < 0)
+        off = -off;
+    snprintf(c->zone, sizeof(c->zone), "%c%02ld:%02ld", sign, off / 60, off % 60);
+
+    c->sec = sec;
+}
+
+/* append len bytes at *p, never past end */
+static void ts_put(char **p, char *end, const char *s, size_t len) {
+    size_t room = end - *p;
+    if (len > room)
+        len = room;
+    memcpy(*p, s, len);
+    *p += len;
+}
+
+size_t format_timestamp(int format, char *out, size_t size) {
+
+    if (size == 0)
+        return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+    TimestampCache *c = &ts_cache;
+    if (now.tv_sec != c->sec)
+        ts_refresh(c, now.tv_sec);
+
+    /* milliseconds by hand, printf would cost more than the rest */
+    int ms = now.tv_nsec / 1000000;
+    char msec[4] = { '.', '0' + ms / 100, '0' + ms / 10 % 10, '0' + ms % 10 };
+
+    char *p = out;
+    char *end = out + size - 1;
+
+    switch (format) {
+    case TS_MS:
+        ts_put(&p, end, "[", 1);
+        ts_put(&p, end, c->hms, 8);
+        ts_put(&p, end, msec, 4);
+        ts_put(&p, end, "]", 1);
+        break;
+    case TS_DATE:
+        ts_put(&p, end, "[", 1);
+        ts_put(&p, end, c->date, 10);
+        ts_put(&p, end, " ", 1);
+        ts_put(&p, end, c->hms, 8);
+        ts_put(&p, end, "]", 1);
+        break;
+    case TS_ISO:
+        ts_put(&p, end, "[", 1);
+        ts_put(&p, end, c->date, 10);
+        ts_put(&p, end, "T", 1);
+        ts_put(&p, end, c->hms, 8);
+        ts_put(&p, end, msec, 4);
+        ts_put(&p, end, c->zone, strlen(c->zone));
+        ts_put(&p, end, "]", 1);
+        break;
+    default:
+        ts_put(&p, end, c->chat, c->chat_len);
+        break;
+    }
+
+    *p = '\0';
+    return p - out;
+}
+
 /* create a simple timestamp like: [18:42]
    used for log formatting */
 void make_timestamp(char *out, size_t size) {
+    format_timestamp(TS_CHAT, out, size);
+}
+
+/* ---------- framing ---------- */
+
+/* initial input buffer size; grows only for frames that do not fit */
+#define DECODER_INITIAL_CAP (BUFFER_SIZE * 4)
+
+int frame_decoder_init(FrameDecoder *d, size_t max_payload) {
+
+    /* the buffer is allocated on first use, so idle
+       connections cost no input memory */
+    d->buf = NULL;
+    d->cap = 0;
+    d->start = 0;
+    d->end = 0;
+    d->max_payload = max_payload;
+    return 0;
+}
+
+void frame_decoder_free(FrameDecoder *d) {
+    free(d->buf);
+    d->buf = NULL;
+    d->cap = d->start = d->end = 0;
+}
+
+/* read the length field of a buffered header */
+static size_t header_length(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return ((size_t)u[1] << 16) | ((size_t)u[2] << 8) | u[3];
+}
+
+char *frame_decoder_space(FrameDecoder *d, size_t *avail) {
+
+    if (!d->buf) {
+        d->buf = malloc(DECODER_INITIAL_CAP);
+        if (!d->buf) {
+            *avail = 0;
+            return NULL;
+        }
+        d->cap = DECODER_INITIAL_CAP;
+    }
+
+    /* everything consumed → rewind for free, no copy */
+    if (d->start == d->end)
+        d->start = d->end = 0;
+
+    size_t pending = d->end - d->start;
+
+    /* how much room the frame currently being received needs */
+    size_t need = FRAME_HEADER_SIZE;
+    if (pending >= FRAME_HEADER_SIZE)
+        need += header_length(d->buf + d->start);
+
+    if (need > d->cap - d->start) {
+
+        /* move the partial frame to the front.
+           this copies at most one unfinished frame, never whole reads. */
+        memmove(d->buf, d->buf + d->start, pending);
+        d->start = 0;
+        d->end = pending;
 
-    time_t now = time(NULL);        /* get current time */
-    struct tm *t = localtime(&now); /* convert to local time */
+        /* frame larger than the buffer → grow it once
+           (oversized frames are rejected by frame_decoder_next) */
+        if (need > d->cap && need <= FRAME_HEADER_SIZE + d->max_payload) {
+            char *nb = realloc(d->buf, need);
+            if (nb) {
+                d->buf = nb;
+                d->cap = need;
+            }
+        }
+    }
+
+    *avail = d->cap - d->end;
+    return d->buf + d->end;
+}
+
+void frame_decoder_commit(FrameDecoder *d, size_t n) {
+    d->end += n;
+}
+
+int frame_decoder_next(FrameDecoder *d, uint8_t *type,
+                       const char **payload, size_t *len) {
+
+    size_t pending = d->end - d->start;
+    if (pending < FRAME_HEADER_SIZE)
+        return 0;
+
+    const char *h = d->buf + d->start;
+    size_t plen = header_length(h);
+
+    if (plen > d->max_payload)
+        return -1;
+
+    if (pending < FRAME_HEADER_SIZE + plen)
+        return 0;
+
+    *type = (uint8_t)h[0];
+    *payload = h + FRAME_HEADER_SIZE;
+    *len = plen;
+
+    d->start += FRAME_HEADER_SIZE + plen;
+    return 1;
+}
+
+ssize_t frame_decoder_recv(FrameDecoder *d, int fd) {
+
+    size_t avail;
+    char *p = frame_decoder_space(d, &avail);
+
+    /* could not grow the buffer */
+    if (avail == 0)
+        return -1;
+
+    ssize_t n;
+    do {
+        n = recv(fd, p, avail, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0)
+        frame_decoder_commit(d, (size_t)n);
+
+    return n;
+}
+
+void frame_header(char *out, uint8_t type, size_t len) {
+    out[0] = (char)type;
+    out[1] = (char)((len >> 16) & 0xFF);
+    out[2] = (char)((len >> 8) & 0xFF);
+    out[3] = (char)(len & 0xFF);
+}
+
+/* send header and payload with one sendmsg() where possible,
+   so a small frame never goes out as two tcp segments. */
+ssize_t send_frame(int fd, uint8_t type, const void *payload, size_t len) {
+
+    if (len > FRAME_MAX_PAYLOAD)
+        return -1;
+
+    char header[FRAME_HEADER_SIZE];
+    frame_header(header, type, len);
+
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    size_t total = 0;
+    size_t want = sizeof(header) + len;
+
+    while (total < want) {
+
+        ssize_t s = sendmsg(fd, &msg, MSG_NOSIGNAL);
+
+        if (s <= 0) {
+            if (s < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        total += s;
+
+        /* skip over what was already sent */
+        size_t skip = s;
+        while (msg.msg_iovlen > 0 && skip >= msg.msg_iov->iov_len) {
+            skip -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + skip;
+            msg.msg_iov->iov_len -= skip;
+        }
+    }
+
+    return total;
+}
+
+/* ---------- shared message buffers ---------- */
+
+MsgBuf *msgbuf_alloc(size_t cap) {
+
+    MsgBuf *m = malloc(sizeof(MsgBuf) + FRAME_HEADER_SIZE + cap);
+    if (!m)
+        return NULL;
+
+    atomic_init(&m->refs, 1);
+    m->kind = MSG_UNICAST;
+    m->room = 0;
+    m->to = 0;
+    m->len = FRAME_HEADER_SIZE;
+    m->cap = cap;
+    return m;
+}
+
+void msgbuf_seal(MsgBuf *m, uint8_t type, size_t len) {
+
+    if (len > m->cap)
+        len = m->cap;
+
+    frame_header(m->data, type, len);
+    m->len = FRAME_HEADER_SIZE + len;
+}
+
+MsgBuf *msgbuf_new(uint8_t type, const void *payload, size_t len) {
+
+    MsgBuf *m = msgbuf_alloc(len);
+    if (!m)
+        return NULL;
+
+    memcpy(msgbuf_payload(m), payload, len);
+    msgbuf_seal(m, type, len);
+    return m;
+}
+
+/* taking a reference needs no ordering: the caller already holds one */
+MsgBuf *msgbuf_ref(MsgBuf *m) {
+    atomic_fetch_add_explicit(&m->refs, 1, memory_order_relaxed);
+    return m;
+}
+
+MsgBuf *msgbuf_ref_many(MsgBuf *m, int n) {
+    atomic_fetch_add_explicit(&m->refs, n, memory_order_relaxed);
+    return m;
+}
 
-    /* format into [HH:MM] */
-    strftime(out, size, "[%H:%M%p]", t);
+/* the release/acquire pair makes every thread's last use of the
+   buffer happen before it is freed */
+void msgbuf_unref(MsgBuf *m) {
+    if (m && atomic_fetch_sub_explicit(&m->refs, 1, memory_order_acq_rel) == 1)
+        free(m);
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <arpa/inet.h>
 
 /* default server configuration */
@@ -11,7 +12,7 @@
 
 /* general limits */
 #define BUFFER_SIZE 1024
-#define MAX_CLIENTS 10
+#define MAX_CLIENTS 1024   /* default limit, see server --max-clients */
 
 /* limits for client metadata */
 #define MAX_NAME 32
@@ -23,16 +24,163 @@ typedef struct {
     int32_t id;           /* client id (assigned or used by server) */
     char name[MAX_NAME];  /* username */
     char ip[MAX_IP];      /* ip address in string form */
-    uint8_t active;       /* simple flag, reserved for future use */
+    uint8_t flags;        /* HELLO_* features the client asks for */
 } Client;
 
+/* hello flags. a client that sets any gets one byte back before the
+   history: the flags the server agreed to. */
+#define HELLO_ZLIB 0x01   /* compress everything after that byte,
+                             see zstream.h */
+#define HELLO_PING 0x02   /* the server pings a quiet connection and the
+                             client answers every FRAME_PING with a
+                             FRAME_PONG; one that stays silent too long
+                             is dropped */
+
 /* send exactly len bytes (handles partial sends) */
 ssize_t send_all(int fd, const void *buf, size_t len);
 
 /* receive exactly len bytes (used for fixed-size structs) */
 ssize_t recv_all(int fd, void *buf, size_t len);
 
+/* write all n buffers to a file (handles partial writes).
+   iov is used up in the process. returns -1 on error. */
+struct iovec;
+int writev_all(int fd, struct iovec *iov, int n);
+
+/* switch a socket to non-blocking mode; returns -1 on error */
+int set_nonblocking(int fd);
+
+/* ---------- timestamps ----------
+
+   every chat line starts with a timestamp. the clock is read with
+   the coarse (tick resolution, no syscall) realtime clock, and the
+   text for the current second is cached per thread, so formatting
+   one is a few byte copies; localtime() runs once a second. */
+
+enum {
+    TS_CHAT,    /* [HH:MMPM] */
+    TS_MS,      /* [HH:MM:SS.mmm] */
+    TS_DATE,    /* [YYYY-MM-DD HH:MM:SS] */
+    TS_ISO      /* [YYYY-MM-DDTHH:MM:SS.mmm+hh:mm] */
+};
+
+/* longest timestamp, terminator included */
+#define TIMESTAMP_MAX 48
+
+/* write a timestamp in the given TS_* format; returns its length */
+size_t format_timestamp(int format, char *out, size_t size);
+
 /* generate timestamp like [HH:MM] */
 void make_timestamp(char *out, size_t size);
 
+/* ---------- framing ----------
+
+   every message on the wire is a frame:
+
+     [ 4-byte header, big-endian ][ payload ]
+
+   the top 8 bits of the header hold the frame type,
+   the low 24 bits hold the payload length. */
+
+#define FRAME_HEADER_SIZE 4
+#define FRAME_MAX_PAYLOAD 0xFFFFFF
+
+/* largest chat line a client may send */
+#define MAX_MESSAGE 4096
+
+/* frame types */
+enum {
+    FRAME_TEXT = 1,     /* printable chat text */
+    FRAME_PING = 2,     /* server → client: still there? (no payload) */
+    FRAME_PONG = 3      /* client → server: the answer (no payload) */
+};
+
+/* incremental frame decoder.
+   keeps one input buffer per connection; recv() writes straight
+   into its free space and complete frames are returned in place. */
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t start;        /* first byte not yet consumed */
+    size_t end;          /* one past the last received byte */
+    size_t max_payload;  /* larger frames are a protocol error */
+} FrameDecoder;
+
+int  frame_decoder_init(FrameDecoder *d, size_t max_payload);
+void frame_decoder_free(FrameDecoder *d);
+
+/* free space to receive into (grows/compacts as needed) */
+char *frame_decoder_space(FrameDecoder *d, size_t *avail);
+
+/* mark n bytes written into the space as received */
+void frame_decoder_commit(FrameDecoder *d, size_t n);
+
+/* pop next complete frame.
+   returns 1 and fills type/payload/len, 0 if more data is needed,
+   -1 on a malformed frame. payload stays valid until the next
+   frame_decoder_space() call. */
+int frame_decoder_next(FrameDecoder *d, uint8_t *type,
+                       const char **payload, size_t *len);
+
+/* one recv() into the decoder.
+   returns bytes read, 0 on orderly close, -1 on error. */
+ssize_t frame_decoder_recv(FrameDecoder *d, int fd);
+
+/* write a frame header for a payload of len bytes */
+void frame_header(char *out, uint8_t type, size_t len);
+
+/* send header and payload as one frame */
+ssize_t send_frame(int fd, uint8_t type, const void *payload, size_t len);
+
+/* ---------- shared message buffers ----------
+
+   a chat event is formatted once into a MsgBuf that already holds
+   the complete frame. every recipient's queue keeps a reference to
+   the same buffer; it is freed when the last reference is dropped.
+   a sealed buffer is never modified, so it may be shared between
+   threads (the reference count is atomic). */
+
+/* what a buffer holds, for a client that cannot keep up: only
+   room events may be dropped from its queue */
+enum {
+    MSG_UNICAST,        /* notices, answers, private messages */
+    MSG_CHAT,           /* a chat line of a room */
+    MSG_PRESENCE        /* joins, leaves, renames */
+};
+
+typedef struct {
+    atomic_int refs;
+    int kind;           /* MSG_* */
+    int room;           /* chat room of the event, 0 is the lobby */
+    uint64_t to;        /* recipient of a private message (ROOM_DIRECT) */
+    size_t len;         /* frame bytes in data (header included) */
+    size_t cap;         /* payload bytes available */
+    char data[];        /* frame header followed by payload */
+} MsgBuf;
+
+/* buffer with room for a payload of up to cap bytes, one reference.
+   write the payload at msgbuf_payload(), then msgbuf_seal(). */
+MsgBuf *msgbuf_alloc(size_t cap);
+
+/* write the frame header for a payload of len bytes */
+void msgbuf_seal(MsgBuf *m, uint8_t type, size_t len);
+
+/* allocate, copy payload and seal in one step */
+MsgBuf *msgbuf_new(uint8_t type, const void *payload, size_t len);
+
+static inline char *msgbuf_payload(MsgBuf *m) {
+    return m->data + FRAME_HEADER_SIZE;
+}
+
+static inline size_t msgbuf_payload_len(const MsgBuf *m) {
+    return m->len - FRAME_HEADER_SIZE;
+}
+
+MsgBuf *msgbuf_ref(MsgBuf *m);
+
+/* add n references at once (one per consumer of a shared ring) */
+MsgBuf *msgbuf_ref_many(MsgBuf *m, int n);
+
+void msgbuf_unref(MsgBuf *m);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,372 @@
+#include "logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+
+/* most messages appended with one writev() */
+#define LOGGER_IOV 1024
+
+/* the writer prints its stats this often, if it wrote anything */
+#define LOGGER_REPORT_MS 60000
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void stat_add(_Atomic uint64_t *v, uint64_t n) {
+    atomic_fetch_add_explicit(v, n, memory_order_relaxed);
+}
+
+static void stat_max(_Atomic uint64_t *v, uint64_t n) {
+    if (n > atomic_load_explicit(v, memory_order_relaxed))
+        atomic_store_explicit(v, n, memory_order_relaxed);
+}
+
+int logger_init(Logger *lg, SegLog *log, size_t size, int sync_mode,
+                int interval_ms, int echo_fd) {
+
+    memset(lg, 0, sizeof(*lg));
+
+    size_t n = 1;
+    while (n < size)
+        n *= 2;
+
+    lg->slots = calloc(n, sizeof(*lg->slots));
+    if (!lg->slots)
+        return -1;
+
+    lg->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (lg->wake_fd < 0) {
+        free(lg->slots);
+        return -1;
+    }
+
+    lg->log = log;
+    lg->echo_fd = echo_fd;
+    lg->sync_mode = sync_mode;
+    lg->interval_ms = interval_ms;
+    lg->mask = n - 1;
+    return 0;
+}
+
+void logger_route(Logger *lg, SegLog *(*route)(const MsgBuf *m, void *arg),
+                  void *arg) {
+    lg->route = route;
+    lg->route_arg = arg;
+}
+
+void logger_free(Logger *lg) {
+    close(lg->wake_fd);
+    free(lg->slots);
+    lg->slots = NULL;
+}
+
+static void fill_iov(Logger *lg, uint64_t from, int n, struct iovec *iov) {
+    for (int k = 0; k < n; k++) {
+        MsgBuf *m = lg->slots[(from + k) & lg->mask];
+        iov[k].iov_base = msgbuf_payload(m);
+        iov[k].iov_len = msgbuf_payload_len(m);
+    }
+}
+
+/* the log message m goes to */
+static SegLog *log_of(Logger *lg, const MsgBuf *m) {
+    return lg->route ? lg->route(m, lg->route_arg) : lg->log;
+}
+
+static void sync_one(Logger *lg, SegLog *log) {
+
+    uint64_t t = now_ns();
+
+    if (seglog_sync(log) < 0)
+        perror("logger: fdatasync");
+
+    t = now_ns() - t;
+    stat_add(&lg->stats.syncs, 1);
+    stat_add(&lg->stats.sync_ns, t);
+    stat_max(&lg->stats.max_sync_ns, t);
+    histogram_add(&lg->stats.sync_lat, t);
+}
+
+/* remember that log needs a sync (if anything is ever synced) */
+static void mark_dirty(Logger *lg, SegLog *log) {
+
+    if (lg->sync_mode == LOG_SYNC_NONE)
+        return;
+
+    for (int k = 0; k < lg->dirty_count; k++)
+        if (lg->dirty[k] == log)
+            return;
+
+    if (lg->dirty_count == LOGGER_DIRTY)
+        sync_one(lg, log);
+    else
+        lg->dirty[lg->dirty_count++] = log;
+}
+
+void logger_forget(Logger *lg, SegLog *log) {
+
+    for (int k = 0; k < lg->dirty_count; k++) {
+        if (lg->dirty[k] == log) {
+            sync_one(lg, log);
+            lg->dirty[k] = lg->dirty[--lg->dirty_count];
+            return;
+        }
+    }
+}
+
+/* append the queued messages [from, to), at most LOGGER_IOV of them.
+   returns how many were taken off the queue. */
+static int write_batch(Logger *lg, uint64_t from, uint64_t to) {
+
+    int n = to - from > LOGGER_IOV ? LOGGER_IOV : (int)(to - from);
+    struct iovec iov[LOGGER_IOV];
+
+    if (lg->echo_fd >= 0) {
+        fill_iov(lg, from, n, iov);
+        writev_all(lg->echo_fd, iov, n);
+    }
+
+    fill_iov(lg, from, n, iov);
+
+    size_t bytes = 0;
+    for (int k = 0; k < n; k++)
+        bytes += iov[k].iov_len;
+
+    uint64_t t = now_ns();
+
+    /* one append per run of messages for the same log. a failed
+       write loses the run, but never stops the chat. once appended,
+       history replays may include the messages. */
+    for (int k = 0; k < n; ) {
+
+        SegLog *log = log_of(lg, lg->slots[(from + k) & lg->mask]);
+
+        int run = 1;
+        while (k + run < n &&
+               log_of(lg, lg->slots[(from + k + run) & lg->mask]) == log)
+            run++;
+
+        if (log) {
+            if (seglog_append(log, iov + k, run) < 0)
+                perror("logger: write");
+            mark_dirty(lg, log);
+        }
+
+        k += run;
+    }
+
+    t = now_ns() - t;
+
+    for (int k = 0; k < n; k++) {
+        MsgBuf **slot = &lg->slots[(from + k) & lg->mask];
+        msgbuf_unref(*slot);
+        *slot = NULL;
+    }
+
+    stat_add(&lg->stats.batches, 1);
+    stat_add(&lg->stats.records, n);
+    stat_add(&lg->stats.bytes, bytes);
+    stat_max(&lg->stats.max_batch, n);
+    stat_add(&lg->stats.write_ns, t);
+    stat_max(&lg->stats.max_write_ns, t);
+    histogram_add(&lg->stats.batch_size, n);
+    histogram_add(&lg->stats.write_lat, t);
+    return n;
+}
+
+/* sync every log written to since the last call */
+static void sync_log(Logger *lg) {
+
+    for (int k = 0; k < lg->dirty_count; k++)
+        sync_one(lg, lg->dirty[k]);
+
+    lg->dirty_count = 0;
+}
+
+static void *logger_main(void *arg) {
+
+    Logger *lg = arg;
+
+    uint64_t synced = now_ns();     /* time of the last sync */
+    int unsynced = 0;               /* written since then */
+    uint64_t reported = synced;
+    uint64_t reported_records = 0;
+
+    for (;;) {
+
+        uint64_t head = atomic_load_explicit(&lg->head, memory_order_relaxed);
+        uint64_t tail = atomic_load_explicit(&lg->tail, memory_order_acquire);
+
+        if (head != tail) {
+            int n = write_batch(lg, head, tail);
+            atomic_store_explicit(&lg->head, head + n, memory_order_release);
+            unsynced = 1;
+
+            if (lg->sync_mode == LOG_SYNC_BATCH) {
+                sync_log(lg);
+                unsynced = 0;
+            }
+        }
+
+        uint64_t now = now_ns();
+        int timeout = -1;
+
+        if (unsynced && lg->sync_mode == LOG_SYNC_INTERVAL) {
+            uint64_t due = synced + (uint64_t)lg->interval_ms * 1000000;
+            if (now >= due) {
+                sync_log(lg);
+                unsynced = 0;
+                synced = now;
+            } else {
+                timeout = (due - now) / 1000000 + 1;
+            }
+        }
+
+        uint64_t records = atomic_load(&lg->stats.records);
+        if (records != reported_records) {
+            uint64_t due = reported + (uint64_t)LOGGER_REPORT_MS * 1000000;
+            if (now >= due) {
+                logger_report(lg, stderr);
+                reported = now;
+                reported_records = records;
+            } else {
+                int ms = (due - now) / 1000000 + 1;
+                if (timeout < 0 || ms < timeout)
+                    timeout = ms;
+            }
+        }
+
+        if (head != tail)
+            continue;
+
+        /* the queue was empty: go to sleep, unless something arrived
+           after all (pairs with the fence in logger_submit) */
+        atomic_store(&lg->sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (atomic_load(&lg->tail) != head) {
+            atomic_store(&lg->sleeping, 0);
+            continue;
+        }
+
+        if (atomic_load(&lg->stop)) {
+            if (unsynced && lg->sync_mode != LOG_SYNC_NONE)
+                sync_log(lg);
+            break;
+        }
+
+        struct pollfd pfd = { .fd = lg->wake_fd, .events = POLLIN };
+        int r = poll(&pfd, 1, timeout);
+        atomic_store(&lg->sleeping, 0);
+
+        if (r > 0) {
+            uint64_t v;
+            if (read(lg->wake_fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+                perror("logger: read");
+        }
+    }
+
+    return NULL;
+}
+
+static void wake_writer(Logger *lg) {
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load(&lg->sleeping) && atomic_exchange(&lg->sleeping, 0)) {
+        uint64_t one = 1;
+        if (write(lg->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("logger: write wake_fd");
+    }
+}
+
+int logger_start(Logger *lg) {
+    return pthread_create(&lg->thread, NULL, logger_main, lg) == 0 ? 0 : -1;
+}
+
+void logger_stop(Logger *lg) {
+
+    atomic_store(&lg->stop, 1);
+
+    uint64_t one = 1;
+    if (write(lg->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("logger: write wake_fd");
+
+    pthread_join(lg->thread, NULL);
+}
+
+void logger_submit(Logger *lg, MsgBuf *m) {
+
+    uint64_t tail = atomic_load_explicit(&lg->tail, memory_order_relaxed);
+
+    /* full: the writer is a whole queue behind, wait for it */
+    if (tail - atomic_load_explicit(&lg->head, memory_order_acquire) > lg->mask) {
+        stat_add(&lg->stats.stalls, 1);
+        while (tail - atomic_load_explicit(&lg->head, memory_order_acquire) > lg->mask)
+            sched_yield();
+    }
+
+    lg->slots[tail & lg->mask] = msgbuf_ref(m);
+    atomic_store_explicit(&lg->tail, tail + 1, memory_order_release);
+
+    wake_writer(lg);
+}
+
+void logger_report(Logger *lg, FILE *out) {
+
+    LoggerStats *st = &lg->stats;
+
+    uint64_t batches = atomic_load(&st->batches);
+    uint64_t syncs = atomic_load(&st->syncs);
+
+    fprintf(out,
+            "log: %llu records, %llu bytes in %llu batches "
+            "(avg %.1f, max %llu per batch), "
+            "write avg %.1f us max %.1f us, "
+            "%llu syncs avg %.1f us max %.1f us, %llu stalls\n",
+            (unsigned long long)atomic_load(&st->records),
+            (unsigned long long)atomic_load(&st->bytes),
+            (unsigned long long)batches,
+            batches ? (double)atomic_load(&st->records) / batches : 0.0,
+            (unsigned long long)atomic_load(&st->max_batch),
+            batches ? atomic_load(&st->write_ns) / 1e3 / batches : 0.0,
+            atomic_load(&st->max_write_ns) / 1e3,
+            (unsigned long long)syncs,
+            syncs ? atomic_load(&st->sync_ns) / 1e3 / syncs : 0.0,
+            atomic_load(&st->max_sync_ns) / 1e3,
+            (unsigned long long)atomic_load(&st->stalls));
+}
+
+void logger_metrics(Logger *lg, FILE *out) {
+
+    LoggerStats *st = &lg->stats;
+
+    fprintf(out, "log_records %llu\n",
+            (unsigned long long)atomic_load(&st->records));
+    fprintf(out, "log_bytes %llu\n",
+            (unsigned long long)atomic_load(&st->bytes));
+    fprintf(out, "log_batches %llu\n",
+            (unsigned long long)atomic_load(&st->batches));
+    fprintf(out, "log_syncs %llu\n",
+            (unsigned long long)atomic_load(&st->syncs));
+    fprintf(out, "log_stalls %llu\n",
+            (unsigned long long)atomic_load(&st->stalls));
+    /* head first: the tail is never behind it */
+    uint64_t head = atomic_load(&lg->head);
+    fprintf(out, "log_queued %llu\n",
+            (unsigned long long)(atomic_load(&lg->tail) - head));
+
+    histogram_print(out, "log_batch", &st->batch_size, 1);
+    histogram_print(out, "log_write_us", &st->write_lat, 1e3);
+    histogram_print(out, "log_sync_us", &st->sync_lat, 1e3);
+}
@@ -0,0 +1,109 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "helpers.h"
+#include "seglog.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* group-commit chat logger.
+
+   the event loop only queues references to the finished messages
+   (one producer, no locks); a writer thread takes everything queued
+   so far and appends it to the log with a single writev(). a burst
+   of messages therefore costs one write (and at most one fsync)
+   instead of one per message, and a slow disk delays only the
+   writer, never chat delivery.
+
+   messages may go to different logs (see logger_route); a batch is
+   then appended as one writev per run of messages for the same log,
+   and every log written to is synced. */
+
+/* when the writer makes the log durable */
+enum {
+    LOG_SYNC_NONE,      /* never; the kernel writes back when it likes */
+    LOG_SYNC_INTERVAL,  /* fdatasync at most every interval_ms */
+    LOG_SYNC_BATCH      /* fdatasync after every batch */
+};
+
+#define LOGGER_CACHE_LINE 64
+
+/* most logs waiting for their sync at once; more are synced right
+   after their write */
+#define LOGGER_DIRTY 64
+
+/* what the writer did so far, for reports */
+typedef struct {
+    _Atomic uint64_t batches;       /* writev calls that completed a batch */
+    _Atomic uint64_t records;       /* messages written */
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t max_batch;     /* most messages in one batch */
+    _Atomic uint64_t write_ns;      /* time spent writing batches */
+    _Atomic uint64_t max_write_ns;
+    _Atomic uint64_t syncs;
+    _Atomic uint64_t sync_ns;
+    _Atomic uint64_t max_sync_ns;
+    _Atomic uint64_t stalls;        /* submits that found the queue full */
+    Histogram batch_size;           /* messages per batch */
+    Histogram write_lat;            /* ns per batch write */
+    Histogram sync_lat;             /* ns per fdatasync */
+} LoggerStats;
+
+typedef struct {
+    SegLog *log;            /* where the messages go */
+    SegLog *(*route)(const MsgBuf *m, void *arg);   /* or per message */
+    void *route_arg;
+    SegLog *dirty[LOGGER_DIRTY];    /* written to since the last sync */
+    int dirty_count;
+    int echo_fd;            /* every record is copied here too, or -1 */
+    int sync_mode;          /* LOG_SYNC_* */
+    int interval_ms;        /* for LOG_SYNC_INTERVAL */
+
+    MsgBuf **slots;         /* queue of messages to write */
+    uint64_t mask;          /* slots - 1, a power of two */
+    _Alignas(LOGGER_CACHE_LINE) _Atomic uint64_t head;  /* next to write */
+    _Alignas(LOGGER_CACHE_LINE) _Atomic uint64_t tail;  /* next to fill */
+
+    int wake_fd;            /* eventfd the writer sleeps on */
+    atomic_int sleeping;
+    atomic_int stop;
+    pthread_t thread;
+
+    LoggerStats stats;
+} Logger;
+
+/* logger appending to log with room for size queued messages */
+int  logger_init(Logger *lg, SegLog *log, size_t size, int sync_mode,
+                 int interval_ms, int echo_fd);
+
+/* send every message to the log route(m, arg) returns instead of
+   the one given to logger_init; NULL drops it. called by the writer
+   thread, before logger_start only. */
+void logger_route(Logger *lg, SegLog *(*route)(const MsgBuf *m, void *arg),
+                  void *arg);
+
+/* log is about to be closed: sync it now if it is waiting for its
+   sync, and forget it. called by the route, on the writer thread. */
+void logger_forget(Logger *lg, SegLog *log);
+
+/* start / stop the writer thread. stopping writes (and syncs)
+   everything queued before it returns. */
+int  logger_start(Logger *lg);
+void logger_stop(Logger *lg);
+void logger_free(Logger *lg);
+
+/* queue m for the log, taking a reference. single producer only.
+   if the writer is that far behind, waits for it. */
+void logger_submit(Logger *lg, MsgBuf *m);
+
+/* one line summary of the stats */
+void logger_report(Logger *lg, FILE *out);
+
+/* the stats as "log_<name> <value>" lines, for the stats report */
+void logger_metrics(Logger *lg, FILE *out);
+
+#endif
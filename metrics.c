@@ -0,0 +1,54 @@
+#include "metrics.h"
+
+void histogram_merge(Histogram *into, const Histogram *h) {
+
+    counter_add(&into->count, counter_get(&h->count));
+    counter_add(&into->sum, counter_get(&h->sum));
+
+    if (counter_get(&h->max) > counter_get(&into->max))
+        atomic_store(&into->max, counter_get(&h->max));
+
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+        counter_add(&into->buckets[b], counter_get(&h->buckets[b]));
+}
+
+uint64_t histogram_quantile(const Histogram *h, double q) {
+
+    uint64_t count = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+        count += counter_get(&h->buckets[b]);
+
+    if (count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * (count - 1)) + 1;
+    uint64_t seen = 0;
+    uint64_t max = counter_get(&h->max);
+
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+
+        seen += counter_get(&h->buckets[b]);
+        if (seen < rank)
+            continue;
+
+        /* largest value with b significant bits */
+        uint64_t top = b == 64 ? UINT64_MAX : ((uint64_t)1 << b) - 1;
+        return top < max ? top : max;
+    }
+
+    return max;
+}
+
+void histogram_print(FILE *out, const char *name, const Histogram *h,
+                     double scale) {
+
+    uint64_t count = counter_get(&h->count);
+
+    fprintf(out, "%s_count %llu\n", name, (unsigned long long)count);
+    fprintf(out, "%s_avg %.1f\n", name,
+            count ? counter_get(&h->sum) / scale / count : 0.0);
+    fprintf(out, "%s_p50 %.1f\n", name, histogram_quantile(h, 0.5) / scale);
+    fprintf(out, "%s_p99 %.1f\n", name, histogram_quantile(h, 0.99) / scale);
+    fprintf(out, "%s_p999 %.1f\n", name, histogram_quantile(h, 0.999) / scale);
+    fprintf(out, "%s_max %.1f\n", name, counter_get(&h->max) / scale);
+}
@@ -0,0 +1,60 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* counters and latency histograms for the hot paths.
+
+   every metric has exactly one writer (a shard, or the logger), so
+   an update is a relaxed load and store of its own cache lines, no
+   locked instruction. readers (the stats report) load the values of
+   all writers and add them up; a report taken while the server runs
+   may be a few events behind, but never torn. */
+
+typedef _Atomic uint64_t Counter;
+
+/* a counter used as a gauge goes down by adding a negative amount
+   (the arithmetic wraps around, as unsigned arithmetic does) */
+static inline void counter_add(Counter *c, uint64_t n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline uint64_t counter_get(const Counter *c) {
+    return atomic_load_explicit((Counter *)c, memory_order_relaxed);
+}
+
+/* histogram with one bucket per power of two: bucket b holds values
+   of b significant bits. cheap enough for every event, precise enough
+   for tail latencies (within a factor of two). */
+#define HISTOGRAM_BUCKETS 65
+
+typedef struct {
+    Counter count;
+    Counter sum;
+    Counter max;
+    Counter buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+static inline void histogram_add(Histogram *h, uint64_t v) {
+    counter_add(&h->buckets[v ? 64 - __builtin_clzll(v) : 0], 1);
+    counter_add(&h->count, 1);
+    counter_add(&h->sum, v);
+    if (v > counter_get(&h->max))
+        atomic_store_explicit(&h->max, v, memory_order_relaxed);
+}
+
+/* add h to into (a reader's private total) */
+void histogram_merge(Histogram *into, const Histogram *h);
+
+/* upper bound of the value at quantile q (0..1) */
+uint64_t histogram_quantile(const Histogram *h, double q);
+
+/* "name_count", "name_avg", "name_p50", "name_p99", "name_p999" and
+   "name_max" lines, values divided by scale (e.g. 1000 for ns → us) */
+void histogram_print(FILE *out, const char *name, const Histogram *h,
+                     double scale);
+
+#endif
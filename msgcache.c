@@ -0,0 +1,74 @@
+#include "msgcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int msgcache_init(MsgCache *mc, size_t cap) {
+
+    memset(mc, 0, sizeof(*mc));
+
+    /* nothing logged yet counts as a complete (empty) log */
+    mc->whole = 1;
+
+    if (cap == 0)
+        return 0;
+
+    mc->items = malloc(cap * sizeof(*mc->items));
+    if (!mc->items)
+        return -1;
+
+    mc->cap = cap;
+    return 0;
+}
+
+void msgcache_free(MsgCache *mc) {
+
+    for (size_t k = 0; k < mc->count; k++)
+        msgbuf_unref(msgcache_at(mc, k));
+
+    free(mc->items);
+    memset(mc, 0, sizeof(*mc));
+}
+
+void msgcache_push(MsgCache *mc, MsgBuf *m) {
+
+    /* a cache of size 0 remembers nothing */
+    if (mc->cap == 0) {
+        mc->whole = 0;
+        return;
+    }
+
+    /* full → the oldest message falls out */
+    if (mc->count == mc->cap) {
+        msgbuf_unref(mc->items[mc->head]);
+        mc->head = (mc->head + 1) % mc->cap;
+        mc->count--;
+        mc->whole = 0;
+    }
+
+    mc->items[(mc->head + mc->count) % mc->cap] = msgbuf_ref(m);
+    mc->count++;
+}
+
+long msgcache_window(const MsgCache *mc, size_t max_msgs, size_t max_bytes,
+                     size_t *bytes) {
+
+    size_t n = 0;
+    *bytes = 0;
+
+    /* walk back from the newest message */
+    while (n < max_msgs && n < mc->count) {
+
+        size_t len = msgbuf_payload_len(msgcache_at(mc, mc->count - 1 - n));
+        if (*bytes + len > max_bytes)
+            return n;
+
+        *bytes += len;
+        n++;
+    }
+
+    if (n < max_msgs && !mc->whole)
+        return -1;
+
+    return n;
+}
@@ -0,0 +1,42 @@
+#ifndef MSGCACHE_H
+#define MSGCACHE_H
+
+#include "helpers.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the most recent chat events, as the very buffers used for fan-out.
+
+   a fixed number of slots; adding to a full cache drops the oldest
+   reference. a new client's history is taken from here, so a join
+   costs no file i/o as long as the window fits the cache. */
+
+typedef struct {
+    MsgBuf **items;
+    size_t cap;         /* slots */
+    size_t head;        /* slot of the oldest message */
+    size_t count;       /* cached messages */
+    int whole;          /* holds every message of the log so far */
+} MsgCache;
+
+int  msgcache_init(MsgCache *mc, size_t cap);
+void msgcache_free(MsgCache *mc);
+
+/* keep a reference to m, dropping the oldest one if full */
+void msgcache_push(MsgCache *mc, MsgBuf *m);
+
+/* k-th message counted from the oldest one (k < count) */
+static inline MsgBuf *msgcache_at(const MsgCache *mc, size_t k) {
+    return mc->items[(mc->head + k) % mc->cap];
+}
+
+/* how many of the newest messages make a history window of at most
+   max_msgs messages and max_bytes payload bytes. *bytes gets their
+   payload size. returns -1 if the cache runs out before a limit is
+   reached and does not hold the whole log, i.e. the window needs
+   older messages from the file. */
+long msgcache_window(const MsgCache *mc, size_t max_msgs, size_t max_bytes,
+                     size_t *bytes);
+
+#endif
@@ -0,0 +1,236 @@
+#include "nameindex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* buckets to start with; doubled whenever there are more names */
+#define NAME_BUCKETS 256
+
+/* most names in the /list answer, so it fits a client's queue */
+#define LIST_NAMES 1000
+
+int nameindex_init(NameIndex *ix) {
+
+    memset(ix, 0, sizeof(*ix));
+
+    ix->buckets = calloc(NAME_BUCKETS, sizeof(*ix->buckets));
+    if (!ix->buckets)
+        return -1;
+
+    ix->bucket_count = NAME_BUCKETS;
+    ix->list_version = UINT64_MAX;
+
+    if (pthread_rwlock_init(&ix->lock, NULL) != 0 ||
+        pthread_mutex_init(&ix->list_lock, NULL) != 0) {
+        free(ix->buckets);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* fnv-1a */
+static uint32_t hash_name(const char *name) {
+
+    uint32_t h = 2166136261u;
+    for (; *name; name++)
+        h = (h ^ (unsigned char)*name) * 16777619u;
+
+    return h;
+}
+
+/* the link pointing at name's entry (or the end of its chain) */
+static NameEntry **find_link(NameIndex *ix, const char *name) {
+
+    NameEntry **link = &ix->buckets[hash_name(name) & (ix->bucket_count - 1)];
+    while (*link && strcmp((*link)->name, name) != 0)
+        link = &(*link)->next;
+
+    return link;
+}
+
+/* twice the buckets, once there are more names than buckets.
+   a failed resize only makes chains longer. */
+static void grow(NameIndex *ix) {
+
+    if (ix->count <= ix->bucket_count)
+        return;
+
+    size_t count = ix->bucket_count * 2;
+    NameEntry **buckets = calloc(count, sizeof(*buckets));
+    if (!buckets)
+        return;
+
+    for (size_t b = 0; b < ix->bucket_count; b++) {
+        NameEntry *e = ix->buckets[b];
+        while (e) {
+            NameEntry *next = e->next;
+            NameEntry **head = &buckets[hash_name(e->name) & (count - 1)];
+            e->next = *head;
+            *head = e;
+            e = next;
+        }
+    }
+
+    free(ix->buckets);
+    ix->buckets = buckets;
+    ix->bucket_count = count;
+}
+
+/* insert under the write lock */
+static int insert(NameIndex *ix, const char *name, int shard, uint64_t handle) {
+
+    NameEntry **link = find_link(ix, name);
+    if (*link) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    NameEntry *e = malloc(sizeof(*e));
+    if (!e)
+        return -1;
+
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    e->shard = shard;
+    e->handle = handle;
+    e->next = NULL;
+    *link = e;
+
+    ix->count++;
+    ix->version++;
+    grow(ix);
+    return 0;
+}
+
+/* remove under the write lock; returns the entry's shard, or -1 */
+static int remove_entry(NameIndex *ix, const char *name, uint64_t handle) {
+
+    NameEntry **link = find_link(ix, name);
+    NameEntry *e = *link;
+
+    if (!e || e->handle != handle)
+        return -1;
+
+    int shard = e->shard;
+    *link = e->next;
+    free(e);
+
+    ix->count--;
+    ix->version++;
+    return shard;
+}
+
+int nameindex_claim(NameIndex *ix, const char *name, int shard,
+                    uint64_t handle) {
+
+    pthread_rwlock_wrlock(&ix->lock);
+    int r = insert(ix, name, shard, handle);
+    pthread_rwlock_unlock(&ix->lock);
+
+    return r;
+}
+
+int nameindex_rename(NameIndex *ix, const char *from, const char *to,
+                     uint64_t handle) {
+
+    pthread_rwlock_wrlock(&ix->lock);
+
+    int r = -1;
+    NameEntry *e = *find_link(ix, from);
+
+    if (e && e->handle == handle && insert(ix, to, e->shard, handle) == 0) {
+        remove_entry(ix, from, handle);
+        r = 0;
+    }
+
+    pthread_rwlock_unlock(&ix->lock);
+    return r;
+}
+
+void nameindex_release(NameIndex *ix, const char *name, uint64_t handle) {
+
+    pthread_rwlock_wrlock(&ix->lock);
+    remove_entry(ix, name, handle);
+    pthread_rwlock_unlock(&ix->lock);
+}
+
+int nameindex_find(NameIndex *ix, const char *name, int *shard,
+                   uint64_t *handle) {
+
+    pthread_rwlock_rdlock(&ix->lock);
+
+    NameEntry *e = *find_link(ix, name);
+    if (e) {
+        *shard = e->shard;
+        *handle = e->handle;
+    }
+
+    pthread_rwlock_unlock(&ix->lock);
+    return e ? 0 : -1;
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/* the /list frame for the names as they are now, sorted */
+static MsgBuf *make_list(NameIndex *ix) {
+
+    size_t count = ix->count;
+    size_t shown = count < LIST_NAMES ? count : LIST_NAMES;
+
+    const char **names = malloc((count ? count : 1) * sizeof(*names));
+    if (!names)
+        return NULL;
+
+    size_t n = 0;
+    for (size_t b = 0; b < ix->bucket_count; b++)
+        for (NameEntry *e = ix->buckets[b]; e; e = e->next)
+            names[n++] = e->name;
+
+    qsort(names, n, sizeof(*names), by_name);
+
+    MsgBuf *m = msgbuf_alloc(64 + shown * (MAX_NAME + 2));
+    if (m) {
+        char *p = msgbuf_payload(m);
+        size_t len = sprintf(p, "* %zu online:", count);
+
+        for (size_t k = 0; k < shown; k++)
+            len += sprintf(p + len, "%s %s", k ? "," : "", names[k]);
+
+        if (shown < count)
+            len += sprintf(p + len, ", ... (%zu more)", count - shown);
+
+        p[len++] = '\n';
+        msgbuf_seal(m, FRAME_TEXT, len);
+    }
+
+    free(names);
+    return m;
+}
+
+MsgBuf *nameindex_list(NameIndex *ix) {
+
+    pthread_mutex_lock(&ix->list_lock);
+    pthread_rwlock_rdlock(&ix->lock);
+
+    /* out of date → made once, for every /list until the next change */
+    if (ix->list_version != ix->version || !ix->list) {
+
+        MsgBuf *m = make_list(ix);
+        if (m) {
+            if (ix->list)
+                msgbuf_unref(ix->list);
+            ix->list = m;
+            ix->list_version = ix->version;
+        }
+    }
+
+    MsgBuf *m = ix->list ? msgbuf_ref(ix->list) : NULL;
+
+    pthread_rwlock_unlock(&ix->lock);
+    pthread_mutex_unlock(&ix->list_lock);
+    return m;
+}
@@ -0,0 +1,64 @@
+#ifndef NAMEINDEX_H
+#define NAMEINDEX_H
+
+#include "helpers.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* who is online, by name.
+
+   one table for all shards, hashed on the name, so finding a user
+   (/msg) costs one bucket walk instead of a walk over every client.
+   an entry holds the shard a user is on and an opaque handle the
+   shard resolves to its connection; no pointer crosses threads.
+   lookups share a read lock, only joins, leaves and renames write.
+
+   the /list answer is kept as one finished frame, made again only
+   after the names changed; every /list in between shares it. */
+
+typedef struct NameEntry {
+    char name[MAX_NAME];
+    int shard;
+    uint64_t handle;
+    struct NameEntry *next;
+} NameEntry;
+
+typedef struct {
+    pthread_rwlock_t lock;
+    NameEntry **buckets;
+    size_t bucket_count;    /* a power of two */
+    size_t count;
+    uint64_t version;       /* bumped by every change */
+
+    pthread_mutex_t list_lock;
+    MsgBuf *list;           /* the /list frame, as of list_version */
+    uint64_t list_version;
+} NameIndex;
+
+int  nameindex_init(NameIndex *ix);
+
+/* add name for (shard, handle). returns -1 if the name is taken
+   (errno EEXIST) or out of memory. */
+int  nameindex_claim(NameIndex *ix, const char *name, int shard,
+                     uint64_t handle);
+
+/* rename the entry of handle from one name to another in one step,
+   so the user is never missing from the index. returns -1 as
+   nameindex_claim does; the old name stays then. */
+int  nameindex_rename(NameIndex *ix, const char *from, const char *to,
+                      uint64_t handle);
+
+/* drop name, if it still belongs to handle */
+void nameindex_release(NameIndex *ix, const char *name, uint64_t handle);
+
+/* where the user called name is. returns -1 if nobody is. */
+int  nameindex_find(NameIndex *ix, const char *name, int *shard,
+                    uint64_t *handle);
+
+/* a reference to the /list frame ("* N online: a, b, ...");
+   drop it with msgbuf_unref. NULL if out of memory. */
+MsgBuf *nameindex_list(NameIndex *ix);
+
+#endif
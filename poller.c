@@ -0,0 +1,328 @@
+#include "poller.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+
+struct Poller {
+    int backend;
+
+    /* select and poll: the registered descriptors, dense
+       (swap-with-last on removal), plus fd → slot */
+    struct pollfd *fds;
+    void **ptrs;
+    int count;
+    int cap;
+    int *slot_of_fd;
+    int fd_cap;
+    int scan;               /* where the next poll/select scan starts */
+
+    /* epoll */
+    int epfd;
+    struct epoll_event *events;
+    int events_cap;
+};
+
+static const char *names[] = {
+    [POLLER_SELECT]   = "select",
+    [POLLER_POLL]     = "poll",
+    [POLLER_EPOLL]    = "epoll",
+    [POLLER_EPOLL_ET] = "epoll-et"
+};
+
+int poller_backend(const char *name) {
+
+    for (int b = 0; b < (int)(sizeof(names) / sizeof(names[0])); b++)
+        if (strcmp(name, names[b]) == 0)
+            return b;
+
+    return -1;
+}
+
+const char *poller_name(int backend) {
+    return names[backend];
+}
+
+static int is_epoll(const Poller *p) {
+    return p->backend == POLLER_EPOLL || p->backend == POLLER_EPOLL_ET;
+}
+
+Poller *poller_new(int backend) {
+
+    Poller *p = calloc(1, sizeof(*p));
+    if (!p)
+        return NULL;
+
+    p->backend = backend;
+    p->epfd = -1;
+
+    if (is_epoll(p)) {
+        p->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (p->epfd < 0) {
+            free(p);
+            return NULL;
+        }
+    }
+
+    return p;
+}
+
+void poller_free(Poller *p) {
+
+    if (!p)
+        return;
+
+    if (p->epfd >= 0)
+        close(p->epfd);
+
+    free(p->fds);
+    free(p->ptrs);
+    free(p->slot_of_fd);
+    free(p->events);
+    free(p);
+}
+
+int poller_fd_limit(const Poller *p) {
+    return p->backend == POLLER_SELECT ? FD_SETSIZE : -1;
+}
+
+int poller_edge(const Poller *p) {
+    return p->backend == POLLER_EPOLL_ET;
+}
+
+static uint32_t epoll_bits(const Poller *p, int events) {
+    return (events & POLLER_IN ? EPOLLIN : 0) |
+           (events & POLLER_OUT ? EPOLLOUT : 0) |
+           (poller_edge(p) && !(events & POLLER_LEVEL) ? EPOLLET : 0);
+}
+
+static short poll_bits(int events) {
+    return (events & POLLER_IN ? POLLIN : 0) |
+           (events & POLLER_OUT ? POLLOUT : 0);
+}
+
+static int slot_of(const Poller *p, int fd) {
+    return fd >= 0 && fd < p->fd_cap ? p->slot_of_fd[fd] : -1;
+}
+
+int poller_add(Poller *p, int fd, int events, void *ptr) {
+
+    if (is_epoll(p)) {
+        struct epoll_event ev;
+        ev.events = epoll_bits(p, events);
+        ev.data.ptr = ptr;
+        return epoll_ctl(p->epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    if (fd < 0 || (p->backend == POLLER_SELECT && fd >= FD_SETSIZE)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (slot_of(p, fd) >= 0) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    /* grow the fd map */
+    if (fd >= p->fd_cap) {
+        int cap = p->fd_cap ? p->fd_cap : 64;
+        while (cap <= fd)
+            cap *= 2;
+
+        int *map = realloc(p->slot_of_fd, cap * sizeof(*map));
+        if (!map)
+            return -1;
+
+        for (int i = p->fd_cap; i < cap; i++)
+            map[i] = -1;
+
+        p->slot_of_fd = map;
+        p->fd_cap = cap;
+    }
+
+    /* and the dense arrays */
+    if (p->count == p->cap) {
+        int cap = p->cap ? p->cap * 2 : 64;
+
+        struct pollfd *fds = realloc(p->fds, cap * sizeof(*fds));
+        if (!fds)
+            return -1;
+        p->fds = fds;
+
+        void **ptrs = realloc(p->ptrs, cap * sizeof(*ptrs));
+        if (!ptrs)
+            return -1;
+        p->ptrs = ptrs;
+
+        p->cap = cap;
+    }
+
+    int i = p->count++;
+    p->fds[i].fd = fd;
+    p->fds[i].events = poll_bits(events);
+    p->fds[i].revents = 0;
+    p->ptrs[i] = ptr;
+    p->slot_of_fd[fd] = i;
+    return 0;
+}
+
+int poller_mod(Poller *p, int fd, int events, void *ptr) {
+
+    if (is_epoll(p)) {
+        struct epoll_event ev;
+        ev.events = epoll_bits(p, events);
+        ev.data.ptr = ptr;
+        return epoll_ctl(p->epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    int i = slot_of(p, fd);
+    if (i < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    p->fds[i].events = poll_bits(events);
+    p->ptrs[i] = ptr;
+    return 0;
+}
+
+void poller_del(Poller *p, int fd) {
+
+    if (is_epoll(p)) {
+        epoll_ctl(p->epfd, EPOLL_CTL_DEL, fd, NULL);
+        return;
+    }
+
+    int i = slot_of(p, fd);
+    if (i < 0)
+        return;
+
+    /* the last entry fills the hole */
+    int last = --p->count;
+    if (i != last) {
+        p->fds[i] = p->fds[last];
+        p->ptrs[i] = p->ptrs[last];
+        p->slot_of_fd[p->fds[i].fd] = i;
+    }
+
+    p->slot_of_fd[fd] = -1;
+}
+
+static int wait_epoll(Poller *p, PollerEvent *out, int max, int timeout_ms) {
+
+    if (max > p->events_cap) {
+        struct epoll_event *ev = realloc(p->events, max * sizeof(*ev));
+        if (!ev)
+            return -1;
+        p->events = ev;
+        p->events_cap = max;
+    }
+
+    int n = epoll_wait(p->epfd, p->events, max, timeout_ms);
+
+    for (int k = 0; k < n; k++) {
+        uint32_t re = p->events[k].events;
+        out[k].ptr = p->events[k].data.ptr;
+        out[k].events = (re & EPOLLIN ? POLLER_IN : 0) |
+                        (re & EPOLLOUT ? POLLER_OUT : 0) |
+                        (re & (EPOLLERR | EPOLLHUP) ? POLLER_ERR : 0);
+    }
+
+    return n;
+}
+
+static int wait_poll(Poller *p, PollerEvent *out, int max, int timeout_ms) {
+
+    int r = poll(p->fds, p->count, timeout_ms);
+    if (r <= 0)
+        return r;
+
+    /* more may be ready than fit in out; as with select, the next
+       scan starts where this one stopped */
+    int n = 0;
+    for (int k = 0; k < p->count && n < max; k++) {
+
+        int i = (p->scan + k) % p->count;
+        short re = p->fds[i].revents;
+        if (!re)
+            continue;
+
+        out[n].ptr = p->ptrs[i];
+        out[n].events = (re & POLLIN ? POLLER_IN : 0) |
+                        (re & POLLOUT ? POLLER_OUT : 0) |
+                        (re & (POLLERR | POLLHUP | POLLNVAL) ? POLLER_ERR : 0);
+        n++;
+
+        if (n == max)
+            p->scan = (i + 1) % p->count;
+    }
+
+    return n;
+}
+
+static int wait_select(Poller *p, PollerEvent *out, int max, int timeout_ms) {
+
+    fd_set rfds, wfds;
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    int max_fd = -1;
+
+    for (int i = 0; i < p->count; i++) {
+
+        int fd = p->fds[i].fd;
+
+        if (p->fds[i].events & POLLIN)
+            FD_SET(fd, &rfds);
+        if (p->fds[i].events & POLLOUT)
+            FD_SET(fd, &wfds);
+
+        if (fd > max_fd)
+            max_fd = fd;
+    }
+
+    struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    int r = select(max_fd + 1, &rfds, &wfds, NULL, timeout_ms < 0 ? NULL : &tv);
+    if (r <= 0)
+        return r;
+
+    /* more may be ready than fit in out; the next scan starts where
+       this one stopped, so nobody is skipped for long */
+    int n = 0;
+    for (int k = 0; k < p->count && n < max; k++) {
+
+        int i = (p->scan + k) % p->count;
+        int fd = p->fds[i].fd;
+
+        int ev = (FD_ISSET(fd, &rfds) ? POLLER_IN : 0) |
+                 (FD_ISSET(fd, &wfds) ? POLLER_OUT : 0);
+        if (!ev)
+            continue;
+
+        out[n].ptr = p->ptrs[i];
+        out[n].events = ev;
+        n++;
+
+        if (n == max)
+            p->scan = (i + 1) % p->count;
+    }
+
+    return n;
+}
+
+int poller_wait(Poller *p, PollerEvent *out, int max, int timeout_ms) {
+
+    switch (p->backend) {
+    case POLLER_EPOLL:
+    case POLLER_EPOLL_ET:
+        return wait_epoll(p, out, max, timeout_ms);
+    case POLLER_POLL:
+        return wait_poll(p, out, max, timeout_ms);
+    default:
+        return wait_select(p, out, max, timeout_ms);
+    }
+}
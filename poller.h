@@ -0,0 +1,61 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+/* readiness event loop interface.
+
+   one set of calls over select(), poll() and epoll, picked at run
+   time. descriptors are registered with the events they wait for
+   and a pointer handed back with every readiness event, so the loop
+   built on top is the same for every backend.
+
+   select and poll are level triggered by nature; epoll is used the
+   same way, and as epoll-et with every descriptor edge triggered:
+   readiness is reported once per change, so whoever gets an event
+   has to read (or accept) until the descriptor has nothing left.
+   that is one wakeup per burst instead of one per read. a
+   descriptor must be removed before it is closed (epoll forgets
+   closed ones by itself, the others do not). */
+
+enum {
+    POLLER_SELECT,
+    POLLER_POLL,
+    POLLER_EPOLL,
+    POLLER_EPOLL_ET
+};
+
+/* interest and readiness bits */
+#define POLLER_IN   1
+#define POLLER_OUT  2
+#define POLLER_ERR  4       /* hangup or error, reported always */
+#define POLLER_LEVEL 8      /* interest only: level triggered, even
+                               under epoll-et */
+
+typedef struct {
+    void *ptr;
+    int events;             /* POLLER_* */
+} PollerEvent;
+
+typedef struct Poller Poller;
+
+/* backend by name ("select", "poll", "epoll"), -1 if unknown */
+int poller_backend(const char *name);
+const char *poller_name(int backend);
+
+Poller *poller_new(int backend);
+void    poller_free(Poller *p);
+
+/* descriptors at or above this cannot be watched (select), or -1 */
+int poller_fd_limit(const Poller *p);
+
+/* readiness is only reported when it changes (epoll-et) */
+int poller_edge(const Poller *p);
+
+int  poller_add(Poller *p, int fd, int events, void *ptr);
+int  poller_mod(Poller *p, int fd, int events, void *ptr);
+void poller_del(Poller *p, int fd);
+
+/* wait up to timeout_ms (-1: forever) and fill in at most max ready
+   descriptors. returns their number, or -1 on error. */
+int poller_wait(Poller *p, PollerEvent *out, int max, int timeout_ms);
+
+#endif
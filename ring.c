@@ -0,0 +1,54 @@
+#include "ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int ring_init(Ring *r, size_t size, int consumers) {
+
+    memset(r, 0, sizeof(*r));
+
+    /* round up to a power of two so seq → slot is a mask */
+    size_t n = 1;
+    while (n < size)
+        n *= 2;
+
+    r->slots = calloc(n, sizeof(*r->slots));
+    r->cursors = aligned_alloc(RING_CACHE_LINE,
+                               consumers * sizeof(*r->cursors));
+
+    if (!r->slots || !r->cursors) {
+        ring_free(r);
+        return -1;
+    }
+
+    memset(r->cursors, 0, consumers * sizeof(*r->cursors));
+    r->mask = n - 1;
+    r->consumers = consumers;
+    atomic_init(&r->next, 0);
+    return 0;
+}
+
+void ring_free(Ring *r) {
+    free(r->slots);
+    free(r->cursors);
+    r->slots = NULL;
+    r->cursors = NULL;
+}
+
+int ring_has_room(Ring *r, uint64_t seq) {
+
+    uint64_t size = r->mask + 1;
+
+    /* slot of seq was last used by seq - size */
+    if (seq < size)
+        return 1;
+
+    for (int c = 0; c < r->consumers; c++) {
+        uint64_t pos = atomic_load_explicit(&r->cursors[c].pos,
+                                            memory_order_acquire);
+        if (pos + size <= seq)
+            return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,78 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* lock-free broadcast ring.
+
+   every published item is seen by every consumer, in the same order.
+   producers claim consecutive sequence numbers with one atomic add,
+   which puts all messages from all threads into a single global
+   order; each consumer walks the ring with its own cursor and may
+   only read a slot once its producer has published it.
+
+   a producer must not overwrite a slot before the slowest consumer
+   has passed it, see ring_has_room(). */
+
+#define RING_CACHE_LINE 64
+
+typedef struct {
+    _Atomic uint64_t published;   /* seq + 1 once the item is visible */
+    void *item;
+} RingSlot;
+
+/* one cursor per consumer, on its own cache line */
+typedef struct {
+    _Alignas(RING_CACHE_LINE) _Atomic uint64_t pos;   /* next seq to read */
+} RingCursor;
+
+typedef struct {
+    RingSlot *slots;
+    uint64_t mask;                /* size - 1, size is a power of two */
+    RingCursor *cursors;
+    int consumers;
+    _Alignas(RING_CACHE_LINE) _Atomic uint64_t next;   /* next seq to claim */
+} Ring;
+
+/* ring with at least size slots, read by the given number of consumers */
+int  ring_init(Ring *r, size_t size, int consumers);
+void ring_free(Ring *r);
+
+/* reserve the next position in the global order */
+static inline uint64_t ring_claim(Ring *r) {
+    return atomic_fetch_add(&r->next, 1);
+}
+
+/* true once every consumer is done with the slot seq will reuse */
+int ring_has_room(Ring *r, uint64_t seq);
+
+/* make item visible at seq (the slot must have room) */
+static inline void ring_publish(Ring *r, uint64_t seq, void *item) {
+    RingSlot *s = &r->slots[seq & r->mask];
+    s->item = item;
+    atomic_store_explicit(&s->published, seq + 1, memory_order_release);
+}
+
+/* next item for consumer c, or NULL if it has not been published yet.
+   the item stays at the front until ring_advance(). */
+static inline void *ring_peek(Ring *r, int c, uint64_t *seq) {
+    uint64_t pos = atomic_load_explicit(&r->cursors[c].pos, memory_order_relaxed);
+    RingSlot *s = &r->slots[pos & r->mask];
+
+    if (atomic_load_explicit(&s->published, memory_order_acquire) != pos + 1)
+        return NULL;
+
+    if (seq)
+        *seq = pos;
+    return s->item;
+}
+
+/* consumer c is done with its current item */
+static inline void ring_advance(Ring *r, int c) {
+    uint64_t pos = atomic_load_explicit(&r->cursors[c].pos, memory_order_relaxed);
+    atomic_store_explicit(&r->cursors[c].pos, pos + 1, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include "room.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int room_table_init(RoomTable *t, int shards) {
+
+    memset(t, 0, sizeof(*t));
+    t->shards = shards;
+    atomic_init(&t->count, 0);
+
+    return pthread_mutex_init(&t->lock, NULL) == 0 ? 0 : -1;
+}
+
+int room_name(const char *in, char out[ROOM_NAME]) {
+
+    if (*in == '#')
+        in++;
+
+    size_t len = strlen(in);
+    if (len == 0 || len >= ROOM_NAME - 1)
+        return -1;
+
+    for (size_t k = 0; k < len; k++) {
+        char ch = in[k];
+        if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+              (ch >= '0' && ch <= '9') || ch == '-' || ch == '_'))
+            return -1;
+    }
+
+    out[0] = '#';
+    memcpy(out + 1, in, len + 1);
+    return 0;
+}
+
+/* fnv-1a */
+static unsigned hash_name(const char *name) {
+
+    uint32_t h = 2166136261u;
+    for (; *name; name++)
+        h = (h ^ (unsigned char)*name) * 16777619u;
+
+    return h % ROOM_BUCKETS;
+}
+
+Room *room_get(RoomTable *t, const char *name, size_t cache_cap, int create) {
+
+    unsigned b = hash_name(name);
+
+    pthread_mutex_lock(&t->lock);
+
+    Room *r = t->buckets[b];
+    while (r && strcmp(r->name, name) != 0)
+        r = r->hash_next;
+
+    int count = atomic_load(&t->count);
+
+    if (!r && create && count < MAX_ROOMS) {
+
+        r = calloc(1, sizeof(*r));
+        if (r)
+            r->shards = aligned_alloc(ROOM_CACHE_LINE,
+                                      t->shards * sizeof(*r->shards));
+
+        if (r && r->shards) {
+            memset(r->shards, 0, t->shards * sizeof(*r->shards));
+            r->id = count;
+            r->cache_cap = cache_cap;
+            strcpy(r->name, name);
+            pthread_mutex_init(&r->log_lock, NULL);
+
+            r->hash_next = t->buckets[b];
+            t->buckets[b] = r;
+
+            /* shards find it by id only through events published
+               after this, which orders the write before their reads */
+            t->rooms[count] = r;
+            atomic_store(&t->count, count + 1);
+        } else if (r) {
+            free(r);
+            r = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&t->lock);
+    return r;
+}
+
+int room_add(RoomShard *rs, void *member) {
+
+    if (rs->count == rs->cap) {
+
+        int cap = rs->cap ? rs->cap * 2 : 8;
+        void **members = realloc(rs->members, cap * sizeof(*members));
+        if (!members)
+            return -1;
+
+        rs->members = members;
+        rs->cap = cap;
+    }
+
+    rs->members[rs->count] = member;
+    return rs->count++;
+}
+
+void *room_remove(RoomShard *rs, int pos) {
+
+    int last = --rs->count;
+    if (pos == last)
+        return NULL;
+
+    rs->members[pos] = rs->members[last];
+    return rs->members[pos];
+}
+
+MsgCache *room_cache(Room *r, int shard) {
+
+    RoomShard *rs = &r->shards[shard];
+
+    /* a cache that cannot be allocated remembers nothing */
+    if (!rs->cache_ready) {
+        if (msgcache_init(&rs->cache, r->cache_cap) < 0)
+            msgcache_init(&rs->cache, 0);
+        rs->cache_ready = 1;
+    }
+
+    return &rs->cache;
+}
@@ -0,0 +1,103 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include "msgcache.h"
+#include "seglog.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* chat rooms.
+
+   a room exists once and is shared by all shards, but everything a
+   shard does with it lives in the room's slot for that shard: its
+   members on that shard (dense, swap-with-last, so joining and
+   leaving are O(1) at any size), the room's recent messages and how
+   many of them it delivered. only the owning shard touches its slot,
+   so none of it is locked. a chat event carries its room's id through
+   the broadcast ring, and costs every shard O(its members in that
+   room).
+
+   rooms are looked up by name in a hash table under a mutex, which
+   only /join and /part take. a room, once created, stays until exit. */
+
+/* MsgBuf.room of a private message, which belongs to no room */
+#define ROOM_DIRECT -1
+
+/* longest room name, '#' and terminator included */
+#define ROOM_NAME 32
+
+/* most rooms at once */
+#define MAX_ROOMS 4096
+
+#define ROOM_BUCKETS 1024
+
+#define ROOM_CACHE_LINE 64
+
+/* a room as seen by one shard */
+typedef struct {
+    _Alignas(ROOM_CACHE_LINE) void **members;
+    int count;
+    int cap;
+    MsgCache cache;         /* recent events, created on the first one */
+    int cache_ready;
+    uint64_t delivered;     /* events of the room this shard handled */
+} RoomShard;
+
+typedef struct Room {
+    int id;                 /* index in the table, carried by events */
+    char name[ROOM_NAME];
+    size_t cache_cap;
+    RoomShard *shards;      /* one per shard */
+    SegLog log;             /* its log stream, owned by the logger thread */
+    atomic_int log_state;   /* 0: not opened yet, 1: open, 2: closed
+                               until its next event, -1: failed */
+    uint64_t log_base;      /* sequence number in log of the room's first
+                               event since startup; set before log_state
+                               turns 1 */
+    pthread_mutex_t log_lock;   /* held to read the log, and to open or
+                                   close it */
+    struct Room *log_newer; /* open room logs, by their last write */
+    struct Room *log_older;
+    struct Room *hash_next;
+} Room;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Room *rooms[MAX_ROOMS];
+    atomic_int count;
+    Room *buckets[ROOM_BUCKETS];
+    int shards;
+} RoomTable;
+
+int room_table_init(RoomTable *t, int shards);
+
+/* "#name" from a user's "name" or "#name": letters, digits, '-' and
+   '_' only. returns -1 if it is not a valid room name. */
+int room_name(const char *in, char out[ROOM_NAME]);
+
+/* the room called name (see room_name), created with a cache of
+   cache_cap messages per shard if create is set. NULL if there is no
+   such room, or no room for another one. */
+Room *room_get(RoomTable *t, const char *name, size_t cache_cap, int create);
+
+/* room by id; only for ids taken from an event or a membership */
+static inline Room *room_at(RoomTable *t, int id) {
+    return t->rooms[id];
+}
+
+/* add a member to a shard's slot; returns its position, -1 if out
+   of memory */
+int room_add(RoomShard *rs, void *member);
+
+/* remove the member at pos. the last member moves into pos and is
+   returned (its caller has to remember its new position), or NULL if
+   pos was the last one. */
+void *room_remove(RoomShard *rs, int pos);
+
+/* the shard's cache of recent events of r */
+MsgCache *room_cache(Room *r, int shard);
+
+#endif
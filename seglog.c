@@ -0,0 +1,977 @@
+/* copy_file_range() */
+#define _GNU_SOURCE
+
+#include "seglog.h"
+#include "helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/* bytes read per step when an index has to be rebuilt */
+#define SCAN_BLOCK (64 * 1024)
+
+/* index entries handled per step when merging segments */
+#define IDX_BLOCK 8192
+
+static void seg_path(const SegLog *sl, uint64_t first, const char *ext,
+                     char *out, size_t size) {
+    snprintf(out, size, "%s/chat-%020llu.%s", sl->dir,
+             (unsigned long long)first, ext);
+}
+
+static Segment *seg_new(uint64_t first, off_t base) {
+
+    Segment *s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+
+    s->first = first;
+    s->base = base;
+    s->fd = -1;
+    s->idx_fd = -1;
+    atomic_init(&s->refs, 1);
+    return s;
+}
+
+static Segment *seg_ref(Segment *s) {
+    if (s)
+        atomic_fetch_add(&s->refs, 1);
+    return s;
+}
+
+/* dropping the last reference to a segment also drops its reference
+   to the next one, so a loop instead of recursion */
+static void seg_unref(Segment *s) {
+
+    while (s && atomic_fetch_sub(&s->refs, 1) == 1) {
+
+        Segment *next = s->next;
+
+        if (s->fd >= 0)
+            close(s->fd);
+        if (s->idx_fd >= 0)
+            close(s->idx_fd);
+        free(s);
+
+        s = next;
+    }
+}
+
+static int seg_open(SegLog *sl, Segment *s, const char *ext) {
+    char path[512];
+    seg_path(sl, s->first, ext, path, sizeof(path));
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/* make room to open the files of s: close those of the oldest other
+   closed segments until fewer than SEGLOG_OPEN_SEGMENTS have any open. the
+   tail stays open, and so does the text of a segment a reader pins,
+   since it may be reading from it right now (indexes are only read
+   under the lock). */
+static void seg_evict(SegLog *sl, Segment *s) {
+
+    size_t open = 0;
+    for (Segment *o = sl->head; o != sl->tail; o = o->next)
+        if (o != s && (o->fd >= 0 || o->idx_fd >= 0))
+            open++;
+
+    for (Segment *o = sl->head; o != sl->tail && open >= SEGLOG_OPEN_SEGMENTS; o = o->next) {
+
+        if (o == s || (o->fd < 0 && o->idx_fd < 0))
+            continue;
+
+        if (o->idx_fd >= 0) {
+            close(o->idx_fd);
+            o->idx_fd = -1;
+        }
+        if (o->fd >= 0 && atomic_load(&o->refs) == 1) {
+            close(o->fd);
+            o->fd = -1;
+        }
+        if (o->fd < 0)
+            open--;
+    }
+}
+
+/* readers share one descriptor per file, opened the first time it
+   is needed (under sl->lock) */
+static int seg_fd(SegLog *sl, Segment *s) {
+
+    if (s->fd < 0) {
+        seg_evict(sl, s);
+        s->fd = seg_open(sl, s, "log");
+    }
+    return s->fd;
+}
+
+static int seg_idx_fd(SegLog *sl, Segment *s) {
+
+    if (s->idx_fd < 0) {
+        seg_evict(sl, s);
+        s->idx_fd = seg_open(sl, s, "idx");
+    }
+    return s->idx_fd;
+}
+
+/* offset in s where message k (of s) starts; -1 on error */
+static off_t seg_start(SegLog *sl, Segment *s, uint64_t k) {
+
+    if (k == s->first)
+        return 0;
+    if (k == s->first + s->count)
+        return s->size;
+
+    int fd = seg_idx_fd(sl, s);
+    uint64_t end;
+
+    if (fd < 0 ||
+        pread(fd, &end, sizeof(end), (k - 1 - s->first) * sizeof(end)) != sizeof(end))
+        return -1;
+
+    return (off_t)end;
+}
+
+/* refill sl->order after the list changed (under sl->lock). without
+   the memory for it, lookups walk the list instead. */
+static void seg_order(SegLog *sl) {
+
+    if (sl->segments > sl->order_cap) {
+        size_t cap = sl->segments * 2;
+        Segment **p = realloc(sl->order, cap * sizeof(*p));
+        if (!p) {
+            sl->ordered = 0;
+            return;
+        }
+        sl->order = p;
+        sl->order_cap = cap;
+    }
+
+    size_t n = 0;
+    for (Segment *s = sl->head; ; s = s->next) {
+        sl->order[n++] = s;
+        if (s == sl->tail)
+            break;
+    }
+    sl->ordered = n;
+}
+
+/* the kept segment holding message k (the tail for the next one) */
+static Segment *seg_find(SegLog *sl, uint64_t k) {
+
+    if (!sl->ordered) {
+        Segment *s = sl->head;
+        while (s != sl->tail && k >= s->first + s->count)
+            s = s->next;
+        return s;
+    }
+
+    /* the last segment starting at or before k */
+    size_t lo = 0, hi = sl->ordered - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (sl->order[mid]->first <= k)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    /* k in a gap a repair left after it: the next one */
+    Segment *s = sl->order[lo];
+    if (s != sl->tail && k >= s->first + s->count)
+        s = s->next;
+    return s;
+}
+
+/* position of message k counted over all kept segments */
+static off_t log_pos(SegLog *sl, uint64_t k) {
+
+    Segment *s = seg_find(sl, k);
+    off_t off = seg_start(sl, s, k);
+    return off < 0 ? -1 : s->base + off;
+}
+
+static int day_of(time_t t) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    return tm.tm_year * 1000 + tm.tm_yday;
+}
+
+/* ---------- startup ---------- */
+
+/* make the index of s match its text again after a crash: entries
+   past the end of the text go, lines written but not indexed get
+   entries, and a partly written last line is cut off. */
+static int seg_repair(SegLog *sl, Segment *s) {
+
+    char path[512];
+    struct stat st;
+
+    seg_path(sl, s->first, "log", path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0)
+        goto fail;
+
+    seg_path(sl, s->first, "idx", path, sizeof(path));
+    int idx = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (idx < 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct stat ist;
+    if (fstat(idx, &ist) < 0)
+        goto fail_idx;
+
+    uint64_t count = ist.st_size / sizeof(uint64_t);
+    uint64_t end = 0;
+
+    /* drop entries pointing past the text */
+    while (count > 0) {
+        if (pread(idx, &end, sizeof(end), (count - 1) * sizeof(end)) != sizeof(end))
+            goto fail_idx;
+        if ((off_t)end <= st.st_size)
+            break;
+        count--;
+        end = 0;
+    }
+
+    if (ftruncate(idx, count * sizeof(end)) < 0)
+        goto fail_idx;
+
+    /* index the lines after the last indexed one */
+    char *buf = malloc(SCAN_BLOCK);
+    uint64_t *ends = malloc(SCAN_BLOCK * sizeof(*ends));
+    if (!buf || !ends) {
+        free(buf);
+        free(ends);
+        goto fail_idx;
+    }
+
+    off_t pos = end;
+    while (pos < st.st_size) {
+
+        ssize_t n = pread(fd, buf, SCAN_BLOCK, pos);
+        if (n <= 0)
+            break;
+
+        size_t found = 0;
+        for (ssize_t i = 0; i < n; i++)
+            if (buf[i] == '\n')
+                ends[found++] = pos + i + 1;
+
+        if (found > 0) {
+            struct iovec iov = { ends, found * sizeof(*ends) };
+            if (lseek(idx, 0, SEEK_END) < 0 || writev_all(idx, &iov, 1) < 0)
+                break;
+            count += found;
+            end = ends[found - 1];
+        }
+
+        pos += n;
+    }
+
+    free(buf);
+    free(ends);
+
+    /* a line without its newline never made it completely */
+    if ((off_t)end < st.st_size && ftruncate(fd, end) < 0)
+        goto fail_idx;
+
+    s->count = count;
+    s->size = end;
+
+    close(idx);
+    close(fd);
+    return 0;
+
+fail_idx:
+    close(idx);
+fail:
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+/* counts and sizes of s from its files; repairs it if they disagree */
+static int seg_load(SegLog *sl, Segment *s) {
+
+    char path[512];
+    struct stat st, ist;
+
+    seg_path(sl, s->first, "log", path, sizeof(path));
+    if (stat(path, &st) < 0)
+        return -1;
+    s->mtime = st.st_mtime;
+
+    seg_path(sl, s->first, "idx", path, sizeof(path));
+    if (stat(path, &ist) < 0)
+        return seg_repair(sl, s);
+
+    s->count = ist.st_size / sizeof(uint64_t);
+    s->size = st.st_size;
+
+    /* a consistent index ends exactly where the text does */
+    uint64_t last = 0;
+    if (s->count) {
+        /* a descriptor of our own: most segments are never read again */
+        int fd = seg_open(sl, s, "idx");
+        if (fd < 0)
+            return -1;
+        ssize_t n = pread(fd, &last, sizeof(last), (s->count - 1) * sizeof(last));
+        close(fd);
+        if (n != sizeof(last))
+            return -1;
+    }
+
+    if (ist.st_size % sizeof(uint64_t) != 0 || (off_t)last != s->size)
+        return seg_repair(sl, s);
+
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* sequence numbers of the segments in dir, sorted */
+static int list_segments(SegLog *sl, uint64_t **out, size_t *n) {
+
+    DIR *d = opendir(sl->dir);
+    if (!d)
+        return -1;
+
+    uint64_t *firsts = NULL;
+    size_t count = 0, cap = 0;
+    struct dirent *e;
+
+    while ((e = readdir(d))) {
+
+        unsigned long long first;
+        int len = 0;
+
+        if (sscanf(e->d_name, "chat-%20llu.log%n", &first, &len) != 1 ||
+            e->d_name[len] != '\0')
+            continue;
+
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            uint64_t *p = realloc(firsts, cap * sizeof(*p));
+            if (!p) {
+                free(firsts);
+                closedir(d);
+                return -1;
+            }
+            firsts = p;
+        }
+        firsts[count++] = first;
+    }
+
+    closedir(d);
+    if (count)
+        qsort(firsts, count, sizeof(*firsts), cmp_u64);
+
+    *out = firsts;
+    *n = count;
+    return 0;
+}
+
+/* create the files of a new, empty tail segment */
+static int tail_create(SegLog *sl, uint64_t first) {
+
+    char path[512];
+
+    seg_path(sl, first, "log", path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+
+    seg_path(sl, first, "idx", path, sizeof(path));
+    int idx = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (idx < 0) {
+        close(fd);
+        return -1;
+    }
+
+    sl->wfd = fd;
+    sl->widx = idx;
+    return 0;
+}
+
+static void maintain(SegLog *sl);
+
+int seglog_open(SegLog *sl, const char *dir, const char *legacy,
+                const SegLogConfig *cfg) {
+
+    memset(sl, 0, sizeof(*sl));
+    snprintf(sl->dir, sizeof(sl->dir), "%s", dir);
+    sl->cfg = *cfg;
+    sl->wfd = sl->widx = -1;
+    pthread_mutex_init(&sl->lock, NULL);
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        goto fail;
+
+    uint64_t *firsts;
+    size_t n;
+    if (list_segments(sl, &firsts, &n) < 0)
+        goto fail;
+
+    /* the log from before segments: it is the history up to now */
+    if (n == 0 && legacy && access(legacy, F_OK) == 0) {
+
+        char path[512];
+        seg_path(sl, 0, "log", path, sizeof(path));
+
+        if (rename(legacy, path) < 0) {
+            free(firsts);
+            goto fail;
+        }
+
+        free(firsts);
+        if (list_segments(sl, &firsts, &n) < 0)
+            goto fail;
+    }
+
+    /* only sizes and counts are read, never the text itself
+       (unless an index needs repair) */
+    Segment *prev = NULL;
+    off_t base = 0;
+
+    for (size_t i = 0; i < n; i++) {
+
+        Segment *s = seg_new(firsts[i], base);
+        if (!s || seg_load(sl, s) < 0) {
+            seg_unref(s);
+            free(firsts);
+            goto fail;
+        }
+
+        if (prev)
+            prev->next = s;
+        else
+            sl->head = s;
+
+        prev = s;
+        base += s->size;
+        sl->segments++;
+    }
+
+    free(firsts);
+
+    if (!prev) {
+        prev = seg_new(0, 0);
+        if (!prev)
+            goto fail;
+        prev->mtime = time(NULL);
+        sl->head = prev;
+        sl->segments = 1;
+    }
+
+    sl->tail = prev;
+    sl->end = prev->first + prev->count;
+    sl->tail_day = day_of(prev->mtime);
+    seg_order(sl);
+
+    if (tail_create(sl, prev->first) < 0)
+        goto fail;
+
+    maintain(sl);
+    return 0;
+
+    /* a failed open gives back the segments loaded so far, and
+       the lock */
+fail:
+    seglog_close(sl);
+    return -1;
+}
+
+void seglog_close(SegLog *sl) {
+
+    if (sl->wfd >= 0)
+        close(sl->wfd);
+    if (sl->widx >= 0)
+        close(sl->widx);
+
+    seg_unref(sl->head);
+    free(sl->order);
+    pthread_mutex_destroy(&sl->lock);
+    memset(sl, 0, sizeof(*sl));
+}
+
+/* ---------- retention and compaction (writer thread) ---------- */
+
+/* s is about to lose its files. a reader pinning it, or an older
+   segment of the same chain, still reads from the descriptor, so
+   it is opened without making room: the segments it would close
+   may be next on that chain. */
+static void keep_open(SegLog *sl, Segment *s) {
+    if (s->fd < 0)
+        s->fd = seg_open(sl, s, "log");
+}
+
+static void remove_files(SegLog *sl, uint64_t first) {
+
+    char path[512];
+
+    seg_path(sl, first, "log", path, sizeof(path));
+    unlink(path);
+    seg_path(sl, first, "idx", path, sizeof(path));
+    unlink(path);
+}
+
+static void retain(SegLog *sl) {
+
+    time_t oldest = time(NULL) - (time_t)sl->cfg.retain_days * 24 * 3600;
+
+    pthread_mutex_lock(&sl->lock);
+
+    while (sl->head != sl->tail) {
+
+        Segment *h = sl->head;
+
+        int too_many = sl->cfg.retain_segments &&
+                       sl->segments > sl->cfg.retain_segments;
+        int too_old = sl->cfg.retain_days && h->mtime < oldest;
+
+        if (!too_many && !too_old)
+            break;
+
+        if (atomic_load(&h->refs) > 1)
+            keep_open(sl, h);
+
+        remove_files(sl, h->first);
+
+        sl->head = seg_ref(h->next);
+        sl->segments--;
+        seg_unref(h);
+    }
+
+    seg_order(sl);
+    pthread_mutex_unlock(&sl->lock);
+}
+
+/* copy len bytes from in to out, in the kernel if possible */
+static int copy_bytes(int in, int out, off_t len) {
+
+    char buf[SCAN_BLOCK];
+
+    while (len > 0) {
+
+        ssize_t n = copy_file_range(in, NULL, out, NULL, len, 0);
+
+        /* not across these files: copy by hand */
+        if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL)) {
+            n = read(in, buf, len < SCAN_BLOCK ? len : SCAN_BLOCK);
+            if (n > 0) {
+                struct iovec iov = { buf, n };
+                if (writev_all(out, &iov, 1) < 0)
+                    return -1;
+            }
+        }
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* append the index of s to out, its offsets moved by delta */
+static int copy_index(SegLog *sl, Segment *s, int out, off_t delta) {
+
+    uint64_t ends[IDX_BLOCK];
+    char path[512];
+
+    /* a descriptor of our own: s->idx_fd belongs to the readers */
+    seg_path(sl, s->first, "idx", path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    uint64_t k = 0;
+    while (k < s->count) {
+
+        size_t n = s->count - k < IDX_BLOCK ? s->count - k : IDX_BLOCK;
+        size_t len = n * sizeof(*ends);
+
+        if (pread(fd, ends, len, k * sizeof(*ends)) != (ssize_t)len)
+            break;
+
+        for (size_t i = 0; i < n; i++)
+            ends[i] += delta;
+
+        struct iovec iov = { ends, len };
+        if (writev_all(out, &iov, 1) < 0)
+            break;
+
+        k += n;
+    }
+
+    close(fd);
+    return k == s->count ? 0 : -1;
+}
+
+/* merge the n closed segments from a to b into one, which takes a's
+   place in the list. prev is the one before a (NULL for the head).
+   returns the merged segment, or NULL (and nothing changed). */
+static Segment *merge(SegLog *sl, Segment *prev, Segment *a, Segment *b) {
+
+    char tmp_log[512], tmp_idx[512], path[512];
+
+    seg_path(sl, a->first, "log.tmp", tmp_log, sizeof(tmp_log));
+    seg_path(sl, a->first, "idx.tmp", tmp_idx, sizeof(tmp_idx));
+
+    int out = open(tmp_log, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int out_idx = open(tmp_idx, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    Segment *m = seg_new(a->first, a->base);
+    int ok = out >= 0 && out_idx >= 0 && m;
+
+    /* the segments are closed, so no lock is needed to read them */
+    for (Segment *s = a; ok; s = s->next) {
+
+        seg_path(sl, s->first, "log", path, sizeof(path));
+        int in = open(path, O_RDONLY | O_CLOEXEC);
+
+        ok = in >= 0 &&
+             copy_bytes(in, out, s->size) == 0 &&
+             copy_index(sl, s, out_idx, m->size) == 0;
+
+        if (in >= 0)
+            close(in);
+
+        m->count += s->count;
+        m->size += s->size;
+        m->mtime = s->mtime;
+
+        if (s == b)
+            break;
+    }
+
+    ok = ok && fdatasync(out) == 0 && fdatasync(out_idx) == 0;
+
+    if (out >= 0)
+        close(out);
+    if (out_idx >= 0)
+        close(out_idx);
+
+    if (!ok) {
+        unlink(tmp_log);
+        unlink(tmp_idx);
+        free(m);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&sl->lock);
+
+    /* a pinned reader may walk the old chain to its end */
+    int pinned = 0;
+    for (Segment *s = a; ; s = s->next) {
+        pinned |= atomic_load(&s->refs) > 1;
+        if (s == b)
+            break;
+    }
+
+    for (Segment *s = a; pinned; s = s->next) {
+        keep_open(sl, s);
+        if (s == b)
+            break;
+    }
+
+    /* the merged files replace a's; the others go */
+    seg_path(sl, a->first, "log", path, sizeof(path));
+    rename(tmp_log, path);
+    seg_path(sl, a->first, "idx", path, sizeof(path));
+    rename(tmp_idx, path);
+
+    for (Segment *s = a->next; ; s = s->next) {
+        remove_files(sl, s->first);
+        sl->segments--;
+        if (s == b)
+            break;
+    }
+
+    m->next = seg_ref(b->next);
+
+    if (prev)
+        prev->next = m;
+    else
+        sl->head = m;
+
+    seg_order(sl);
+    pthread_mutex_unlock(&sl->lock);
+
+    /* drops a and, unless pinned, the rest of the old chain */
+    seg_unref(a);
+    return m;
+}
+
+static void compact(SegLog *sl) {
+
+    if (!sl->cfg.compact_bytes)
+        return;
+
+    Segment *prev = NULL;
+    Segment *a = sl->head;
+
+    /* only the writer changes the list, so it may walk it unlocked */
+    while (a != sl->tail) {
+
+        Segment *b = a;
+        off_t size = a->size;
+
+        while (b->next != sl->tail &&
+               size + b->next->size <= sl->cfg.compact_bytes) {
+            b = b->next;
+            size += b->size;
+        }
+
+        if (b != a) {
+            Segment *m = merge(sl, prev, a, b);
+            if (m)
+                a = m;
+            else
+                a = b;
+        }
+
+        prev = a;
+        a = a->next;
+    }
+}
+
+static void maintain(SegLog *sl) {
+    retain(sl);
+    compact(sl);
+}
+
+/* ---------- writer ---------- */
+
+/* close the tail and start a new one with the next message */
+static int rotate(SegLog *sl, time_t now) {
+
+    int old_fd = sl->wfd, old_idx = sl->widx;
+
+    Segment *s = seg_new(sl->end, sl->tail->base + sl->tail->size);
+    if (!s)
+        return -1;
+
+    if (tail_create(sl, sl->end) < 0) {
+        free(s);
+        return -1;
+    }
+
+    /* a closed segment is never written again */
+    fdatasync(old_fd);
+    fdatasync(old_idx);
+    close(old_fd);
+    close(old_idx);
+
+    s->mtime = now;
+
+    pthread_mutex_lock(&sl->lock);
+    sl->tail->next = s;
+    sl->tail = s;
+    sl->segments++;
+    seg_order(sl);
+    pthread_mutex_unlock(&sl->lock);
+
+    sl->tail_day = day_of(now);
+
+    maintain(sl);
+    return 0;
+}
+
+int seglog_append(SegLog *sl, struct iovec *iov, int n) {
+
+    if (n <= 0)
+        return 0;
+
+    time_t now = time(NULL);
+    Segment *t = sl->tail;
+
+    int full = sl->cfg.segment_bytes && t->size >= sl->cfg.segment_bytes;
+    int new_day = sl->cfg.daily && day_of(now) != sl->tail_day;
+
+    if (t->count > 0 && (full || new_day))
+        rotate(sl, now);
+
+    t = sl->tail;
+
+    /* index entries first, while the lengths are intact */
+    uint64_t *ends = malloc(n * sizeof(*ends));
+    if (!ends)
+        return -1;
+
+    off_t size = t->size;
+    for (int k = 0; k < n; k++) {
+        size += iov[k].iov_len;
+        ends[k] = size;
+    }
+
+    /* a failed write must not leave part of a line behind */
+    if (writev_all(sl->wfd, iov, n) < 0) {
+        int err = errno;
+        if (ftruncate(sl->wfd, t->size) < 0)
+            perror("seglog: ftruncate");
+        free(ends);
+        errno = err;
+        return -1;
+    }
+
+    /* the text is in place before its index points at it */
+    struct iovec idx = { ends, n * sizeof(*ends) };
+    int r = writev_all(sl->widx, &idx, 1);
+    free(ends);
+
+    if (r < 0) {
+        int err = errno;
+        if (ftruncate(sl->wfd, t->size) < 0)
+            perror("seglog: ftruncate");
+        errno = err;
+        return -1;
+    }
+
+    pthread_mutex_lock(&sl->lock);
+    t->count += n;
+    t->size = size;
+    t->mtime = now;
+    sl->end += n;
+    pthread_mutex_unlock(&sl->lock);
+
+    sl->tail_day = day_of(now);
+    return 0;
+}
+
+int seglog_sync(SegLog *sl) {
+    if (fdatasync(sl->wfd) < 0 || fdatasync(sl->widx) < 0)
+        return -1;
+    return 0;
+}
+
+/* ---------- readers ---------- */
+
+uint64_t seglog_begin(SegLog *sl) {
+
+    pthread_mutex_lock(&sl->lock);
+    uint64_t first = sl->head->first;
+    pthread_mutex_unlock(&sl->lock);
+
+    return first;
+}
+
+uint64_t seglog_end(SegLog *sl) {
+
+    pthread_mutex_lock(&sl->lock);
+    uint64_t end = sl->end;
+    pthread_mutex_unlock(&sl->lock);
+
+    return end;
+}
+
+uint64_t seglog_window(SegLog *sl, uint64_t upto, size_t max_msgs,
+                       size_t max_bytes, SegPos *pos, off_t *bytes) {
+
+    pthread_mutex_lock(&sl->lock);
+
+    uint64_t begin = sl->head->first;
+
+    if (upto > sl->end)
+        upto = sl->end;
+    if (upto < begin)
+        upto = begin;
+
+    uint64_t lo = upto - (upto - begin < max_msgs ? upto - begin : max_msgs);
+    uint64_t hi = upto;
+
+    off_t end = log_pos(sl, upto);
+    /* max_bytes may be (size_t)-1, which is no off_t */
+    off_t limit = end >= 0 && (size_t)end > max_bytes
+                  ? end - (off_t)max_bytes : 0;
+
+    /* first message starting inside the byte budget (positions grow
+       with the sequence number, so binary search over the indexes) */
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        off_t p = log_pos(sl, mid);
+        if (p >= 0 && p < limit)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    off_t start = log_pos(sl, lo);
+
+    /* an unreadable index gives an empty window */
+    if (start < 0 || end < 0) {
+        lo = upto;
+        start = end = 0;
+    }
+
+    Segment *s = seg_find(sl, lo);
+    pos->seg = seg_ref(s);
+    pos->off = start - s->base;
+    *bytes = end - start;
+
+    pthread_mutex_unlock(&sl->lock);
+    return lo;
+}
+
+int seglog_piece(SegLog *sl, SegPos *pos, off_t *off, size_t *avail) {
+
+    pthread_mutex_lock(&sl->lock);
+
+    /* at the end of a segment: continue with the next one */
+    while (pos->off >= pos->seg->size && pos->seg->next) {
+        Segment *next = seg_ref(pos->seg->next);
+        pos->off -= pos->seg->size;
+        seg_unref(pos->seg);
+        pos->seg = next;
+    }
+
+    int fd = seg_fd(sl, pos->seg);
+    *off = pos->off;
+    *avail = pos->seg->size - pos->off;
+
+    pthread_mutex_unlock(&sl->lock);
+    return fd;
+}
+
+int seglog_read(SegLog *sl, SegPos *pos, char *buf, size_t len) {
+
+    while (len > 0) {
+
+        off_t off;
+        size_t avail;
+
+        int fd = seglog_piece(sl, pos, &off, &avail);
+        if (fd < 0 || avail == 0)
+            return -1;
+
+        ssize_t n = pread(fd, buf, len < avail ? len : avail, off);
+        if (n <= 0)
+            return -1;
+
+        pos->off += n;
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+void seglog_release(SegPos *pos) {
+    seg_unref(pos->seg);
+    pos->seg = NULL;
+}
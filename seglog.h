@@ -0,0 +1,116 @@
+#ifndef SEGLOG_H
+#define SEGLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* segmented chat log.
+
+   the log is a directory of segments. a segment is a text file of
+   whole lines (one message per line) named after the sequence number
+   of its first message, e.g. chat-00000000000000001234.log, plus a
+   sidecar index (.idx) holding the end offset of each of its
+   messages as a 64 bit number. finding message k is one pread() of
+   an index, so neither startup nor history lookups ever read the
+   log text itself.
+
+   one thread (the logger) appends. a new segment starts when the
+   current one reaches the size limit or, in daily mode, on a new
+   day; then old segments are dropped (retention) and runs of small
+   closed ones merged (compaction). readers pin the segment they are
+   in, so a replay keeps working while its files are rotated away. */
+
+/* closed segments whose descriptors the readers keep open */
+#define SEGLOG_OPEN_SEGMENTS 4
+
+/* most descriptors an open log holds, pinned readers aside: the
+   tail's write and read ends, and those of the closed segments */
+#define SEGLOG_FDS (4 + 2 * SEGLOG_OPEN_SEGMENTS)
+
+typedef struct Segment {
+    uint64_t first;         /* sequence number of its first message */
+    uint64_t count;         /* messages in it */
+    off_t size;             /* bytes in it */
+    off_t base;             /* bytes of the kept segments before it */
+    time_t mtime;           /* last write */
+    int fd;                 /* text, opened for reading on demand
+                               (by a few closed segments at a time) */
+    int idx_fd;             /* index, likewise */
+    atomic_int refs;
+    struct Segment *next;   /* newer segment (holds a reference) */
+} Segment;
+
+typedef struct {
+    off_t segment_bytes;    /* new segment at this size (0: no limit) */
+    int daily;              /* new segment every day */
+    size_t retain_segments; /* keep at most this many (0: all) */
+    int retain_days;        /* drop segments older than this (0: never) */
+    off_t compact_bytes;    /* merge closed segments up to this size (0: off) */
+} SegLogConfig;
+
+typedef struct {
+    char dir[256];
+    SegLogConfig cfg;
+    pthread_mutex_t lock;   /* list and tail counters, for the readers */
+    Segment *head;          /* oldest kept segment (holds a reference) */
+    Segment *tail;          /* the one being written */
+    size_t segments;
+    Segment **order;        /* the same, oldest first, for lookups */
+    size_t ordered, order_cap;
+    uint64_t end;           /* sequence number of the next message */
+    int wfd, widx;          /* write ends of the tail */
+    int tail_day;           /* day the tail was started or last written */
+} SegLog;
+
+/* a read position, pinning its segment */
+typedef struct {
+    Segment *seg;
+    off_t off;              /* within seg */
+} SegPos;
+
+/* open (or create) the log in dir, repairing the newest segment's
+   index after a crash. an old single-file log at legacy, if there is
+   one and dir has no segments yet, becomes the first segment. */
+int  seglog_open(SegLog *sl, const char *dir, const char *legacy,
+                 const SegLogConfig *cfg);
+void seglog_close(SegLog *sl);
+
+/* writer side, one thread only */
+
+/* append n messages, iov[k] holding message k (a whole line).
+   iov is used up. */
+int seglog_append(SegLog *sl, struct iovec *iov, int n);
+
+/* make everything appended so far durable */
+int seglog_sync(SegLog *sl);
+
+/* readers */
+
+/* sequence numbers of the oldest kept and the next message */
+uint64_t seglog_begin(SegLog *sl);
+uint64_t seglog_end(SegLog *sl);
+
+/* the window of at most max_msgs messages and max_bytes bytes that
+   ends right before message upto (clamped to the log). pins *pos at
+   its start and stores its size in *bytes; returns its first
+   sequence number. */
+uint64_t seglog_window(SegLog *sl, uint64_t upto, size_t max_msgs,
+                       size_t max_bytes, SegPos *pos, off_t *bytes);
+
+/* where the bytes at pos are: returns a descriptor to read from at
+   *off, with *avail bytes left in that segment (moving pos on to the
+   next segment at the end of one). -1 on error. */
+int seglog_piece(SegLog *sl, SegPos *pos, off_t *off, size_t *avail);
+
+/* copy len bytes at pos to buf, advancing pos */
+int seglog_read(SegLog *sl, SegPos *pos, char *buf, size_t len);
+
+/* unpin */
+void seglog_release(SegPos *pos);
+
+#endif
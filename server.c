@@ -1,94 +1,2994 @@
 #include "helpers.h"
+#include "conntable.h"
+#include "ring.h"
+#include "seglog.h"
+#include "msgcache.h"
+#include "logger.h"
+#include "poller.h"
+#include "metrics.h"
+#include "room.h"
+#include "nameindex.h"
+#include "timerwheel.h"
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/tcp.h>      /* tcp_info with the segment counts */
+#include <time.h>
 
-#include <sys/select.h>
 #include <poll.h>
-#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <sys/utsname.h>
+#endif
+
+#ifdef USE_SSL
+#include "tls.h"
+#endif
+
+#ifdef HAVE_ZLIB
+#include "zstream.h"
+#endif
 
 /* TODO
 
-client logic/commands – recognize special strings (e.g., /msg user text, /list, /nick 
-new_name) and not just send them, but process them accordingly.
+configuration via arguments – port, IP, path to log file, etc.; currently hardcoded.
+
+Extended logging – log level, or connect to syslog (the chat log is already
+segmented by size or date, see seglog.h).
+
+Authentication – simple authorization (passwords); encryption is there with
+USE_SSL, see tls.h.
+
+File transfers – command from the client sendfile <path> and the server sends the 
+content; history replay already streams the log with sendfile(2), so it can be reused.
+*/
+
+
+/* unsent bytes a client may hold before the slow-consumer policy
+   kicks in (--high-water). a client the policy dealt with is let
+   off once its queue is down to --low-water (default half of it). */
+#define HIGH_WATER (256 * 1024)
+
+/* what happens to a client over its high water mark (--slow-policy) */
+enum {
+    SLOW_DISCONNECT,    /* drop the connection */
+    SLOW_DROP,          /* drop its oldest chat lines, leave a marker */
+    SLOW_COLLAPSE       /* drop joins and leaves first, then as SLOW_DROP */
+};
+
+/* most buffers handed to one writev() call */
+#define FLUSH_IOV 64
+
+/* a client's segment count is read every this many flushes (and
+   when it leaves): one getsockopt() each time */
+#define SEGS_SAMPLE 64
+
+/* messages waiting to be written to one client.
+   a ring of references to shared, immutable buffers. */
+typedef struct {
+    MsgBuf **items;
+    size_t head;        /* slot of the oldest message */
+    size_t count;       /* queued messages */
+    size_t cap;         /* ring slots (power of two) */
+    size_t offset;      /* bytes of items[head] already sent */
+    size_t bytes;       /* unsent bytes in the whole queue */
+} OutQueue;
+
+/* a new connection first sends its Client hello, then gets the
+   chat history, then takes part in the chat. every step is
+   non-blocking, so a slow or silent peer never holds up the loop. */
+enum {
+    HS_TLS,         /* TLS handshake (--tls-cert) */
+    HS_HELLO,       /* waiting for the Client struct */
+    HS_HISTORY,     /* history replay goes out before live messages */
+    HS_LIVE
+};
+
+/* the handshake (TLS, hello and history) must be done within this time */
+#define HANDSHAKE_TIMEOUT_MS 10000
+
+/* a live client that said nothing for this long is pinged (--ping),
+   and dropped after this long (--idle), in seconds. only clients
+   that asked for pings (HELLO_PING) can be told apart from dead ones
+   by their silence; the others get TCP keepalive probes after the
+   ping interval instead, and no idle timeout. */
+#define PING_INTERVAL 30
+#define IDLE_TIMEOUT  90
+
+/* keepalive probes before the kernel gives up on a silent peer */
+#define KEEPALIVE_PROBES 3
+
+/* default history window replayed to a new client (--history,
+   --history-bytes); whichever limit is hit first wins. older
+   messages are there for the asking, see /history. */
+#define HISTORY_MESSAGES 50
+#define HISTORY_BYTES    (64 * 1024)
+
+/* messages in one /history page, by default and at most */
+#define HISTORY_PAGE     50
+#define HISTORY_PAGE_MAX 1000
+
+/* and its bytes at most */
+#define HISTORY_PAGE_BYTES (64 * 1024)
+
+/* recent events kept in memory per shard (--cache) */
+#define RECENT_CACHE 4096
+
+/* zlib level for clients that ask for compression (--compress) */
+#define COMPRESS_LEVEL 1
+
+/* lobby events in one history block, compressed once per shard and
+   sent as is to every compressing client whose window covers it, and
+   the newest blocks kept (the cache holds RECENT_CACHE events) */
+#define HISTORY_BLOCK  32
+#define HISTORY_BLOCKS 256
+#define HISTORY_BLOCK_LEVEL 9
+
+/* recent events of every other room kept per shard, the history a
+   client gets when it joins one */
+#define ROOM_CACHE 256
+
+/* most rooms one client is in at once */
+#define MAX_JOINED 16
+
+/* a client's place in a room: its slot in the room's member list
+   on the client's shard, and how far back it has seen the room */
+typedef struct {
+    Room *room;
+    int pos;
+    int64_t older;      /* oldest event of the room it got, counted
+                           from the first one since startup (0) */
+} Membership;
+
+/* structure that represents a connected client.
+   allocated once per connection and never moved, so a pointer to it
+   is a stable handle (also the pointer registered with the poller). */
+typedef struct ConnectedClient {
+    int fd;         
+    uint32_t serial;    /* tells connections on a reused fd apart */
+    Client info;
+    int named;          /* info.name is in the name index */
+    int state;          /* handshake progress, HS_* */
+    size_t hello_got;   /* bytes of info received so far */
+    int reply;          /* HELLO_* flags granted, -1 if it asked for none */
+    off_t hist_size;    /* history bytes to replay, fixed at the hello */
+    off_t hist_pos;     /* replay bytes sent (size field + history) */
+    SegPos hist_from;   /* the window's start in the log */
+    off_t hist_file;    /* bytes of it from the log, sent first */
+    MsgBuf **hist_msgs; /* the rest: cached messages */
+    size_t hist_count;
+    size_t hist_next;   /* first message not completely sent */
+    size_t hist_off;    /* bytes of its payload already sent */
+    Timer timer;        /* its handshake deadline, then idle and ping */
+    uint64_t last_input;/* ms of its last read with data */
+    uint64_t last_ping; /* ms of its last ping */
+    FrameDecoder in;    /* buffered input, split into frames */
+    OutQueue out;       /* frames not yet accepted by the socket */
+    int want_out;       /* waiting for write readiness */
+    int dirty;          /* on the flush list */
+    int dead;           /* send/recv failed, removed at end of pass */
+    int ops;            /* io_uring operations in flight */
+    int sending;        /* queued messages in the current send chain */
+    struct ConnectedClient *next_dirty;
+    int readable;       /* its socket may hold input not read yet */
+    struct ConnectedClient *in_prev, *in_next;  /* waiting for a turn */
+    unsigned flushes;   /* flush_client() calls, for segment sampling */
+    uint32_t segs_seen; /* data segments sent, at the last sample */
+    int slow;           /* went over the high water mark, not drained yet */
+    uint64_t collapsed; /* joins and leaves it missed meanwhile */
+    MsgBuf *marker;     /* the last "messages skipped" notice queued */
+    uint64_t marked;    /* messages it counts */
+    Membership joined[MAX_JOINED];  /* rooms it is in */
+    int joined_count;
+    Room *room;         /* where its chat lines go, NULL if nowhere */
+#ifdef USE_SSL
+    Tls *tls;           /* NULL on a plain connection */
+#endif
+#ifdef HAVE_ZLIB
+    ZOut *z;            /* its compressed stream (HELLO_ZLIB), or NULL */
+#endif
+} ConnectedClient;
+
+/* what one shard did so far. written by the shard only, summed
+   up by metrics_report(). */
+typedef struct {
+    Counter passes;         /* event loop iterations */
+    Counter events;         /* readiness events / completions handled */
+    Counter accepted;
+    Counter rejected;       /* over --max-clients or the fd limit */
+    Counter disconnects;
+    Counter timeouts;       /* handshakes that took too long */
+    Counter idle_timeouts;  /* live clients silent for too long */
+    Counter pings;          /* pings sent to quiet clients */
+    Counter clients;        /* connected now */
+    Counter handshakes;     /* of them still in their handshake */
+    Counter msgs_in;
+    Counter bytes_in;
+    Counter recvs;          /* recv calls (hello and frames) */
+    Counter budget_hits;    /* turns that ended with input left over */
+    Counter broadcasts;
+    Counter deliveries;     /* messages queued for a client */
+    Counter slow_drops;     /* clients dropped for a full queue */
+    Counter slow_clients;   /* times a client went over its high water */
+    Counter slow_skipped;   /* chat lines dropped from slow queues */
+    Counter slow_collapsed; /* joins and leaves slow clients missed */
+    Counter queued_bytes;   /* unsent bytes in all queues now */
+    Counter sends;          /* send/sendmsg/sendfile calls */
+    Counter corks;          /* flushes written under TCP_CORK */
+    Counter segs_out;       /* TCP data segments sent, sampled */
+    Counter bytes_out;
+    Counter history_hits;   /* history windows served from memory */
+    Counter history_misses; /* windows that needed the log file */
+    Counter history_pages;  /* /history pages sent */
+    Counter joins;          /* /join into a room */
+    Counter parts;          /* /part, or leaving with the connection */
+    Counter privates;       /* /msg sent */
+    Counter tls_clients;    /* finished TLS handshakes */
+    Counter tls_failed;     /* TLS handshakes that failed */
+    Counter ktls_clients;   /* of them sending through kernel TLS */
+    Counter zlib_clients;   /* connections that got compression */
+    Counter zlib_in;        /* bytes they were sent, before compression */
+    Counter zlib_out;       /* and after */
+    Counter history_blocks; /* history blocks compressed */
+    Counter history_block_hits; /* history blocks sent from the cache */
+    Histogram loop_ns;      /* one pass of the loop, without the wait */
+    Histogram broadcast_ns; /* one broadcast() */
+    Histogram queue_depth;  /* a client's queued messages, per delivery */
+    Histogram queue_bytes;  /* and their bytes */
+} ShardStats;
+
+/* one event loop thread (--threads).
+   every shard has its own listening socket (SO_REUSEPORT), its own
+   clients and its own poll set; chat events reach all shards through
+   the broadcast ring. */
+typedef struct {
+    int id;
+    pthread_t thread;
+    int wake_fd;            /* eventfd, written when the ring has news */
+    atomic_int sleeping;    /* blocked (or about to block) in its poller */
+    ShardStats stats;
+} Shard;
+
+/* slots in the broadcast ring */
+#define RING_SIZE 8192
+
+/* ring events delivered between two flushes */
+#define DELIVER_BATCH 64
+
+static Shard *shards;
+static int shard_count = 1;
+
+/* every chat event, in one global order, read by every shard */
+static Ring ring;
+
+/* chat history, queued by shard 0 in ring order and written by
+   the logger thread */
+static Logger logger;
+
+/* messages the logger may be behind before shard 0 waits for it */
+#define LOG_QUEUE 65536
+
+/* default size of a log segment (--segment) */
+#define SEGMENT_BYTES (64 * 1024 * 1024)
+
+/* room logs open at once. opening one more closes the one written
+   least recently; it opens again with its room's next event. at
+   least 2: the logger routes one message past the run it appends. */
+#define ROOM_LOGS 64
+
+/* log durability (--sync) */
+static int log_sync = LOG_SYNC_NONE;
+static int log_sync_ms;
+
+/* the chat log: indexed segments in log_dir, appended by the
+   logger, read by history replays */
+static SegLog chatlog;
+static const char *log_dir = "logs";
+static SegLogConfig log_cfg = { .segment_bytes = SEGMENT_BYTES };
+
+/* sequence number in the log of the first ring event; ring event
+   seq is log message log_base + seq */
+static uint64_t log_base;
+
+/* TLS certificate and key (--tls-cert, --tls-key); without them
+   connections are plain */
+static const char *tls_cert, *tls_key;
+
+/* zlib level granted to clients that ask, 0: never (--compress) */
+static int compress_level = COMPRESS_LEVEL;
+
+/* history window for new clients */
+static size_t history_msgs = HISTORY_MESSAGES;
+static size_t history_bytes = HISTORY_BYTES;
+
+/* output queue limits and what happens beyond them */
+static size_t high_water = HIGH_WATER;
+static size_t low_water;
+static int slow_policy = SLOW_DISCONNECT;
+
+/* size of every shard's recent message cache */
+static size_t cache_msgs = RECENT_CACHE;
+
+/* every chat room. the lobby is room 0: every client is in it from
+   its hello on, and its events make up the chat log. */
+static RoomTable rooms;
+static Room *lobby;
+
+/* the open room logs, most recently written first (logger thread) */
+static Room *room_logs_newest, *room_logs_oldest;
+static int room_logs_open;
+
+/* everyone past the hello, by name, on every shard */
+static NameIndex names;
+
+/* numbers the connections */
+static atomic_uint next_serial;
+
+/* how chat lines are stamped (--timestamp) */
+static int timestamp_format = TS_CHAT;
+
+/* event loop each shard runs (--event-loop) */
+static void (*run_loop)(void);
+
+/* POLLER_* backend of run_server_poller */
+static int poller_kind = POLLER_EPOLL;
+
+/* the loop's name, for the stats */
+static const char *loop_name;
+
+/* admin socket path (--admin), NULL if there is none */
+static const char *admin_path;
+
+/* monotonic ns at startup */
+static uint64_t start_time;
+
+/* most clients at once (--max-clients), split across shards */
+static int max_clients = MAX_CLIENTS;
+
+/* select() cannot watch fds at or above FD_SETSIZE */
+static int fd_limit = -1;
+
+/* ms of silence before a live client is pinged (--ping) and before
+   it is dropped (--idle); 0: never */
+static int ping_ms = PING_INTERVAL * 1000;
+static int idle_ms = IDLE_TIMEOUT * 1000;
+
+/* ms the output of a pass may wait for more (--flush-delay) */
+static int flush_delay_ms;
+
+/* the shard running on this thread */
+static _Thread_local Shard *self;
+
+/* and its stats */
+static _Thread_local ShardStats *stats;
+
+/* this shard's clients, O(1) lookup by fd */
+static _Thread_local ConnTable table;
+
+/* clients that got new output since the last flush */
+static _Thread_local ConnectedClient *dirty_head = NULL;
+
+/* this shard's timers: every client's, and the delayed flush */
+static _Thread_local TimerWheel wheel;
+
+/* ms at the start of the current pass. the timers run on it, and
+   input is stamped with it: one clock read per pass. */
+static _Thread_local uint64_t loop_now;
+
+/* writes the pass output --flush-delay ms after it was produced */
+static _Thread_local Timer flush_timer;
+
+/* the ping frame, shared by every client of the shard */
+static _Thread_local MsgBuf *ping_msg;
+
+/* clients with input to handle, in turn order (see serve_input) */
+static _Thread_local ConnectedClient *in_head, *in_tail;
+
+/* most ready events fetched per poller_wait(). a shard asks for one
+   per connection it may have, up to this. */
+#define POLLER_BATCH 4096
+
+/* input one client may have handled per pass; whatever is left
+   waits for its next turn, after everyone else's */
+#define READ_BUDGET (64 * 1024)
+#define MSG_BUDGET  256
+
+/* this shard's readiness poller, so queue changes can switch write
+   interest on and off; NULL under io_uring */
+static _Thread_local Poller *poller;
+
+#ifdef HAVE_ZLIB
+/* a history block, compressed on its own */
+typedef struct {
+    int64_t number;     /* its first lobby event / HISTORY_BLOCK */
+    char *data;         /* NULL: an empty slot */
+    size_t len;
+} HistBlock;
+
+/* this shard's newest history blocks, by number, and the stream they
+   are compressed with. made on the first compressed join. */
+static _Thread_local HistBlock *hist_blocks;
+static _Thread_local ZOut *block_z;
+#endif
+
+/* monotonic clock in nanoseconds, for the stats */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* monotonic clock in milliseconds */
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void client_timer(void *arg);
+static void client_arm(ConnectedClient *c);
+
+/* whether c answers pings, so its silence means it is gone */
+static int heartbeat(const ConnectedClient *c) {
+    return c->reply > 0 && (c->reply & HELLO_PING);
+}
+
+/* a new connection starts its handshake, which has to be done in time */
+static void handshake_start(ConnectedClient *c) {
+
+    counter_add(&stats->handshakes, 1);
+
+    timer_init(&c->timer, client_timer, c);
+    timer_set(&wheel, &c->timer, loop_now + HANDSHAKE_TIMEOUT_MS);
+}
+
+/* c's history went out: it is live, and its timer watches for
+   silence from now on */
+static void handshake_end(ConnectedClient *c) {
+
+    counter_add(&stats->handshakes, -1);
+
+    c->state = HS_LIVE;
+    c->last_input = loop_now;
+    client_arm(c);
+
+    /* a client that cannot answer pings is left to the kernel: it
+       probes the peer once the connection was quiet for the ping
+       interval, and resets it when no probe is answered */
+    if (heartbeat(c))
+        return;
+
+    int secs = ping_ms / 1000, probes = KEEPALIVE_PROBES, one = 1;
+    if (secs > 0 &&
+        setsockopt(c->fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one)) == 0) {
+        setsockopt(c->fd, IPPROTO_TCP, TCP_KEEPIDLE, &secs, sizeof(secs));
+        setsockopt(c->fd, IPPROTO_TCP, TCP_KEEPINTVL, &secs, sizeof(secs));
+        setsockopt(c->fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+    }
+}
+
+/* take c off the input queue (no-op if it is not on it) */
+static void input_unqueue(ConnectedClient *c) {
+
+    if (!c->in_prev && in_head != c)
+        return;
+
+    if (c->in_prev)
+        c->in_prev->in_next = c->in_next;
+    else
+        in_head = c->in_next;
+
+    if (c->in_next)
+        c->in_next->in_prev = c->in_prev;
+    else
+        in_tail = c->in_prev;
+
+    c->in_prev = c->in_next = NULL;
+}
+
+/* c has input to handle: queue it for a turn, at the back */
+static void input_queue(ConnectedClient *c) {
+
+    if (c->in_prev || in_head == c)
+        return;
+
+    c->in_prev = in_tail;
+    c->in_next = NULL;
+    if (in_tail)
+        in_tail->in_next = c;
+    else
+        in_head = c;
+    in_tail = c;
+}
+
+/* c's socket reported input */
+static void input_ready(ConnectedClient *c) {
+    c->readable = 1;
+    input_queue(c);
+}
+
+/* drop the cached messages of c's history window */
+static void history_release(ConnectedClient *c) {
+
+    for (size_t k = 0; k < c->hist_count; k++)
+        msgbuf_unref(c->hist_msgs[k]);
+
+    free(c->hist_msgs);
+    c->hist_msgs = NULL;
+    c->hist_count = 0;
+
+    if (c->hist_from.seg)
+        seglog_release(&c->hist_from);
+}
+
+/* sendmsg() of n buffers to c, encrypted if c speaks TLS */
+static ssize_t client_send(ConnectedClient *c, struct iovec *iov, int n,
+                           int flags) {
+
+#ifdef USE_SSL
+    if (c->tls)
+        return tls_sendmsg(c->tls, iov, n, flags);
+#endif
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+
+    return sendmsg(c->fd, &msg, MSG_NOSIGNAL | flags);
+}
+
+/* sendfile() to c, encrypted if c speaks TLS */
+static ssize_t client_sendfile(ConnectedClient *c, int fd, off_t *off,
+                               size_t len) {
+
+#ifdef USE_SSL
+    if (c->tls)
+        return tls_sendfile(c->tls, fd, off, len);
+#endif
+
+    return sendfile(c->fd, fd, off, len);
+}
+
+/* recv() from c, decrypted if c speaks TLS */
+static ssize_t client_recv(ConnectedClient *c, void *buf, size_t len) {
+
+#ifdef USE_SSL
+    if (c->tls)
+        return tls_recv(c->tls, buf, len);
+#endif
+
+    ssize_t n;
+    do {
+        n = recv(c->fd, buf, len, 0);
+    } while (n < 0 && errno == EINTR);
+
+    return n;
+}
+
+/* input c sent that TLS decrypted already: the socket will not
+   report it readable, so it has to be read now */
+static int client_pending(ConnectedClient *c) {
+
+#ifdef USE_SSL
+    if (c->tls)
+        return tls_pending(c->tls) > 0;
+#endif
+
+    (void)c;
+    return 0;
+}
+
+/* what goes out before c's history: the flags granted, if its hello
+   asked for any, and the window size as a long (what receive_file()
+   expects first). a compressing client gets the size in its stream. */
+static size_t history_head(const ConnectedClient *c, char *out) {
+
+    size_t n = 0;
+    long size = (long)c->hist_size;
+
+    if (c->reply >= 0)
+        out[n++] = (char)c->reply;
+
+#ifdef HAVE_ZLIB
+    if (c->z)
+        return n;
+#endif
+
+    memcpy(out + n, &size, sizeof(size));
+    return n + sizeof(size);
+}
+
+/* n more replay bytes went out; a finished replay makes c live */
+static void history_sent(ConnectedClient *c, size_t n) {
+
+    char head[1 + sizeof(long)];
+
+    c->hist_pos += n;
+
+    if (c->hist_pos < (off_t)history_head(c, head) + c->hist_size)
+        return;
+
+    history_release(c);
+    handshake_end(c);
+}
+
+/* write as much of c's history replay as the socket takes: the
+   head (see history_head), then the window itself. a part from the
+   log goes straight from the page cache with sendfile(2), cached
+   messages with one sendmsg() per batch. returns 0 once the replay
+   is done, 1 if the socket is full, -1 on error. */
+static int history_send(ConnectedClient *c) {
+
+    char head[1 + sizeof(long)];
+    off_t head_len = history_head(c, head);
+
+    while (c->state == HS_HISTORY) {
+
+        ssize_t s;
+
+        if (c->hist_pos < head_len) {
+
+            /* the head; the log bytes follow in the same segment */
+            struct iovec iov = {
+                head + c->hist_pos, head_len - c->hist_pos
+            };
+            s = client_send(c, &iov, 1, c->hist_size > 0 ? MSG_MORE : 0);
+        } else if (c->hist_pos - head_len < c->hist_file) {
+
+            /* the window may span segments; one sendfile per piece */
+            off_t off;
+            size_t avail;
+            size_t left = c->hist_file - (c->hist_pos - head_len);
+
+            int fd = seglog_piece(&chatlog, &c->hist_from, &off, &avail);
+            if (fd < 0 || avail == 0)
+                return -1;
+
+            s = client_sendfile(c, fd, &off, avail < left ? avail : left);
+
+            /* segments never shrink; EOF here means one was truncated */
+            if (s == 0)
+                return -1;
+            if (s > 0)
+                c->hist_from.off += s;
+        } else {
+
+            /* the cached payloads are exactly the logged lines */
+            struct iovec iov[FLUSH_IOV];
+            size_t n = 0;
+
+            for (size_t k = c->hist_next; k < c->hist_count && n < FLUSH_IOV; k++) {
+                MsgBuf *m = c->hist_msgs[k];
+                iov[n].iov_base = msgbuf_payload(m);
+                iov[n].iov_len = msgbuf_payload_len(m);
+                n++;
+            }
+            iov[0].iov_base = (char *)iov[0].iov_base + c->hist_off;
+            iov[0].iov_len -= c->hist_off;
+
+            s = client_send(c, iov, n, 0);
+
+            /* step over every payload that went out completely */
+            if (s > 0) {
+                size_t sent = s + c->hist_off;
+                while (c->hist_next < c->hist_count) {
+                    size_t len = msgbuf_payload_len(c->hist_msgs[c->hist_next]);
+                    if (sent < len)
+                        break;
+                    sent -= len;
+                    c->hist_next++;
+                }
+                c->hist_off = sent;
+            }
+        }
+
+        counter_add(&stats->sends, 1);
+
+        if (s < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+
+            return -1;
+        }
+
+        counter_add(&stats->bytes_out, s);
+        history_sent(c, s);
+    }
+
+    return 0;
+}
+
+#ifdef HAVE_LIBURING
+
+/* submission queue size of each shard's io_uring */
+#define URING_ENTRIES 1024
+
+/* provided receive buffers per shard, shared by all its clients */
+#define URING_BUFS     512
+#define URING_BUF_SIZE 4096
+#define URING_BGID     0
+
+/* completions handled per loop pass */
+#define URING_BATCH 256
+
+/* what a completion is for, kept in the low bits of user_data
+   (clients come from calloc, so their low bits are free) */
+enum {
+    URING_RECV,
+    URING_SEND,
+    URING_ACCEPT,
+    URING_WAKE,
+    URING_WRITABLE
+};
+
+#define URING_OP_MASK 7
+
+/* io_uring instance while the io_uring loop runs, NULL otherwise */
+static _Thread_local struct io_uring *uring;
+
+static void uring_collect(void);
+
+/* free submission slot, submitting what is queued if the ring is full */
+static struct io_uring_sqe *uring_sqe(void) {
+
+    struct io_uring_sqe *sqe;
+    while (!(sqe = io_uring_get_sqe(uring)))
+        io_uring_submit(uring);
+    return sqe;
+}
+
+/* start a multishot receive on client c.
+   the kernel picks a buffer from the shard's buffer ring for every
+   read, so idle clients pin no receive memory. */
+static void uring_recv(ConnectedClient *c) {
+
+    struct io_uring_sqe *sqe = uring_sqe();
+    io_uring_prep_recv_multishot(sqe, c->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    io_uring_sqe_set_data64(sqe, (uintptr_t)c | URING_RECV);
+    c->ops++;
+}
+
+/* queue c's pending output as one chain of linked sends.
+   links keep the messages in order, MSG_WAITALL makes every send
+   complete in full, and all chains of a pass go out in one submit.
+   only one chain per client is in flight; its last completion
+   starts the next one. */
+static int uring_flush(ConnectedClient *c) {
+
+    OutQueue *q = &c->out;
+
+    if (c->sending > 0)
+        return 0;
+
+    /* history replay first. io_uring has no sendfile, so it is
+       written directly and only the wait for room goes through
+       the ring; the wait also holds back queued messages. */
+    if (c->state == HS_HISTORY) {
+
+        int r = history_send(c);
+        if (r < 0) {
+            c->dead = 1;
+            return -1;
+        }
+
+        if (r > 0) {
+            struct io_uring_sqe *sqe = uring_sqe();
+            io_uring_prep_poll_add(sqe, c->fd, POLLOUT);
+            io_uring_sqe_set_data64(sqe, (uintptr_t)c | URING_WRITABLE);
+            c->sending = 1;
+            c->ops++;
+            return 0;
+        }
+    }
+
+    if (q->count == 0)
+        return 0;
+
+    size_t n = q->count < FLUSH_IOV ? q->count : FLUSH_IOV;
+
+    /* a chain split over two submits would lose its links */
+    if (io_uring_sq_space_left(uring) < n)
+        io_uring_submit(uring);
+
+    for (size_t k = 0; k < n; k++) {
+
+        MsgBuf *m = q->items[(q->head + k) & (q->cap - 1)];
+
+        struct io_uring_sqe *sqe = uring_sqe();
+        /* one segment for the chain, not one per message */
+        io_uring_prep_send(sqe, c->fd, m->data, m->len,
+                           MSG_NOSIGNAL | MSG_WAITALL |
+                           (k + 1 < n ? MSG_MORE : 0));
+        io_uring_sqe_set_data64(sqe, (uintptr_t)c | URING_SEND);
+
+        if (k + 1 < n)
+            sqe->flags |= IOSQE_IO_LINK;
+    }
+
+    c->sending = n;
+    c->ops += n;
+    return 0;
+}
+
+#endif
+
+/* register a new client socket with the event loop: poller or
+   io_uring receive */
+static int watch_client(ConnectedClient *c) {
+
+#ifdef HAVE_LIBURING
+    if (uring) {
+        uring_recv(c);
+        return 0;
+    }
+#endif
+
+    return poller_add(poller, c->fd, POLLER_IN, c);
+}
+
+/* ask for (or stop asking for) write readiness on client c */
+static void watch_output(ConnectedClient *c, int on) {
+
+    /* only touch the poller when the interest actually changes */
+    if (c->want_out == on)
+        return;
+
+    c->want_out = on;
+
+    if (!poller)
+        return;
+
+    poller_mod(poller, c->fd, POLLER_IN | (on ? POLLER_OUT : 0), c);
+}
+
+static void tell(ConnectedClient *c, const char *fmt, ...);
+
+/* drop c's oldest queued room events (only joins and leaves if
+   presence_only) until incoming more bytes fit under the low water
+   mark. what is being written stays, and so does everything sent to
+   c alone. the dropped chat lines are counted by a notice put where
+   they were, which takes over an earlier notice still queued. */
+static void drop_queued(ConnectedClient *c, size_t incoming, int presence_only) {
+
+    OutQueue *q = &c->out;
+
+    /* partly written, or (io_uring) in flight */
+    size_t keep = c->sending > 0 ? (size_t)c->sending : q->offset > 0;
+
+    MsgBuf **items = malloc(q->cap * sizeof(*items));
+    if (!items)
+        return;
+
+    size_t n = 0;
+    size_t at = SIZE_MAX;       /* where the notice goes */
+    uint64_t skipped = 0;
+
+    for (size_t k = 0; k < q->count; k++) {
+
+        MsgBuf *m = q->items[(q->head + k) & (q->cap - 1)];
+        int drop = 0;
+
+        if (k < keep) {
+            /* stays */
+        } else if (m == c->marker) {
+            drop = 1;
+            skipped += c->marked;
+        } else if (q->bytes + incoming > low_water &&
+                   (m->kind == MSG_PRESENCE ||
+                    (m->kind == MSG_CHAT && !presence_only))) {
+            drop = 1;
+            if (presence_only) {
+                c->collapsed++;
+                counter_add(&stats->slow_collapsed, 1);
+            } else {
+                skipped++;
+                counter_add(&stats->slow_skipped, 1);
+            }
+        }
+
+        if (!drop) {
+            items[n++] = m;
+            continue;
+        }
+
+        if (at == SIZE_MAX && (!presence_only || m == c->marker))
+            at = n;
+
+        q->bytes -= m->len;
+        counter_add(&stats->queued_bytes, -m->len);
+        msgbuf_unref(m);
+    }
+
+    /* something was dropped before that slot, so there is room */
+    if (at != SIZE_MAX && skipped > 0) {
+
+        char text[96];
+        int len = snprintf(text, sizeof(text),
+                           "* %llu messages skipped, your connection is "
+                           "too slow\n", (unsigned long long)skipped);
+
+        MsgBuf *mk = msgbuf_new(FRAME_TEXT, text, len);
+        if (mk) {
+            memmove(items + at + 1, items + at, (n - at) * sizeof(*items));
+            items[at] = mk;
+            n++;
+            q->bytes += mk->len;
+            counter_add(&stats->queued_bytes, mk->len);
+
+            if (c->marker)
+                msgbuf_unref(c->marker);
+            c->marker = msgbuf_ref(mk);
+            c->marked = skipped;
+        }
+    }
+
+    free(q->items);
+    q->items = items;
+    q->head = 0;
+    q->count = n;
+}
+
+/* incoming more bytes would take c over its high water mark: apply
+   the slow-consumer policy. returns -1 if c has to go. */
+static int shed(ConnectedClient *c, size_t incoming) {
+
+    if (!c->slow) {
+        c->slow = 1;
+        counter_add(&stats->slow_clients, 1);
+    }
+
+    if (slow_policy == SLOW_DISCONNECT)
+        return -1;
+
+    /* down to the low water mark, so this happens once per episode,
+       not for every message */
+    if (slow_policy == SLOW_COLLAPSE)
+        drop_queued(c, incoming, 1);
+    if (c->out.bytes + incoming > low_water)
+        drop_queued(c, incoming, 0);
+
+    return c->out.bytes + incoming > high_water ? -1 : 0;
+}
+
+/* c's queue shrank. a slow client is let off at the low water mark
+   and told what it missed besides the skipped chat lines. */
+static void check_drained(ConnectedClient *c) {
+
+    if (!c->slow || c->out.bytes > low_water)
+        return;
+
+    c->slow = 0;
+
+    if (c->collapsed > 0) {
+        unsigned long long n = c->collapsed;
+        c->collapsed = 0;
+        tell(c, "* %llu joins and leaves not shown\n", n);
+    }
+}
+
+/* append a reference to m to c's outbound queue, applying the
+   slow-consumer policy if it does not fit. returns -1 if the client
+   has to be dropped. */
+static int queue_msg(ConnectedClient *c, MsgBuf *m) {
+
+    OutQueue *q = &c->out;
+
+    /* collapsing: a slow client is spared the joins and leaves */
+    if (c->slow && slow_policy == SLOW_COLLAPSE && m->kind == MSG_PRESENCE) {
+        c->collapsed++;
+        counter_add(&stats->slow_collapsed, 1);
+        return 0;
+    }
+
+    if (q->bytes + m->len > high_water && shed(c, m->len) < 0)
+        return -1;
+
+    /* ring full → double it, unwrapping the items */
+    if (q->count == q->cap) {
+
+        size_t cap = q->cap ? q->cap * 2 : 16;
+        MsgBuf **items = malloc(cap * sizeof(*items));
+        if (!items)
+            return -1;
+
+        for (size_t k = 0; k < q->count; k++)
+            items[k] = q->items[(q->head + k) & (q->cap - 1)];
+
+        free(q->items);
+        q->items = items;
+        q->head = 0;
+        q->cap = cap;
+    }
+
+    q->items[(q->head + q->count) & (q->cap - 1)] = msgbuf_ref(m);
+    q->count++;
+    q->bytes += m->len;
+    counter_add(&stats->queued_bytes, m->len);
+
+    return 0;
+}
+
+/* drop every queued reference */
+static void clear_queue(OutQueue *q) {
+
+    counter_add(&stats->queued_bytes, -q->bytes);
+
+    for (size_t k = 0; k < q->count; k++)
+        msgbuf_unref(q->items[(q->head + k) & (q->cap - 1)]);
+
+    free(q->items);
+    memset(q, 0, sizeof(*q));
+}
+
+#ifdef USE_SSL
+static int tls_step(ConnectedClient *c);
+#endif
+
+#ifdef HAVE_ZLIB
+static int compress_iov(ConnectedClient *c, const struct iovec *iov, int n,
+                        int full);
+
+/* flush_client() of a compressing client: what is compressed goes
+   out first, then the next batch of queued frames is compressed and
+   flushed as one. a frame leaves the queue once it is compressed, so
+   the slow-consumer policy still sees what the socket did not take
+   as queued messages. returns 0 once everything went out, 1 if the
+   socket is full, -1 on error. */
+static int flush_compressed(ConnectedClient *c) {
+
+    OutQueue *q = &c->out;
+
+    while (1) {
+
+        size_t len;
+        const char *data = zout_pending(c->z, &len);
+
+        if (data) {
+
+            /* the next batch is compressed right behind it */
+            struct iovec iov = { (char *)data, len };
+            ssize_t s = client_send(c, &iov, 1, q->count > 0 ? MSG_MORE : 0);
+            counter_add(&stats->sends, 1);
+
+            if (s < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return 1;
+                return -1;
+            }
+
+            counter_add(&stats->bytes_out, s);
+            zout_consume(c->z, s);
+            continue;
+        }
+
+        if (q->count == 0)
+            return 0;
+
+        struct iovec iov[FLUSH_IOV];
+        size_t n = q->count < FLUSH_IOV ? q->count : FLUSH_IOV;
+
+        for (size_t k = 0; k < n; k++) {
+            MsgBuf *m = q->items[(q->head + k) & (q->cap - 1)];
+            iov[k].iov_base = m->data;
+            iov[k].iov_len = m->len;
+        }
+
+        if (compress_iov(c, iov, n, 0) < 0)
+            return -1;
+
+        for (size_t k = 0; k < n; k++) {
+
+            MsgBuf *m = q->items[q->head];
+
+            q->bytes -= m->len;
+            counter_add(&stats->queued_bytes, -m->len);
+
+            msgbuf_unref(m);
+            q->head = (q->head + 1) & (q->cap - 1);
+            q->count--;
+        }
+
+        check_drained(c);
+    }
+}
+#endif
+
+/* write as much queued output as the socket takes without blocking.
+   all pending buffers go out in one sendmsg() (a writev that does not
+   raise SIGPIPE). returns -1 (and marks the client dead) on error. */
+static int flush_output(ConnectedClient *c) {
+
+#ifdef USE_SSL
+    /* the TLS handshake waited for socket space */
+    if (c->state == HS_TLS) {
+        if (tls_step(c) < 0)
+            c->dead = 1;
+        return c->dead ? -1 : 0;
+    }
+#endif
+
+    /* the history replay goes out before any queued message */
+    if (c->state == HS_HISTORY) {
+
+        int r = history_send(c);
+        if (r < 0) {
+            c->dead = 1;
+            return -1;
+        }
+
+        /* socket buffer full → wait for write readiness */
+        if (r > 0) {
+            watch_output(c, 1);
+            return 0;
+        }
+    }
+
+#ifdef HAVE_ZLIB
+    /* a compressing client's queue empties onto its stream */
+    if (c->z) {
+
+        int r = flush_compressed(c);
+        if (r < 0) {
+            c->dead = 1;
+            return -1;
+        }
+
+        if (r > 0) {
+            watch_output(c, 1);
+            return 0;
+        }
+    }
+#endif
+
+    OutQueue *q = &c->out;
+
+    while (q->count > 0) {
+
+        /* gather pending buffers, the first one minus what was sent */
+        struct iovec iov[FLUSH_IOV];
+        size_t n = q->count < FLUSH_IOV ? q->count : FLUSH_IOV;
+
+        for (size_t k = 0; k < n; k++) {
+            MsgBuf *m = q->items[(q->head + k) & (q->cap - 1)];
+            iov[k].iov_base = m->data;
+            iov[k].iov_len = m->len;
+        }
+        iov[0].iov_base = (char *)iov[0].iov_base + q->offset;
+        iov[0].iov_len -= q->offset;
+
+        /* more batches follow: no partial segment in between */
+        ssize_t s = client_send(c, iov, n, q->count > n ? MSG_MORE : 0);
+        counter_add(&stats->sends, 1);
+
+        if (s < 0) {
+            if (errno == EINTR)
+                continue;
+
+            /* socket buffer full → wait for write readiness */
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                watch_output(c, 1);
+                return 0;
+            }
+
+            c->dead = 1;
+            return -1;
+        }
+
+        q->bytes -= s;
+        counter_add(&stats->queued_bytes, -s);
+        counter_add(&stats->bytes_out, s);
+
+        /* release every buffer that went out completely */
+        size_t sent = s + q->offset;
+        while (q->count > 0) {
+
+            MsgBuf *m = q->items[q->head];
+            if (sent < m->len)
+                break;
+
+            sent -= m->len;
+            msgbuf_unref(m);
+            q->head = (q->head + 1) & (q->cap - 1);
+            q->count--;
+        }
+        q->offset = sent;
+
+        check_drained(c);
+    }
+
+#ifdef USE_SSL
+    /* the last record may still wait for socket space */
+    if (c->tls) {
+        int r = tls_flush(c->tls);
+        if (r < 0) {
+            c->dead = 1;
+            return -1;
+        }
+        if (r > 0) {
+            watch_output(c, 1);
+            return 0;
+        }
+    }
+#endif
+
+    /* drained → no need to wake up for writability anymore */
+    watch_output(c, 0);
+    return 0;
+}
+
+/* hold back (or push out) partial segments on c's socket */
+static void set_cork(ConnectedClient *c, int on) {
+    setsockopt(c->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+/* add the data segments the kernel sent to c since the last look */
+static void count_segments(ConnectedClient *c) {
+
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+
+    /* kernels before 4.6 do not count them */
+    if (getsockopt(c->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0 ||
+        len < offsetof(struct tcp_info, tcpi_data_segs_out) +
+              sizeof(ti.tcpi_data_segs_out))
+        return;
+
+    counter_add(&stats->segs_out, ti.tcpi_data_segs_out - c->segs_seen);
+    c->segs_seen = ti.tcpi_data_segs_out;
+}
+
+/* write c's pending output, through io_uring or flush_output().
+   a history replay is many sends (the head, pieces of the log, the
+   cached lines, the join line queued behind them), so it is written
+   corked: it leaves as full segments, and uncorking pushes out the
+   last partial one at once. queued frames need no cork; their sends
+   carry MSG_MORE while more follow. */
+static int flush_client(ConnectedClient *c) {
+
+    if (++c->flushes % SEGS_SAMPLE == 0)
+        count_segments(c);
+
+#ifdef HAVE_LIBURING
+    if (uring)
+        return uring_flush(c);
+#endif
+
+    if (c->state != HS_HISTORY)
+        return flush_output(c);
+
+    set_cork(c, 1);
+    int r = flush_output(c);
+    set_cork(c, 0);
+
+    counter_add(&stats->corks, 1);
+    return r;
+}
+
+/* flush every client that got output since the last call.
+   all messages queued in between leave in one syscall per client. */
+static void flush_dirty(void) {
+
+    while (dirty_head) {
+
+        ConnectedClient *c = dirty_head;
+        dirty_head = c->next_dirty;
+        c->next_dirty = NULL;
+        c->dirty = 0;
+
+        /* still waiting for writability → the loop flushes it then */
+        if (!c->dead && !c->want_out)
+            flush_client(c);
+    }
+
+#ifdef HAVE_LIBURING
+    /* hand the queued sends to the kernel now. sends that fit the
+       socket buffers complete at once and free their queue slots,
+       so queues drain as fast as events arrive. */
+    if (uring) {
+        io_uring_submit(uring);
+        uring_collect();
+    }
+#endif
+}
+
+/* put c on the flush list */
+static void mark_dirty(ConnectedClient *c) {
+
+    if (!c->dirty) {
+        c->dirty = 1;
+        c->next_dirty = dirty_head;
+        dirty_head = c;
+    }
+}
+
+/* queue m for c alone */
+static void unicast(ConnectedClient *c, MsgBuf *m) {
+
+    if (queue_msg(c, m) < 0)
+        c->dead = 1;
+    else
+        mark_dirty(c);
+}
+
+/* queue a message for the members of its room on this shard.
+   nothing is sent here: the buffer is shared by reference and
+   written by flush_dirty(). a client that cannot keep up is
+   dropped once its queue is full; everyone else is unaffected. */
+void broadcast(MsgBuf *m, RoomShard *rs) {
+
+    uint64_t t = now_ns();
+    uint64_t delivered = 0;
+
+    /* only clients past their hello are members */
+    for (int i = 0; i < rs->count; i++) {
+
+        ConnectedClient *c = rs->members[i];
+
+        if (c->dead)
+            continue;
+
+        if (queue_msg(c, m) < 0) {
+            c->dead = 1;
+            counter_add(&stats->slow_drops, 1);
+            continue;
+        }
+
+        histogram_add(&stats->queue_depth, c->out.count);
+        histogram_add(&stats->queue_bytes, c->out.bytes);
+        delivered++;
+
+        mark_dirty(c);
+    }
+
+    counter_add(&stats->broadcasts, 1);
+    counter_add(&stats->deliveries, delivered);
+    histogram_add(&stats->broadcast_ns, now_ns() - t);
+}
+
+/* move r to the front of the open room logs */
+static void room_log_touch(Room *r) {
+
+    if (r == room_logs_newest)
+        return;
+
+    /* take it out, if it is in */
+    if (r->log_older)
+        r->log_older->log_newer = r->log_newer;
+    if (r->log_newer)
+        r->log_newer->log_older = r->log_older;
+    if (r == room_logs_oldest)
+        room_logs_oldest = r->log_newer;
+
+    r->log_newer = NULL;
+    r->log_older = room_logs_newest;
+    if (room_logs_newest)
+        room_logs_newest->log_newer = r;
+    room_logs_newest = r;
+    if (!room_logs_oldest)
+        room_logs_oldest = r;
+}
+
+/* close the log written least recently. a /history reading it is
+   waited for; the logger syncs it first if it waits for a sync. */
+static void room_log_close_oldest(void) {
+
+    Room *r = room_logs_oldest;
+
+    room_logs_oldest = r->log_newer;
+    if (room_logs_oldest)
+        room_logs_oldest->log_older = NULL;
+    else
+        room_logs_newest = NULL;
+    r->log_newer = r->log_older = NULL;
+    room_logs_open--;
+
+    logger_forget(&logger, &r->log);
+
+    pthread_mutex_lock(&r->log_lock);
+    seglog_close(&r->log);
+    atomic_store(&r->log_state, 2);
+    pthread_mutex_unlock(&r->log_lock);
+}
+
+/* the log of m's room, for the logger thread: the chat log for the
+   lobby, <log_dir>/rooms/<name> for every other room, opened with
+   its first event (or its first since it was closed). a room whose
+   log cannot be opened is not logged. */
+static SegLog *room_log(const MsgBuf *m, void *arg) {
+
+    (void)arg;
+
+    if (m->room == 0)
+        return &chatlog;
+
+    Room *r = room_at(&rooms, m->room);
+
+    /* only this thread opens and closes, so no lock to look */
+    int state = atomic_load(&r->log_state);
+
+    if (state == 0 || state == 2) {
+
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s/rooms", log_dir);
+        mkdir(dir, 0755);
+
+        if (room_logs_open == ROOM_LOGS)
+            room_log_close_oldest();
+
+        /* a /history may have it open for a moment (see room_log_lock) */
+        pthread_mutex_lock(&r->log_lock);
+
+        snprintf(dir, sizeof(dir), "%s/rooms/%s", log_dir, r->name + 1);
+        int err = seglog_open(&r->log, dir, NULL, &log_cfg);
+        if (err < 0)
+            perror(dir);
+        else if (state == 0)
+            r->log_base = seglog_end(&r->log);
+
+        /* /history on the shards reads the log from here on */
+        state = err < 0 ? -1 : 1;
+        atomic_store(&r->log_state, state);
+        pthread_mutex_unlock(&r->log_lock);
+
+        if (state > 0)
+            room_logs_open++;
+    }
+
+    if (state < 0)
+        return NULL;
+
+    room_log_touch(r);
+    return &r->log;
+}
+
+/* the log of room r for /history, locked so that the logger cannot
+   close it meanwhile; a log it closed is opened for the time being.
+   NULL (and nothing locked) if r has no log since startup. */
+static SegLog *room_log_lock(Room *r) {
+
+    pthread_mutex_lock(&r->log_lock);
+
+    int state = atomic_load(&r->log_state);
+
+    if (state == 2) {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s/rooms/%s", log_dir, r->name + 1);
+        if (seglog_open(&r->log, dir, NULL, &log_cfg) == 0)
+            return &r->log;
+        perror(dir);
+    } else if (state == 1) {
+        return &r->log;
+    }
+
+    pthread_mutex_unlock(&r->log_lock);
+    return NULL;
+}
+
+static void room_log_unlock(Room *r) {
+
+    /* the logger left it closed: so is our copy */
+    if (atomic_load(&r->log_state) == 2)
+        seglog_close(&r->log);
+
+    pthread_mutex_unlock(&r->log_lock);
+}
+
+/* a connection as the name index knows it: the fd picks the entry
+   in its shard's table, the serial makes sure it is still the same
+   connection */
+static uint64_t conn_handle(const ConnectedClient *c) {
+    return (uint64_t)(uint32_t)c->fd << 32 | c->serial;
+}
+
+/* hand private message m to its recipient, if it is a client of
+   this shard (and still connected) */
+static void deliver_direct(MsgBuf *m) {
+
+    ConnectedClient *c = conntable_get(&table, (int)(m->to >> 32));
+
+    if (c && !c->dead && conn_handle(c) == m->to)
+        unicast(c, m);
+}
+
+/* print and log one chat event (shard 0 only, so it happens once) */
+static void log_event(MsgBuf *m) {
+
+    /* written (and echoed to stdout) by the logger thread, which
+       also indexes it for history replays once it is in the file */
+    logger_submit(&logger, m);
+}
+
+/* hand every event published so far to this shard's clients.
+   all shards walk the same ring, so everyone sees one global order. */
+static void deliver_ring(void) {
+
+    MsgBuf *m;
+    int batch = 0;
+
+    while ((m = ring_peek(&ring, self->id, NULL))) {
+
+        if (m->room == ROOM_DIRECT) {
+
+            /* a private message from another shard: only the
+               recipient's shard does anything, nothing is logged */
+            deliver_direct(m);
+
+        } else {
+
+            /* the room was created before its first event was published */
+            Room *r = room_at(&rooms, m->room);
+            RoomShard *rs = &r->shards[self->id];
+
+            if (self->id == 0)
+                log_event(m);
+
+            /* remembered for the history of clients joining later */
+            rs->delivered++;
+            msgcache_push(room_cache(r, self->id), m);
+
+            broadcast(m, rs);
+        }
+
+        /* the ring held one reference per shard */
+        ring_advance(&ring, self->id);
+        msgbuf_unref(m);
+
+        /* a long backlog is written out as it is delivered, so it
+           lands in socket buffers instead of piling up in queues */
+        if (++batch == DELIVER_BATCH) {
+            flush_dirty();
+            batch = 0;
+        }
+    }
+}
+
+/* wake every other shard that is blocked in its poller */
+static void wake_shards(void) {
+
+    /* pairs with the fence in may_sleep(): either the sleeper sees the
+       new event before blocking, or we see it sleeping and wake it */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    for (int k = 0; k < shard_count; k++) {
+
+        Shard *sh = &shards[k];
+        if (sh == self || !atomic_load(&sh->sleeping))
+            continue;
+
+        if (atomic_exchange(&sh->sleeping, 0)) {
+            uint64_t one = 1;
+            if (write(sh->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                perror("write: wake_fd");
+        }
+    }
+}
+
+/* put one chat event into the global order for all shards.
+   takes over the caller's reference to m. */
+static void publish(MsgBuf *m) {
+
+    uint64_t seq = ring_claim(&ring);
+
+    /* the slot is still in use by a slow shard. keep delivering our
+       own backlog meanwhile, so we never end up waiting on ourselves. */
+    while (!ring_has_room(&ring, seq)) {
+        deliver_ring();
+        sched_yield();
+    }
+
+    ring_publish(&ring, seq, msgbuf_ref_many(m, shard_count));
+    msgbuf_unref(m);
+
+    wake_shards();
+}
+
+/* deliver pending ring events and write out all queued output, or
+   with --flush-delay have the flush timer write it a little later,
+   together with what the next passes add */
+static void sync_output(void) {
+
+    deliver_ring();
+
+    if (flush_delay_ms > 0) {
+        if (dirty_head && !timer_pending(&flush_timer))
+            timer_set(&wheel, &flush_timer, loop_now + flush_delay_ms);
+        return;
+    }
+
+    flush_dirty();
+}
+
+/* the flush timer expired */
+static void flush_timer_fire(void *arg) {
+    (void)arg;
+    flush_dirty();
+}
+
+/* when c was last heard from, or pinged */
+static uint64_t quiet_since(const ConnectedClient *c) {
+    return c->last_ping > c->last_input ? c->last_ping : c->last_input;
+}
+
+/* set the timer of live client c to its next ping or its idle
+   timeout, whichever comes first; or unset it if neither applies */
+static void client_arm(ConnectedClient *c) {
+
+    uint64_t due = 0;
+
+    if (heartbeat(c) && idle_ms > 0)
+        due = c->last_input + idle_ms;
+
+    if (heartbeat(c) && ping_ms > 0) {
+        uint64_t ping = quiet_since(c) + ping_ms;
+        if (!due || ping < due)
+            due = ping;
+    }
+
+    if (due)
+        timer_set(&wheel, &c->timer, due);
+    else
+        timer_cancel(&wheel, &c->timer);
+}
+
+/* c's timer expired. during the handshake that is its deadline.
+   once live it is time to ping or to give up on c, unless input came
+   in meanwhile: a read only stamps last_input, and the timer is moved
+   when it fires, so a busy client costs no timer updates at all. */
+static void client_timer(void *arg) {
+
+    ConnectedClient *c = arg;
+
+    if (c->dead)
+        return;
+
+    if (c->state != HS_LIVE) {
+        c->dead = 1;
+        counter_add(&stats->timeouts, 1);
+        return;
+    }
+
+    if (idle_ms > 0 && loop_now >= c->last_input + idle_ms) {
+        c->dead = 1;
+        counter_add(&stats->idle_timeouts, 1);
+        return;
+    }
+
+    if (ping_ms > 0 && loop_now >= quiet_since(c) + ping_ms) {
+        unicast(c, ping_msg);
+        c->last_ping = loop_now;
+        counter_add(&stats->pings, 1);
+    }
+
+    client_arm(c);
+}
+
+/* fire every timer due by the start of this pass: handshake
+   deadlines, pings, idle timeouts and the delayed flush */
+static void run_timers(void) {
+    timerwheel_advance(&wheel, loop_now);
+}
+
+/* this shard's timers, before its loop starts */
+static void timers_start(void) {
+
+    loop_now = now_ms();
+    timerwheel_init(&wheel, loop_now);
+    timer_init(&flush_timer, flush_timer_fire, NULL);
+
+    ping_msg = msgbuf_new(FRAME_PING, "", 0);
+    if (!ping_msg) { perror("msgbuf_new"); exit(1); }
+}
+
+/* called right before the poller blocks.
+   returns 0 if ring events are already waiting, so the poller
+   must only check for readiness and return at once. */
+static int may_sleep(void) {
+
+    atomic_store(&self->sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (ring_peek(&ring, self->id, NULL)) {
+        atomic_store(&self->sleeping, 0);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* how long the poller may block in ms: not at all if ring events
+   are waiting, else until the next timer is due, or forever (-1) */
+static int wait_ms(void) {
+
+    /* clients whose budget ran out go on right away */
+    if (in_head || !may_sleep())
+        return 0;
+
+    /* at most 2^24 ms ahead, see timerwheel.h */
+    return (int)timerwheel_timeout(&wheel, now_ms());
+}
+
+/* called after the poller returned */
+static void woke_up(int wake_ready) {
+
+    atomic_store(&self->sleeping, 0);
+
+    /* reset the eventfd counter */
+    if (wake_ready) {
+        uint64_t v;
+        if (read(self->wake_fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+            perror("read: wake_fd");
+    }
+}
+
+/* format a chat event of room r once into a new shared buffer and
+   publish it: a timestamp, the room's name (lobby lines have none,
+   as before there were rooms), then the text. the buffer is sized
+   to the text, since it may sit in many queues. */
+static void room_event(Room *r, int kind, const char *fmt, ...) {
+
+    char text[MAX_MESSAGE + 128];
+    char timestamp[TIMESTAMP_MAX];
+    format_timestamp(timestamp_format, timestamp, sizeof(timestamp));
+
+    int n;
+    if (r == lobby)
+        n = snprintf(text, sizeof(text), "%s:", timestamp);
+    else
+        n = snprintf(text, sizeof(text), "%s:%s:", timestamp, r->name);
+
+    va_list ap;
+    va_start(ap, fmt);
+    int k = vsnprintf(text + n, sizeof(text) - n, fmt, ap);
+    va_end(ap);
+
+    n += k < 0 ? 0 : k;
+    if (n >= (int)sizeof(text))
+        n = sizeof(text) - 1;
+
+    MsgBuf *m = msgbuf_new(FRAME_TEXT, text, n);
+    if (!m)
+        return;
+
+    /* print, log and queue for the room's members */
+    m->kind = kind;
+    m->room = r->id;
+    publish(m);
+}
+
+/* a notice to c only, e.g. the answer to a command */
+static void tell(ConnectedClient *c, const char *fmt, ...) {
+
+    char text[256];
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return;
+    if (n >= (int)sizeof(text))
+        n = sizeof(text) - 1;
+
+    MsgBuf *m = msgbuf_new(FRAME_TEXT, text, n);
+    if (m) {
+        unicast(c, m);
+        msgbuf_unref(m);
+    }
+}
+
+/* c's membership of room r, NULL if it is not in r */
+static Membership *membership(ConnectedClient *c, Room *r) {
+
+    for (int k = 0; k < c->joined_count; k++)
+        if (c->joined[k].room == r)
+            return &c->joined[k];
+
+    return NULL;
+}
+
+/* add c to the members of r on this shard. returns -1 if c is in
+   too many rooms already (or out of memory). */
+static int room_join(ConnectedClient *c, Room *r) {
+
+    if (c->joined_count == MAX_JOINED)
+        return -1;
+
+    int pos = room_add(&r->shards[self->id], c);
+    if (pos < 0)
+        return -1;
+
+    c->joined[c->joined_count++] = (Membership){ r, pos, 0 };
+    counter_add(&stats->joins, 1);
+    return 0;
+}
+
+/* take c out of the room of membership ms. its chat lines go to
+   the lobby then, or another room it is in. */
+static void room_leave(ConnectedClient *c, Membership *ms) {
+
+    Room *r = ms->room;
+
+    /* the last member moved into the hole; it has to know */
+    ConnectedClient *moved = room_remove(&r->shards[self->id], ms->pos);
+    if (moved)
+        membership(moved, r)->pos = ms->pos;
+
+    *ms = c->joined[--c->joined_count];
+    counter_add(&stats->parts, 1);
+
+    if (c->room == r) {
+        if (membership(c, lobby))
+            c->room = lobby;
+        else
+            c->room = c->joined_count > 0 ? c->joined[0].room : NULL;
+    }
+}
+
+/* a name /msg can address: one word of printable characters, not
+   starting like a room, a notice or a command */
+static int name_ok(const char *name) {
+
+    size_t len = strlen(name);
+    if (len == 0 || len >= MAX_NAME || strchr("#*@/", name[0]))
+        return 0;
+
+    for (size_t k = 0; k < len; k++) {
+        unsigned char ch = name[k];
+        if (ch <= ' ' || ch == 0x7F)
+            return 0;
+    }
+
+    return 1;
+}
+
+/* put c's hello name into the name index. a name that cannot be
+   addressed is patched up first, a taken one gets a number. */
+static void claim_name(ConnectedClient *c) {
+
+    char *name = c->info.name;
+    char asked[MAX_NAME];
+    memcpy(asked, name, MAX_NAME);
+
+    for (size_t k = 0; name[k]; k++)
+        if ((unsigned char)name[k] <= ' ' || name[k] == 0x7F)
+            name[k] = '_';
+    if (strchr("#*@/", name[0]))
+        name[0] = '_';
+    if (!name[0])
+        strcpy(name, "guest");
+
+    char base[MAX_NAME];
+    memcpy(base, name, MAX_NAME);
+
+    for (int n = 2; nameindex_claim(&names, name, self->id, conn_handle(c)) < 0; n++) {
+
+        /* out of memory: chatting works, /msg does not reach c */
+        if (errno != EEXIST)
+            return;
+
+        snprintf(name, MAX_NAME, "%.*s~%d", MAX_NAME - 12, base, n);
+    }
+
+    c->named = 1;
+
+    if (strcmp(name, asked) != 0)
+        tell(c, "* you are %s\n", name);
+}
+
+static void free_client(ConnectedClient *c);
+
+/* store a freshly accepted socket as a client in handshake state.
+   returns the new client or NULL. */
+static ConnectedClient *add_client(int cfd) {
+
+    ConnectedClient *c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+
+    /* store new client */
+    c->fd = cfd;
+    c->serial = atomic_fetch_add(&next_serial, 1);
+    c->state = HS_HELLO;
+    frame_decoder_init(&c->in, MAX_MESSAGE);
+
+#ifdef USE_SSL
+    /* encrypted from the first byte: the hello comes after TLS */
+    if (tls_cert) {
+        c->tls = tls_new(cfd, 1, NULL);
+        c->state = HS_TLS;
+        if (!c->tls) {
+            frame_decoder_free(&c->in);
+            free(c);
+            return NULL;
+        }
+    }
+#endif
+
+    if (conntable_add(&table, cfd, c) < 0) {
+        free_client(c);
+        return NULL;
+    }
+
+    counter_add(&stats->clients, 1);
+
+    /* the whole handshake has to finish in time */
+    handshake_start(c);
+
+    /* from here on the event loop must never block on this client */
+    if (set_nonblocking(cfd) < 0 || watch_client(c) < 0)
+        c->dead = 1;
+
+    /* output is collected for a whole pass and written at its end;
+       Nagle would only hold back the last partial segment of it */
+    int one = 1;
+    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return c;
+}
+
+/* the newest n cached messages (of bytes payload bytes) become the
+   in-memory part of c's history */
+static int history_take(ConnectedClient *c, size_t n, size_t bytes) {
+
+    MsgCache *mc = room_cache(lobby, self->id);
+
+    if (n > 0) {
+        c->hist_msgs = malloc(n * sizeof(*c->hist_msgs));
+        if (!c->hist_msgs)
+            return -1;
+    }
+
+    /* oldest first */
+    for (size_t k = 0; k < n; k++)
+        c->hist_msgs[k] = msgbuf_ref(msgcache_at(mc, mc->count - n + k));
+
+    c->hist_count = n;
+    c->hist_size += bytes;
+    return 0;
+}
+
+/* fix the history c gets: from memory when the cache holds the
+   window, else from the log file. the logger may not have written
+   the newest events yet; those come from the cache after the part
+   from the file. returns where the window starts, as a lobby event
+   number (see Membership). */
+static int64_t history_window(ConnectedClient *c) {
+
+    MsgCache *mc = room_cache(lobby, self->id);
+    uint64_t delivered = lobby->shards[self->id].delivered;
+
+    size_t bytes;
+    long n = msgcache_window(mc, history_msgs, history_bytes, &bytes);
+    if (n >= 0 && history_take(c, n, bytes) == 0) {
+        counter_add(&stats->history_hits, 1);
+        return (int64_t)delivered - n;
+    }
+
+    counter_add(&stats->history_misses, 1);
+
+    /* every lobby event this shard delivered went into its cache, so
+       the ones the log is missing are the newest cached ones */
+    uint64_t upto = log_base + delivered;
+    uint64_t written = seglog_end(&chatlog);
+
+    size_t gap = 0;
+    bytes = 0;
+
+    while (upto > written + gap && gap < mc->count && gap < history_msgs) {
+        size_t len = msgbuf_payload_len(msgcache_at(mc, mc->count - 1 - gap));
+        if (bytes + len > history_bytes)
+            break;
+        bytes += len;
+        gap++;
+    }
+
+    if (history_take(c, gap, bytes) < 0)
+        gap = bytes = 0;
+
+    /* the logger is further behind than the cache reaches: rather a
+       shorter history than one with a hole in it */
+    if (upto > written + gap && c->hist_count > 0)
+        return (int64_t)delivered - gap;
+
+    uint64_t first = seglog_window(&chatlog, upto < written ? upto : written,
+                                   history_msgs - gap, history_bytes - bytes,
+                                   &c->hist_from, &c->hist_file);
+    c->hist_size += c->hist_file;
+
+    return (int64_t)first - (int64_t)log_base;
+}
+
+#ifdef HAVE_ZLIB
+/* compress n buffers onto c's stream, and count them */
+static int compress_iov(ConnectedClient *c, const struct iovec *iov, int n,
+                        int full) {
+
+    ssize_t out = zout_write(c->z, iov, n, full);
+    if (out < 0)
+        return -1;
+
+    for (int k = 0; k < n; k++)
+        counter_add(&stats->zlib_in, iov[k].iov_len);
+    counter_add(&stats->zlib_out, out);
+
+    return 0;
+}
+
+/* the history block holding lobby event e; events from before
+   startup are negative */
+static int64_t block_of(int64_t e) {
+    return e >= 0 ? e / HISTORY_BLOCK
+                  : -((-e + HISTORY_BLOCK - 1) / HISTORY_BLOCK);
+}
+
+/* history block b, whose events are msgs[0 .. HISTORY_BLOCK): from
+   the shard's block cache, or compressed now and kept there. it is
+   compressed once for every joiner, so it gets the best level. */
+static HistBlock *history_block(int64_t b, MsgBuf **msgs) {
+
+    if (!hist_blocks) {
+        hist_blocks = calloc(HISTORY_BLOCKS, sizeof(*hist_blocks));
+        block_z = zout_new(HISTORY_BLOCK_LEVEL);
+        if (!hist_blocks || !block_z) {
+            free(hist_blocks);
+            zout_free(block_z);
+            hist_blocks = NULL;
+            block_z = NULL;
+            return NULL;
+        }
+    }
+
+    HistBlock *hb = &hist_blocks[(uint64_t)b % HISTORY_BLOCKS];
+
+    if (hb->data && hb->number == b) {
+        counter_add(&stats->history_block_hits, 1);
+        return hb;
+    }
+
+    struct iovec iov[HISTORY_BLOCK];
+    for (int k = 0; k < HISTORY_BLOCK; k++) {
+        iov[k].iov_base = msgbuf_payload(msgs[k]);
+        iov[k].iov_len = msgbuf_payload_len(msgs[k]);
+    }
+
+    /* a fresh stream, so the block refers to nothing before it */
+    zout_reset(block_z);
+    if (zout_write(block_z, iov, HISTORY_BLOCK, 0) < 0)
+        return NULL;
+
+    size_t len;
+    const char *data = zout_pending(block_z, &len);
+
+    char *copy = malloc(len);
+    if (!copy)
+        return NULL;
+
+    memcpy(copy, data, len);
+    zout_consume(block_z, len);
+
+    free(hb->data);
+    hb->number = b;
+    hb->data = copy;
+    hb->len = len;
+
+    counter_add(&stats->history_blocks, 1);
+    return hb;
+}
+
+/* put c's history on its compressed stream instead of replaying it:
+   the window size, the part from the log, then the cached messages.
+   where the window covers a whole history block, the block goes in
+   as compressed once for everyone; only the events around the
+   blocks are compressed for c alone. returns -1 on failure. */
+static int history_compress(ConnectedClient *c) {
+
+    long size = (long)c->hist_size;
+    struct iovec iov[HISTORY_BLOCK];
+
+    iov[0].iov_base = &size;
+    iov[0].iov_len = sizeof(size);
+    if (compress_iov(c, iov, 1, 0) < 0)
+        return -1;
+
+    /* the part from the log, a buffer at a time */
+    if (c->hist_file > 0) {
+
+        size_t cap = c->hist_file < HISTORY_BYTES ? c->hist_file : HISTORY_BYTES;
+        char *buf = malloc(cap);
+        if (!buf)
+            return -1;
+
+        for (off_t left = c->hist_file; left > 0; ) {
+
+            size_t n = left < (off_t)cap ? (size_t)left : cap;
+
+            iov[0].iov_base = buf;
+            iov[0].iov_len = n;
+
+            if (seglog_read(&chatlog, &c->hist_from, buf, n) < 0 ||
+                compress_iov(c, iov, 1, 0) < 0) {
+                free(buf);
+                return -1;
+            }
+
+            left -= n;
+        }
+
+        free(buf);
+    }
+
+    /* the cached messages are the newest lobby events */
+    int64_t first = (int64_t)lobby->shards[self->id].delivered -
+                    (int64_t)c->hist_count;
+    int at_block = 0;
+    size_t k = 0;
+
+    while (k < c->hist_count) {
+
+        int64_t e = first + (int64_t)k;
+        int64_t b = block_of(e);
+
+        /* a whole block starts here */
+        if (e == b * HISTORY_BLOCK && c->hist_count - k >= HISTORY_BLOCK) {
+
+            /* the stream may not refer back across it */
+            if (!at_block && compress_iov(c, NULL, 0, 1) < 0)
+                return -1;
+
+            HistBlock *hb = history_block(b, c->hist_msgs + k);
+            if (!hb || zout_append(c->z, hb->data, hb->len) < 0)
+                return -1;
+
+            for (int j = 0; j < HISTORY_BLOCK; j++)
+                counter_add(&stats->zlib_in,
+                            msgbuf_payload_len(c->hist_msgs[k + j]));
+            counter_add(&stats->zlib_out, hb->len);
+
+            at_block = 1;
+            k += HISTORY_BLOCK;
+            continue;
+        }
+
+        /* up to where the next block starts, for c alone */
+        size_t n = (b + 1) * HISTORY_BLOCK - e;
+        if (n > c->hist_count - k)
+            n = c->hist_count - k;
+
+        for (size_t j = 0; j < n; j++) {
+            iov[j].iov_base = msgbuf_payload(c->hist_msgs[k + j]);
+            iov[j].iov_len = msgbuf_payload_len(c->hist_msgs[k + j]);
+        }
+
+        if (compress_iov(c, iov, n, 0) < 0)
+            return -1;
+
+        at_block = 0;
+        k += n;
+    }
+
+    /* all of it is on the stream now */
+    history_release(c);
+    c->hist_size = c->hist_file = 0;
+    return 0;
+}
+#endif
+
+/* the flags c asked for in its hello that it gets: pings, unless
+   --ping 0, and compression, if it is on and the event loop sends
+   through a stream (io_uring sends the queued buffers as they are).
+   a compressing client's history is put on its stream right away.
+   returns -1 on failure. */
+static int hello_reply(ConnectedClient *c) {
+
+    int grant = 0;
+
+    if ((c->info.flags & HELLO_PING) && ping_ms > 0)
+        grant |= HELLO_PING;
+
+#ifdef HAVE_ZLIB
+    int stream = 1;
+#ifdef HAVE_LIBURING
+    stream = !uring;
+#endif
+
+    if ((c->info.flags & HELLO_ZLIB) && compress_level > 0 && stream) {
+
+        c->z = zout_new(compress_level);
+        if (!c->z || history_compress(c) < 0)
+            return -1;
+
+        grant |= HELLO_ZLIB;
+        counter_add(&stats->zlib_clients, 1);
+    }
+#endif
+
+    return grant;
+}
+
+/* the hello of client c is complete: fix the history it gets
+   and announce the join */
+static void client_hello(ConnectedClient *c) {
+
+    /* never trust the peer to terminate its strings */
+    c->info.name[MAX_NAME - 1] = '\0';
+
+    claim_name(c);
+
+    /* everyone starts out in the lobby */
+    if (room_join(c, lobby) < 0) {
+        c->dead = 1;
+        return;
+    }
+    c->room = lobby;
+
+    /* replay the history window as it is now; everything after
+       arrives live. /history goes back from its start. */
+    membership(c, lobby)->older = history_window(c);
+
+    /* a hello with flags gets an answer before the history */
+    c->reply = c->info.flags ? hello_reply(c) : -1;
+    if (c->info.flags && c->reply < 0) {
+        c->dead = 1;
+        return;
+    }
+
+    c->state = HS_HISTORY;
+    mark_dirty(c);
+
+    /* print, log and notify everyone */
+    room_event(lobby, MSG_PRESENCE, "%s joined the chat\n", c->info.name);
+}
+
+/* free the memory of a client whose socket is already closed */
+static void free_client(ConnectedClient *c) {
+#ifdef USE_SSL
+    tls_free(c->tls);
+#endif
+#ifdef HAVE_ZLIB
+    zout_free(c->z);
+#endif
+    history_release(c);
+    if (c->marker)
+        msgbuf_unref(c->marker);
+    frame_decoder_free(&c->in);
+    clear_queue(&c->out);
+    free(c);
+}
+
+/* close the socket of a client that left and free it */
+static void release_client(ConnectedClient *c) {
+
+#ifdef HAVE_LIBURING
+    /* operations still in flight point at c (and at its queued
+       buffers). shutting the socket down ends them, and the last
+       completion frees the client. */
+    if (c->ops > 0) {
+        shutdown(c->fd, SHUT_RDWR);
+        close(c->fd);
+        c->fd = -1;
+        return;
+    }
+#endif
+
+    /* select and poll would keep watching the number */
+    if (poller)
+        poller_del(poller, c->fd);
+
+    close(c->fd);
+    free_client(c);
+}
+
+/* announce that client c left, close its socket and free it */
+static void remove_client(ConnectedClient *c) {
+
+    char name[MAX_NAME];
+    memcpy(name, c->info.name, MAX_NAME);
+
+    /* the name is free again right away */
+    if (c->named)
+        nameindex_release(&names, name, conn_handle(c));
+
+    /* leave every room (a connection that never sent its hello is
+       in none) before notifying the others */
+    Room *left[MAX_JOINED];
+    int left_count = 0;
+
+    while (c->joined_count > 0) {
+        left[left_count++] = c->joined[0].room;
+        room_leave(c, &c->joined[0]);
+    }
+
+    /* what it was sent, before the socket goes */
+    count_segments(c);
+    input_unqueue(c);
+
+    /* close socket and remove client before notifying others */
+    conntable_remove(&table, c->fd);
+    counter_add(&stats->clients, -1);
+    counter_add(&stats->disconnects, 1);
+    if (c->state != HS_LIVE)
+        counter_add(&stats->handshakes, -1);
+    timer_cancel(&wheel, &c->timer);
+    release_client(c);
+
+    /* print, log and notify others */
+    for (int k = 0; k < left_count; k++)
+        room_event(left[k], MSG_PRESENCE, "%s left the chat\n", name);
+}
+
+/* remove every client marked dead during this pass.
+   announcing a leave can fail more sends, so repeat until clean. */
+static void reap_clients(void) {
+
+    int removed;
+
+    do {
+        removed = 0;
+
+        /* walk backwards: removal moves the last entry into the hole */
+        for (int i = table.count - 1; i >= 0; i--) {
+
+            ConnectedClient *c = conntable_at(&table, i);
+            if (!c->dead)
+                continue;
+
+            /* a freed client must not stay on the flush list. it can
+               get there during the walk: a leave published into a
+               full ring is delivered at once, so one leave may queue
+               to c and a later one overflow its queue. the flush may
+               fail more sends; clients it marks dead behind the walk
+               are removed in the next round. */
+            if (c->dirty)
+                flush_dirty();
+
+            remove_client(c);
+            removed = 1;
+        }
+
+        /* all the leaves go out in one write per client */
+        if (removed)
+            sync_output();
+    } while (removed);
+}
+
+/* take a freshly accepted socket into the handshake.
+   returns the new client, or NULL (and closes cfd) if nobody was added. */
+static ConnectedClient *admit_client(int cfd) {
+
+    /* do not exceed max clients; accepting and closing keeps the
+       listening socket from staying readable forever */
+    if (conntable_full(&table) || (fd_limit >= 0 && cfd >= fd_limit)) {
+        close(cfd);
+        counter_add(&stats->rejected, 1);
+        return NULL;
+    }
+
+    /* the hello, history and join follow as the socket is ready */
+    ConnectedClient *c = add_client(cfd);
+    if (!c) {
+        close(cfd);
+        counter_add(&stats->rejected, 1);
+        return NULL;
+    }
+
+    counter_add(&stats->accepted, 1);
+
+    return c;
+}
+
+/* accept one pending connection and start its handshake.
+   returns 1 if there may be more to accept, 0 if none is pending or
+   accept fails for want of descriptors or memory (the listener is
+   reported again while connections wait, see run_server_poller). */
+static int accept_client(int server_fd) {
+
+    int cfd = accept(server_fd, NULL, NULL);
+    if (cfd < 0) {
+        /* one connection reset while it waited, or a signal: the
+           others are still there */
+        return errno == ECONNABORTED || errno == EPROTO || errno == EINTR;
+    }
+
+    admit_client(cfd);
+    return 1;
+}
+
+static char *metrics_text(size_t *len);
+
+/* /stats: the stats report, to c only */
+static void cmd_stats(ConnectedClient *c, char *arg) {
+
+    (void)arg;
+
+    size_t len;
+    char *text = metrics_text(&len);
+    if (!text)
+        return;
+
+    MsgBuf *m = msgbuf_new(FRAME_TEXT, text, len);
+    free(text);
+    if (!m)
+        return;
+
+    unicast(c, m);
+    msgbuf_unref(m);
+}
+
+/* the recent messages of room r (what this shard has cached), to
+   c only. queued before c is announced, so nothing is missed or
+   seen twice: later events arrive live. returns where they start,
+   as an event number of the room (see Membership). */
+static int64_t room_history(ConnectedClient *c, Room *r) {
+
+    MsgCache *mc = room_cache(r, self->id);
+
+    /* it all goes through c's queue, so it has to fit */
+    size_t max_bytes = history_bytes < low_water ? history_bytes : low_water;
+    size_t bytes;
+    long n = msgcache_window(mc, history_msgs, max_bytes, &bytes);
+
+    /* the cache is all the history a room has to offer */
+    if (n < 0)
+        n = mc->count;
+
+    for (size_t k = mc->count - n; k < mc->count; k++)
+        unicast(c, msgcache_at(mc, k));
+
+    return (int64_t)r->shards[self->id].delivered - n;
+}
+
+/* /join #room: enter a room (created on first use) and talk there.
+   joining a room c is in already only makes it the current one. */
+static void cmd_join(ConnectedClient *c, char *arg) {
+
+    char name[ROOM_NAME];
+    if (room_name(arg, name) < 0) {
+        tell(c, "* usage: /join #room (letters, digits, - and _)\n");
+        return;
+    }
+
+    Room *r = room_get(&rooms, name,
+                       cache_msgs < ROOM_CACHE ? cache_msgs : ROOM_CACHE, 1);
+    if (!r) {
+        tell(c, "* %s: too many rooms\n", name);
+        return;
+    }
+
+    if (!membership(c, r)) {
+
+        if (room_join(c, r) < 0) {
+            tell(c, "* %s: you are in too many rooms (%d)\n",
+                 name, MAX_JOINED);
+            return;
+        }
+
+        membership(c, r)->older = room_history(c, r);
+        room_event(r, MSG_PRESENCE, "%s joined the room\n", c->info.name);
+    }
+
+    c->room = r;
+    tell(c, "* now talking in %s\n", r->name);
+}
+
+/* /part [#room]: leave a room, the current one by default */
+static void cmd_part(ConnectedClient *c, char *arg) {
+
+    Room *r = c->room;
+
+    if (*arg) {
+        char name[ROOM_NAME];
+        r = room_name(arg, name) == 0 ? room_get(&rooms, name, 0, 0) : NULL;
+    }
+
+    Membership *ms = r ? membership(c, r) : NULL;
+    if (!ms) {
+        tell(c, "* you are not in %s\n", *arg ? arg : "a room");
+        return;
+    }
+
+    room_leave(c, ms);
+    room_event(r, MSG_PRESENCE, "%s left the room\n", c->info.name);
+
+    if (c->room)
+        tell(c, "* left %s, now talking in %s\n", r->name, c->room->name);
+    else
+        tell(c, "* left %s; /join a room to talk\n", r->name);
+}
+
+/* /msg user text: a private message. the index says where the
+   user is; on this shard it is queued right away, for another one
+   it travels the ring, where only that shard picks it up. it goes
+   to nobody else and is not logged. */
+static void cmd_msg(ConnectedClient *c, char *arg) {
+
+    char *text = arg + strcspn(arg, " ");
+    if (*text)
+        *text++ = '\0';
+    text += strspn(text, " ");
+
+    if (!*arg || !*text) {
+        tell(c, "* usage: /msg user text\n");
+        return;
+    }
+
+    int shard;
+    uint64_t to;
+    if (nameindex_find(&names, arg, &shard, &to) < 0) {
+        tell(c, "* %s is not online\n", arg);
+        return;
+    }
+
+    char timestamp[TIMESTAMP_MAX];
+    format_timestamp(timestamp_format, timestamp, sizeof(timestamp));
+
+    char line[MAX_MESSAGE + 128];
+    int n = snprintf(line, sizeof(line), "%s:%s → @%s: %s\n",
+                     timestamp, c->info.name, arg, text);
+    if (n >= (int)sizeof(line))
+        n = sizeof(line) - 1;
+
+    MsgBuf *m = msgbuf_new(FRAME_TEXT, line, n);
+    if (!m)
+        return;
+
+    m->room = ROOM_DIRECT;
+    m->to = to;
+    counter_add(&stats->privates, 1);
+
+    /* the sender sees what it sent */
+    if (to != conn_handle(c))
+        unicast(c, m);
+
+    if (shard == self->id) {
+        deliver_direct(m);
+        msgbuf_unref(m);
+    } else {
+        publish(m);
+    }
+}
+
+/* /nick name: a new name, announced in every room c is in */
+static void cmd_nick(ConnectedClient *c, char *arg) {
+
+    if (!name_ok(arg)) {
+        tell(c, "* usage: /nick name (one word, at most %d characters)\n",
+             MAX_NAME - 1);
+        return;
+    }
+
+    if (strcmp(arg, c->info.name) == 0)
+        return;
+
+    int r = c->named
+          ? nameindex_rename(&names, c->info.name, arg, conn_handle(c))
+          : nameindex_claim(&names, arg, self->id, conn_handle(c));
+
+    if (r < 0) {
+        tell(c, errno == EEXIST ? "* %s is taken\n" : "* cannot rename to %s\n",
+             arg);
+        return;
+    }
+
+    char old[MAX_NAME];
+    memcpy(old, c->info.name, MAX_NAME);
+    snprintf(c->info.name, MAX_NAME, "%s", arg);
+    c->named = 1;
+
+    for (int k = 0; k < c->joined_count; k++)
+        room_event(c->joined[k].room, MSG_PRESENCE,
+                   "%s is now %s\n", old, c->info.name);
+
+    /* in no room, nobody else was told */
+    if (c->joined_count == 0)
+        tell(c, "* you are %s\n", c->info.name);
+}
+
+/* /list: who is online, from the snapshot the name index keeps */
+static void cmd_list(ConnectedClient *c, char *arg) {
+
+    (void)arg;
+
+    MsgBuf *m = nameindex_list(&names);
+    if (m) {
+        unicast(c, m);
+        msgbuf_unref(m);
+    }
+}
+
+/* send c the want messages of room r before the oldest one it has,
+   from r's log, whose message base is the room's first event */
+static void history_page(ConnectedClient *c, Room *r, SegLog *log,
+                         uint64_t base, long want) {
+
+    Membership *ms = membership(c, r);
+
+    if (ms->older < 0 && (uint64_t)-ms->older > base) {
+        tell(c, "* no older messages in %s\n", r->name);
+        return;
+    }
+
+    /* events c got live may not be in the file yet */
+    uint64_t upto = base + ms->older;
+    if (upto > seglog_end(log)) {
+        tell(c, "* %s is still being written, try again\n", r->name);
+        return;
+    }
+
+    /* a page goes through c's queue, so it has to fit */
+    size_t max_bytes = HISTORY_PAGE_BYTES < low_water
+                     ? HISTORY_PAGE_BYTES : low_water;
+
+    SegPos pos;
+    off_t bytes;
+    uint64_t first = seglog_window(log, upto, want, max_bytes, &pos, &bytes);
+
+    if (bytes == 0) {
+        seglog_release(&pos);
+        tell(c, "* no older messages in %s\n", r->name);
+        return;
+    }
+
+    char head[ROOM_NAME + 64];
+    int hlen = snprintf(head, sizeof(head), "* %s, %llu older messages:\n",
+                        r->name, (unsigned long long)(upto - first));
+
+    MsgBuf *m = msgbuf_alloc(hlen + bytes);
+    if (!m) {
+        seglog_release(&pos);
+        return;
+    }
+
+    char *p = msgbuf_payload(m);
+    memcpy(p, head, hlen);
+
+    int err = seglog_read(log, &pos, p + hlen, bytes);
+    seglog_release(&pos);
+
+    if (err < 0) {
+        msgbuf_unref(m);
+        tell(c, "* cannot read the history of %s\n", r->name);
+        return;
+    }
+
+    msgbuf_seal(m, FRAME_TEXT, hlen + bytes);
+    unicast(c, m);
+    msgbuf_unref(m);
+
+    ms->older = (int64_t)first - (int64_t)base;
+    counter_add(&stats->history_pages, 1);
+}
+
+/* /history [N]: the N messages of the current room before the
+   oldest one c has, read from the room's log. every page moves c's
+   place further back, so repeating it scrolls through the room;
+   the connect flow only ever sends the small recent window. */
+static void cmd_history(ConnectedClient *c, char *arg) {
+
+    Room *r = c->room;
+    if (!r || !membership(c, r)) {
+        tell(c, "* /join a room first\n");
+        return;
+    }
+
+    long want = *arg ? strtol(arg, NULL, 10) : HISTORY_PAGE;
+    if (want <= 0) {
+        tell(c, "* usage: /history [messages]\n");
+        return;
+    }
+    if (want > HISTORY_PAGE_MAX)
+        want = HISTORY_PAGE_MAX;
+
+    /* the lobby has the chat log; a room has its own, once the
+       logger opened it (with the room's first event) */
+    if (r == lobby) {
+        history_page(c, r, &chatlog, log_base, want);
+        return;
+    }
+
+    SegLog *log = room_log_lock(r);
+    if (!log) {
+        tell(c, "* no older messages in %s\n", r->name);
+        return;
+    }
+
+    history_page(c, r, log, r->log_base, want);
+    room_log_unlock(r);
+}
+
+/* commands are answered to the sender, never broadcast */
+static const struct {
+    const char *name;
+    void (*run)(ConnectedClient *c, char *arg);
+} commands[] = {
+    { "/stats", cmd_stats },
+    { "/join",  cmd_join },
+    { "/part",  cmd_part },
+    { "/msg",   cmd_msg },
+    { "/nick",  cmd_nick },
+    { "/list",  cmd_list },
+    { "/history", cmd_history }
+};
+
+/* run the command line of client c ("/name arguments") */
+static void run_command(ConnectedClient *c, char *line) {
+
+    char *arg = line + strcspn(line, " ");
+    if (*arg)
+        *arg++ = '\0';
+    arg += strspn(arg, " ");
+
+    for (size_t k = 0; k < sizeof(commands) / sizeof(commands[0]); k++) {
+        if (strcmp(line, commands[k].name) == 0) {
+            commands[k].run(c, arg);
+            return;
+        }
+    }
+
+    tell(c, "* unknown command %s\n", line);
+}
+
+/* format one chat message from client c and broadcast it to the
+   room it talks in, or run it if it is a command */
+static void handle_message(ConnectedClient *c, const char *text, size_t len) {
+
+    /* the log is line based, so control characters
+       (including newlines) inside a message become spaces */
+    char clean[MAX_MESSAGE + 1];
+    for (size_t k = 0; k < len; k++) {
+        unsigned char ch = text[k];
+        clean[k] = (ch < 0x20 || ch == 0x7F) ? ' ' : (char)ch;
+    }
+    clean[len] = '\0';
+
+    if (clean[0] == '/') {
+        run_command(c, clean);
+        return;
+    }
+
+    if (!c->room) {
+        tell(c, "* you are in no room; /join one to talk\n");
+        return;
+    }
+
+    counter_add(&stats->msgs_in, 1);
+
+    /* format message with timestamp and name; print, log and queue
+       for the room's members */
+    room_event(c->room, MSG_CHAT, "%s → %s\n", c->info.name, clean);
+}
+
+/* handle up to max complete frames buffered for client c.
+   returns how many, or -1 on a malformed or oversized frame. */
+static int handle_input(ConnectedClient *c, int max) {
+
+    uint8_t type;
+    const char *payload;
+    size_t len;
+    int n = 0;
+
+    while (n < max && !c->dead) {
+
+        int r = frame_decoder_next(&c->in, &type, &payload, &len);
+        if (r <= 0)
+            return r < 0 ? -1 : n;
+
+        /* a pong only had to arrive: the read stamped c's input */
+        if (type == FRAME_TEXT)
+            handle_message(c, payload, len);
+        n++;
+    }
+
+    return n;
+}
+
+/* after a recv() into len bytes of space that returned n: whether
+   c's socket may still hold input. a short read emptied a plain
+   socket; TLS reads ahead by records, so there only EAGAIN tells. */
+static int more_input(ConnectedClient *c, ssize_t n, size_t len) {
+
+    if (n < 0)
+        return client_pending(c);
+
+#ifdef USE_SSL
+    if (c->tls)
+        return 1;
+#endif
+
+    return (size_t)n == len;
+}
+
+/* receive more of c's hello, a plain Client struct.
+   never reads past it: what follows is already framed.
+   returns the bytes read, -1 if c is gone. */
+static ssize_t read_hello(ConnectedClient *c) {
+
+    size_t want = sizeof(Client) - c->hello_got;
+    ssize_t n = client_recv(c, (char *)&c->info + c->hello_got, want);
+    counter_add(&stats->recvs, 1);
+
+    c->readable = more_input(c, n, want);
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+
+    if (n <= 0)
+        return -1;
+
+    c->hello_got += n;
+    counter_add(&stats->bytes_in, n);
+
+    /* its history and join go out with the rest of the pass */
+    if (c->hello_got == sizeof(Client))
+        client_hello(c);
+
+    return n;
+}
+
+#ifdef USE_SSL
+/* more of c's TLS handshake, as its socket allows. the hello
+   follows once it is done. returns -1 if it failed. */
+static int tls_step(ConnectedClient *c) {
+
+    int want_write;
+    int r = tls_handshake(c->tls, &want_write);
+
+    if (r < 0) {
+        counter_add(&stats->tls_failed, 1);
+        return -1;
+    }
+
+    /* waiting for input means there is none; waiting for room,
+       the loop comes back here once there is some */
+    if (r == 0) {
+        c->readable = 0;
+        watch_output(c, want_write);
+        return 0;
+    }
+
+    watch_output(c, 0);
+    c->state = HS_HELLO;
+
+    counter_add(&stats->tls_clients, 1);
+    if (tls_ktls_send(c->tls))
+        counter_add(&stats->ktls_clients, 1);
+
+    /* the hello may be in already, and no new readiness would
+       tell an edge triggered poller about it */
+    input_ready(c);
+    return 0;
+}
+#endif
+
+/* one read from client c into its frame decoder (or its hello, or
+   TLS handshake). one read may carry many frames, and one frame may
+   span many reads. returns the bytes read, -1 if c is gone. */
+static ssize_t read_client(ConnectedClient *c) {
+
+#ifdef USE_SSL
+    if (c->state == HS_TLS)
+        return tls_step(c);
+#endif
+
+    if (c->state == HS_HELLO)
+        return read_hello(c);
+
+    size_t avail;
+    char *p = frame_decoder_space(&c->in, &avail);
+
+    /* could not grow the buffer */
+    if (avail == 0)
+        return -1;
+
+    ssize_t n = client_recv(c, p, avail);
+    counter_add(&stats->recvs, 1);
 
-configuration via arguments – port, IP, maximum number of clients, path to log file, etc.; 
-currently, all values are hardcoded.
+    c->readable = more_input(c, n, avail);
 
-More flexible client structure – use a dynamic list/vector instead of a static array, allow 
-automatic expansion.
+    /* drained, or a spurious wakeup */
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
 
-Guaranteed delivery and validation – check the results of send_all() in broadcast() and 
-respond (delete “dead” sockets).
+    if (n <= 0)
+        return -1;
 
-Signal handling and proper termination – close all clients, log file, output statistics on 
-SIGINT/SIGTERM.
+    frame_decoder_commit(&c->in, n);
+    counter_add(&stats->bytes_in, n);
+    c->last_input = loop_now;
+    return n;
+}
 
-Extended logging – split into files by date, log level, or connect to syslog/rotation.
+/* one turn of client c: handle its buffered frames and read more
+   while its socket has some, until its budget for the pass is used
+   up. what it produces is queued; the end of the pass writes it,
+   together with everything the others produced. returns 1 if input
+   is left for another turn, 0 if not, -1 if c is gone. */
+static int serve_client(ConnectedClient *c) {
 
-Encryption/authentication – add TLS (OpenSSL, mbedTLS) or simple authorization 
-(passwords).
+    size_t bytes = 0;
+    int msgs = 0;
 
-File transfers – command from the client sendfile <path> and the server sends the 
-content; the server already has send_file, so it can be reused.
-*/
+    while (!c->dead) {
 
+        /* malformed or oversized frame → drop the client */
+        int r = handle_input(c, MSG_BUDGET - msgs);
+        if (r < 0)
+            return -1;
 
-/* structure that represents a connected client */
-typedef struct {
-    int fd;         
-    Client info;
-} ConnectedClient;
+        msgs += r;
 
-/* array of active clients */
-ConnectedClient clients[MAX_CLIENTS];
+        if (msgs >= MSG_BUDGET || bytes >= READ_BUDGET)
+            return c->readable || c->in.end > c->in.start;
 
-/* current number of connected clients */
-int client_count = 0;
+        if (!c->readable)
+            return 0;
+
+        ssize_t n = read_client(c);
+        if (n < 0)
+            return -1;
 
-/* send a message to all connected clients */
-void broadcast(const char *msg, size_t len) {
-    for (int i = 0; i < client_count; i++) {
-        send_all(clients[i].fd, msg, len);
+        bytes += n;
     }
+
+    return 0;
 }
 
-int send_file(int fd, const char *filename) {
+/* give every client queued for input one turn, in order. one whose
+   budget ran out goes to the back and gets its next turn in the next
+   pass, so a flooding connection costs the others one budget's worth
+   of waiting, not its whole backlog. */
+static void serve_input(void) {
 
-    FILE *file = fopen(filename, "rb");
-    if (!file)
-        return -1;
+    ConnectedClient *last = in_tail;
 
-    /* move to end to get file size */
-    fseek(file, 0, SEEK_END);
-    long filesize = ftell(file);
-    rewind(file);
+    while (in_head) {
 
-    /* send file size first */
-    if (send_all(fd, &filesize, sizeof(filesize)) < 0) {
-        fclose(file);
-        return -1;
-    }
+        ConnectedClient *c = in_head;
+        input_unqueue(c);
 
-    char buffer[BUFFER_SIZE];
-    size_t n;
+        int r = c->dead ? 0 : serve_client(c);
 
-    /* send file content in chunks */
-    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-        if (send_all(fd, buffer, n) < 0) {
-            fclose(file);
-            return -1;
+        if (r < 0) {
+            c->dead = 1;
+        } else if (r > 0) {
+            input_queue(c);
+            counter_add(&stats->budget_hits, 1);
         }
-    }
 
-    fclose(file);
-    return 0;
+        if (c == last)
+            break;
+    }
 }
 
-void run_server_select(void) {
+/* the listening socket of this shard, bound and listening */
+static int listen_socket(void) {
 
     /* create tcp socket */
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -98,6 +2998,11 @@ void run_server_select(void) {
     int yes = 1;
     setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
 
+    /* every shard binds its own socket to the same port and the
+       kernel spreads new connections across them */
+    if (shard_count > 1)
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+
     /* configure server address */
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
@@ -115,531 +3020,1210 @@ void run_server_select(void) {
         perror("listen"); exit(1);
     }
 
-    /* open log file in append mode */
-    FILE *logfile = fopen("chat.log", "a");
-    if (!logfile) { perror("fopen"); exit(1); }
+    return server_fd;
+}
 
-    /* master set contains all active fds */
-    fd_set master_set;
+/* readiness loop over select, poll or epoll (--event-loop) */
+void run_server_poller(void) {
 
-    printf("server listening...\n");
+    int server_fd = listen_socket();
 
-    while (1) {
+    /* a connection that vanishes between readiness and accept()
+       must not block the loop */
+    set_nonblocking(server_fd);
 
-        /* prepare fd set */
+    poller = poller_new(poller_kind);
+    if (!poller) { perror("poller_new"); exit(1); }
 
-        FD_ZERO(&master_set);
+    timers_start();
 
-        /* always monitor the listening socket */
-        FD_SET(server_fd, &master_set);
+    /* select's fd_set is a fixed-size bitmap; larger fds are
+       refused at accept */
+    fd_limit = poller_fd_limit(poller);
 
-        /* track the highest fd (required by select) */
-        int max_fd = server_fd;
+    /* clients register with their ConnectedClient pointer; the
+       listening socket is the only entry with NULL, ring wakeups
+       carry the shard pointer. the listening socket stays level
+       triggered under epoll-et: an accept that runs out of
+       descriptors leaves connections waiting, and an edge would not
+       be reported for them again. */
+    if (poller_add(poller, server_fd, POLLER_IN | POLLER_LEVEL, NULL) < 0 ||
+        poller_add(poller, self->wake_fd, POLLER_IN, self) < 0) {
+        perror("poller_add");
+        exit(1);
+    }
 
-        /* add all connected clients to fd set */
-        for (int i = 0; i < client_count; i++) {
-            FD_SET(clients[i].fd, &master_set);
+    /* array that will receive ready events: room for every client
+       of the shard, the listening socket and the wakeup, so one
+       wait covers everyone when they are all busy */
+    int batch = table.limit + 2 < POLLER_BATCH ? table.limit + 2 : POLLER_BATCH;
+    PollerEvent *events = malloc(batch * sizeof(*events));
+    if (!events) { perror("malloc"); exit(1); }
 
-            /* update max_fd if needed */
-            if (clients[i].fd > max_fd)
-                max_fd = clients[i].fd;
-        }
+    /* edge triggered: every connection waiting now, one wakeup per
+       burst as for the clients */
+    int accept_all = poller_edge(poller);
+
+    if (self->id == 0)
+        printf("server listening (%d thread%s, %s)...\n",
+               shard_count, shard_count > 1 ? "s" : "",
+               poller_name(poller_kind));
+
+    while (1) {
+
+        /* wait for events, at most until the next timer is due;
+           only peek if ring events are waiting */
+        int nfds = poller_wait(poller, events, batch, wait_ms());
+
+        woke_up(0);
 
-        /* select modifies fd_set, so we use a copy */
-        fd_set read_fds = master_set;
+        uint64_t t = now_ns();
+        loop_now = t / 1000000;
 
-        /* wait for activity */
-        if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0) {
-            perror("select");
+        if (nfds < 0) {
+            if (errno != EINTR)
+                perror("poller_wait");
             continue;
         }
 
-        /* -------- new connection -------- */
-
-        if (FD_ISSET(server_fd, &read_fds)) {
+        /* iterate over triggered events */
+        for (int e = 0; e < nfds; e++) {
 
-            /* do not exceed max clients */
-            if (client_count >= MAX_CLIENTS)
-                continue;
+            ConnectedClient *c = events[e].ptr;
 
-            int cfd = accept(server_fd, NULL, NULL);
-            if (cfd < 0)
-                continue;
+            /* -------- ring wakeup -------- */
 
-            /* receive client info struct */
-            Client new_client;
-            if (recv_all(cfd, &new_client, sizeof(Client)) < 0) {
-                close(cfd);
-                continue;
+            if ((void *)c == (void *)self) {
+                woke_up(1);
             }
 
-            /* store new client */
-            clients[client_count].fd = cfd;
-            clients[client_count].info = new_client;
-            client_count++;
+            /* -------- new connection -------- */
+
+            else if (!c) {
 
-            /* send chat history to the newly connected client */
-            send_file(cfd, "chat.log");
+                /* accept; hello, history and join follow.
+                   the new socket registers itself */
+                while (accept_client(server_fd) && accept_all)
+                    ;
+            }
+            /* -------- client activity -------- */
+            else {
 
-            /* create join message */
-            char timestamp[32];
-            make_timestamp(timestamp, sizeof(timestamp));
+                /* the pointer is the client itself, no lookup needed.
+                   dead clients stay allocated until the batch ends. */
+                if (c->dead)
+                    continue;
 
-            char join_msg[256];
-            snprintf(join_msg, sizeof(join_msg),
-                    "%s:%s joined the chat\n",
-                    timestamp,
-                    new_client.name);
+                int re = events[e].events;
 
-            /* print and log join event */
-            printf("%s", join_msg);
-            fprintf(logfile, "%s", join_msg);
-            fflush(logfile);
+                /* socket can take more output */
+                if (re & POLLER_OUT)
+                    flush_client(c);
 
-            /* notify everyone */
-            broadcast(join_msg, strlen(join_msg));
+                /* read once every ready client is known */
+                if (re & (POLLER_IN | POLLER_ERR))
+                    input_ready(c);
+            }
         }
 
-        /* -------- messages / disconnect -------- */
+        /* read and broadcast every complete message, a budget's
+           worth per client */
+        serve_input();
 
-        for (int i = 0; i < client_count; i++) {
+        /* drop clients whose socket failed during this batch, or
+           whose handshake took too long or who went silent */
+        run_timers();
+        reap_clients();
 
-            /* check if this client's fd is ready */
-            if (!FD_ISSET(clients[i].fd, &read_fds))
-                continue;
+        /* the output of the whole pass, and events published by
+           other shards: one write per client */
+        sync_output();
 
-            char buf[BUFFER_SIZE];
+        counter_add(&stats->passes, 1);
+        counter_add(&stats->events, nfds);
+        histogram_add(&stats->loop_ns, now_ns() - t);
+    }
+}
 
-            /* read incoming data */
-            ssize_t n = recv(clients[i].fd, buf, sizeof(buf) - 1, 0);
+#ifdef HAVE_LIBURING
+
+/* the io_uring loop relies on provided buffer rings and multishot
+   accept/recv (linux 6.0). checked once at startup, so an older
+   kernel quietly keeps the readiness loops. */
+static int uring_supported(void) {
+
+    struct utsname u;
+    int major = 0, minor = 0;
+    if (uname(&u) < 0 || sscanf(u.release, "%d.%d", &major, &minor) != 2
+        || major < 6)
+        return 0;
+
+    struct io_uring ur;
+    if (io_uring_queue_init(8, &ur, 0) < 0)
+        return 0;
+
+    int ok = 0;
+    struct io_uring_probe *probe = io_uring_get_probe_ring(&ur);
+
+    if (probe &&
+        io_uring_opcode_supported(probe, IORING_OP_ACCEPT) &&
+        io_uring_opcode_supported(probe, IORING_OP_RECV) &&
+        io_uring_opcode_supported(probe, IORING_OP_SEND) &&
+        io_uring_opcode_supported(probe, IORING_OP_POLL_ADD)) {
+
+        int err;
+        struct io_uring_buf_ring *br =
+            io_uring_setup_buf_ring(&ur, 8, URING_BGID, 0, &err);
+        if (br) {
+            io_uring_free_buf_ring(&ur, br, 8, URING_BGID);
+            ok = 1;
+        }
+    }
 
-            /* ----- client disconnected ----- */
-            if (n <= 0) {
+    if (probe)
+        io_uring_free_probe(probe);
+    io_uring_queue_exit(&ur);
+    return ok;
+}
 
-                char timestamp[32];
-                make_timestamp(timestamp, sizeof(timestamp));
+/* this shard's receive buffers */
+static _Thread_local struct io_uring_buf_ring *uring_bufs;
+static _Thread_local char *uring_buf_mem;
 
-                char leave_msg[256];
-                snprintf(leave_msg, sizeof(leave_msg),
-                        "%s:%s left the chat\n",
-                        timestamp,
-                        clients[i].info.name);
+/* hand receive buffer bid back to the kernel */
+static void uring_return_buf(unsigned bid) {
 
-                /* print and log leave event */
-                printf("%s", leave_msg);
-                fprintf(logfile, "%s", leave_msg);
-                fflush(logfile);
+    io_uring_buf_ring_add(uring_bufs, uring_buf_mem + bid * URING_BUF_SIZE,
+                          URING_BUF_SIZE, bid,
+                          io_uring_buf_ring_mask(URING_BUFS), 0);
+    io_uring_buf_ring_advance(uring_bufs, 1);
+}
 
-                /* notify others */
-                broadcast(leave_msg, strlen(leave_msg));
+/* copy received bytes into c's decoder and handle complete frames.
+   returns -1 on a malformed frame. */
+static int uring_feed(ConnectedClient *c, const char *data, size_t len) {
 
-                /* close socket and remove client */
-                close(clients[i].fd);
+    /* the hello comes first, everything after it is frames */
+    if (c->state == HS_HELLO) {
 
-                /* swap with last client to keep array compact */
-                clients[i] = clients[client_count - 1];
-                client_count--;
-                i--;  /* re-check this index */
-                continue;
-            }
+        size_t n = sizeof(Client) - c->hello_got;
+        if (n > len)
+            n = len;
 
-            /* ----- normal chat message ----- */
+        memcpy((char *)&c->info + c->hello_got, data, n);
+        c->hello_got += n;
+        data += n;
+        len -= n;
 
-            buf[n] = '\0';  /* null-terminate received data */
+        if (c->hello_got == sizeof(Client))
+            client_hello(c);
+    }
 
-            char timestamp[32];
-            make_timestamp(timestamp, sizeof(timestamp));
+    while (len > 0) {
 
-            /* format message with timestamp and name */
-            char formatted[BUFFER_SIZE + 128];
-            snprintf(formatted, sizeof(formatted),
-                    "%s:%s → %s\n",
-                    timestamp,
-                    clients[i].info.name,
-                    buf);
+        size_t avail;
+        char *p = frame_decoder_space(&c->in, &avail);
+        if (avail == 0)
+            return -1;
 
-            /* print to server console and log file */
-            printf("%s", formatted);
-            fprintf(logfile, "%s", formatted);
-            fflush(logfile);
+        size_t n = len < avail ? len : avail;
+        memcpy(p, data, n);
+        frame_decoder_commit(&c->in, n);
+        data += n;
+        len -= n;
 
-            /* broadcast to all clients */
-            broadcast(formatted, strlen(formatted));
-        }
+        if (handle_input(c, INT_MAX) < 0)
+            return -1;
     }
+
+    return 0;
 }
 
-void run_server_poll(void) {
-    /* create tcp socket */
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) { perror("socket"); exit(1); }
+/* one operation of client c finished. returns 1 if c is gone
+   (closed earlier and now freed) and must not be touched again. */
+static int uring_op_done(ConnectedClient *c) {
 
-    /* allow quick restart after server crash */
-    int yes = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    c->ops--;
 
-    /* configure server address */
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(SERVER_PORT);
-    inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+    if (c->fd >= 0)
+        return 0;
 
-    /* bind socket to address */
-    if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind"); exit(1);
+    if (c->ops == 0)
+        free_client(c);
+    return 1;
+}
+
+/* one send of c's current chain completed */
+static void uring_send_done(ConnectedClient *c, struct io_uring_cqe *cqe) {
+
+    c->sending--;
+
+    if (uring_op_done(c))
+        return;
+
+    OutQueue *q = &c->out;
+    MsgBuf *m = q->items[q->head];
+
+    /* failed, short, or cancelled because an earlier link failed */
+    if (cqe->res < 0 || (size_t)cqe->res < m->len) {
+        c->dead = 1;
+        return;
     }
 
-    /* start listening for incoming connections */
-    if (listen(server_fd, SOMAXCONN) < 0) {
-        perror("listen"); exit(1);
+    /* chains are sent in queue order, so this is the oldest buffer */
+    q->bytes -= m->len;
+    counter_add(&stats->queued_bytes, -m->len);
+    counter_add(&stats->sends, 1);
+    counter_add(&stats->bytes_out, m->len);
+    msgbuf_unref(m);
+    q->head = (q->head + 1) & (q->cap - 1);
+    q->count--;
+
+    check_drained(c);
+
+    /* chain finished → send what was queued meanwhile */
+    if (c->sending == 0 && !c->dead)
+        uring_flush(c);
+}
+
+/* completions waiting to be handled, in arrival order */
+static _Thread_local struct io_uring_cqe *backlog;
+static _Thread_local size_t backlog_head, backlog_count, backlog_cap;
+
+static void backlog_push(const struct io_uring_cqe *cqe) {
+
+    /* handled entries at the front are reused first */
+    if (backlog_count == backlog_cap && backlog_head > 0) {
+        memmove(backlog, backlog + backlog_head,
+                (backlog_count - backlog_head) * sizeof(*backlog));
+        backlog_count -= backlog_head;
+        backlog_head = 0;
+    }
+
+    if (backlog_count == backlog_cap) {
+        backlog_cap = backlog_cap ? backlog_cap * 2 : URING_BATCH;
+        backlog = realloc(backlog, backlog_cap * sizeof(*backlog));
+        if (!backlog) { perror("realloc"); exit(1); }
     }
 
-    /* open log file in append mode */
-    FILE *logfile = fopen("chat.log", "a");
-    if (!logfile) { perror("fopen"); exit(1); }
+    backlog[backlog_count++] = *cqe;
+}
 
-    /* poll descriptors: 1 for server + N clients */
-    struct pollfd fds[MAX_CLIENTS + 1];
+/* take every posted completion off the completion queue.
+   sends are finished right away, so output queues drain while a
+   burst of receives is still being worked through; everything
+   else waits in the backlog. */
+static void uring_collect(void) {
 
-    printf("server listening...\n");
+    struct io_uring_cqe *cqe;
 
-    while (1) {
+    while (io_uring_peek_cqe(uring, &cqe) == 0) {
 
-        /* prepare poll array */
+        uint64_t data = io_uring_cqe_get_data64(cqe);
 
-        /* first descriptor is always the listening socket */
-        fds[0].fd = server_fd;
-        fds[0].events = POLLIN;
+        if ((data & URING_OP_MASK) == URING_SEND)
+            uring_send_done((ConnectedClient *)(uintptr_t)
+                            (data & ~(uint64_t)URING_OP_MASK), cqe);
+        else
+            backlog_push(cqe);
 
-        /* add all connected clients to poll set */
-        for (int i = 0; i < client_count; i++) {
-            fds[i + 1].fd = clients[i].fd;
-            fds[i + 1].events = POLLIN;
-        }
+        io_uring_cqe_seen(uring, cqe);
+    }
+}
 
-        int nfds = client_count + 1;
+/* a multishot receive produced data, or ended */
+static void uring_recv_done(ConnectedClient *c, struct io_uring_cqe *cqe) {
 
-        /* wait for activity */
-        if (poll(fds, nfds, -1) < 0) {
-            perror("poll");
-            continue;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (cqe->res > 0) {
+            counter_add(&stats->bytes_in, cqe->res);
+            c->last_input = loop_now;
         }
 
-        /* -------- new connection -------- */
+        if (cqe->res > 0 && c->fd >= 0 && !c->dead &&
+            uring_feed(c, uring_buf_mem + bid * URING_BUF_SIZE,
+                       cqe->res) < 0)
+            c->dead = 1;
 
-        if (fds[0].revents & POLLIN) {
+        uring_return_buf(bid);
+    }
 
-            /* do not exceed max clients */
-            if (client_count >= MAX_CLIENTS)
-                continue;
+    /* still armed → more completions will follow */
+    if (cqe->flags & IORING_CQE_F_MORE)
+        return;
 
-            int cfd = accept(server_fd, NULL, NULL);
-            if (cfd < 0)
-                continue;
+    if (uring_op_done(c))
+        return;
 
-            /* receive client info struct */
-            Client new_client;
-            if (recv_all(cfd, &new_client, sizeof(Client)) < 0) {
-                close(cfd);
-                continue;
-            }
+    /* every buffer was in use: not an error, just start over */
+    if (cqe->res == -ENOBUFS && !c->dead)
+        uring_recv(c);
+    else
+        c->dead = 1;
+}
 
-            /* store new client */
-            clients[client_count].fd = cfd;
-            clients[client_count].info = new_client;
-            client_count++;
+/* start (or restart) the multishot accept on the listening socket */
+static void uring_accept(int server_fd) {
 
-            /* send chat history to the newly connected client */
-            send_file(cfd, "chat.log");
+    struct io_uring_sqe *sqe = uring_sqe();
+    io_uring_prep_multishot_accept(sqe, server_fd, NULL, NULL, 0);
+    io_uring_sqe_set_data64(sqe, URING_ACCEPT);
+}
 
-            /* create join message */
-            char timestamp[32];
-            make_timestamp(timestamp, sizeof(timestamp));
+/* start (or restart) the multishot poll on the ring wakeup eventfd */
+static void uring_wake(void) {
 
-            char join_msg[256];
-            snprintf(join_msg, sizeof(join_msg),
-                    "%s:%s joined the chat\n",
-                    timestamp,
-                    new_client.name);
+    struct io_uring_sqe *sqe = uring_sqe();
+    io_uring_prep_poll_multishot(sqe, self->wake_fd, POLLIN);
+    io_uring_sqe_set_data64(sqe, URING_WAKE);
+}
 
-            /* print and log join event */
-            printf("%s", join_msg);
-            fprintf(logfile, "%s", join_msg);
-            fflush(logfile);
+void run_server_uring(void) {
 
-            /* notify everyone */
-            broadcast(join_msg, strlen(join_msg));
-        }
+    int server_fd = listen_socket();
 
-        /* -------- messages / disconnect -------- */
+    /* create the ring. a broadcast completes one send per client,
+       so the completion queue gets extra room. */
+    struct io_uring ur;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_ENTRIES * 8;
 
-        for (int i = 0; i < client_count; i++) {
+    int err = io_uring_queue_init_params(URING_ENTRIES, &ur, &params);
+    if (err < 0) {
+        fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-err));
+        exit(1);
+    }
 
-            /* skip if no data on this client */
-            if (!(fds[i + 1].revents & POLLIN))
-                continue;
+    /* lets the client helpers arm receives and queue sends */
+    uring = &ur;
 
-            char buf[BUFFER_SIZE];
+    timers_start();
 
-            /* read incoming data */
-            ssize_t n = recv(clients[i].fd, buf, sizeof(buf) - 1, 0);
+    /* register the receive buffers */
+    uring_buf_mem = malloc((size_t)URING_BUFS * URING_BUF_SIZE);
+    uring_bufs = io_uring_setup_buf_ring(&ur, URING_BUFS, URING_BGID, 0, &err);
+    if (!uring_buf_mem || !uring_bufs) {
+        fprintf(stderr, "io_uring_setup_buf_ring: %s\n", strerror(-err));
+        exit(1);
+    }
+
+    for (unsigned bid = 0; bid < URING_BUFS; bid++)
+        uring_return_buf(bid);
+
+    uring_accept(server_fd);
+    uring_wake();
 
-            /* ----- client disconnected ----- */
-            if (n <= 0) {
+    if (self->id == 0)
+        printf("server listening (%d thread%s, io_uring)...\n",
+               shard_count, shard_count > 1 ? "s" : "");
 
-                char timestamp[32];
-                make_timestamp(timestamp, sizeof(timestamp));
+    while (1) {
 
-                char leave_msg[256];
-                snprintf(leave_msg, sizeof(leave_msg),
-                        "%s:%s left the chat\n",
-                        timestamp,
-                        clients[i].info.name);
+        /* one syscall submits everything queued during the last pass
+           (sends of every client, re-armed receives) and waits for
+           completions, at most until the next timer is due;
+           only peek if completions or ring events are waiting */
+        int ms = 0;
+        if (backlog_head == backlog_count && io_uring_cq_ready(&ur) == 0)
+            ms = wait_ms();
+
+        int r;
+        if (ms > 0) {
+            struct __kernel_timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+            struct io_uring_cqe *first;
+            r = io_uring_submit_and_wait_timeout(&ur, &first, 1, &ts, NULL);
+        } else {
+            r = io_uring_submit_and_wait(&ur, ms < 0 ? 1 : 0);
+        }
 
-                /* print and log leave event */
-                printf("%s", leave_msg);
-                fprintf(logfile, "%s", leave_msg);
-                fflush(logfile);
+        woke_up(0);
 
-                /* notify others */
-                broadcast(leave_msg, strlen(leave_msg));
+        uint64_t t = now_ns();
+        loop_now = t / 1000000;
+        int handled = 0;
 
-                /* close socket and remove client */
-                close(clients[i].fd);
+        if (r < 0 && r != -EINTR && r != -EBUSY && r != -ETIME)
+            fprintf(stderr, "io_uring_submit_and_wait: %s\n", strerror(-r));
 
-                /* swap with last client to keep array compact */
-                clients[i] = clients[client_count - 1];
-                client_count--;
-                i--;  /* re-check this index */
-                continue;
-            }
+        uring_collect();
 
-            /* ----- normal chat message ----- */
+        /* handle a batch of completions. a copy is taken, since
+           handling one can collect more and move the backlog. */
+        for (int k = 0; k < URING_BATCH && backlog_head < backlog_count; k++) {
 
-            buf[n] = '\0';  /* null-terminate received data */
+            struct io_uring_cqe done = backlog[backlog_head++];
+            struct io_uring_cqe *cqe = &done;
+            handled++;
 
-            char timestamp[32];
-            make_timestamp(timestamp, sizeof(timestamp));
+            uint64_t data = io_uring_cqe_get_data64(cqe);
+            ConnectedClient *c = (ConnectedClient *)(uintptr_t)
+                                 (data & ~(uint64_t)URING_OP_MASK);
 
-            /* format message with timestamp and name */
-            char formatted[BUFFER_SIZE + 128];
-            snprintf(formatted, sizeof(formatted),
-                    "%s:%s → %s\n",
-                    timestamp,
-                    clients[i].info.name,
-                    buf);
+            switch (data & URING_OP_MASK) {
 
-            /* print to server console and log file */
-            printf("%s", formatted);
-            fprintf(logfile, "%s", formatted);
-            fflush(logfile);
+            /* -------- ring wakeup -------- */
+            case URING_WAKE:
+                woke_up(1);
+                if (!(cqe->flags & IORING_CQE_F_MORE))
+                    uring_wake();
+                break;
 
-            /* broadcast to all clients */
-            broadcast(formatted, strlen(formatted));
+            /* -------- new connection -------- */
+            case URING_ACCEPT:
+
+                /* hello, history and join follow */
+                if (cqe->res >= 0)
+                    admit_client(cqe->res);
+
+                if (!(cqe->flags & IORING_CQE_F_MORE))
+                    uring_accept(server_fd);
+                break;
+
+            /* -------- messages / disconnect -------- */
+            case URING_RECV:
+                uring_recv_done(c, cqe);
+                break;
+
+            /* -------- room for the history replay -------- */
+            case URING_WRITABLE:
+                c->sending = 0;
+                if (!uring_op_done(c) && !c->dead)
+                    uring_flush(c);
+                break;
+            }
         }
-    }
-}
 
-void run_server_epoll(void) {
+        if (backlog_head == backlog_count)
+            backlog_head = backlog_count = 0;
 
-    /* create tcp socket */
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) { perror("socket"); exit(1); }
+        /* drop clients whose socket failed during this pass, or
+           whose handshake took too long or who went silent */
+        run_timers();
+        reap_clients();
 
-    /* allow quick restart after server crash */
-    int yes = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        /* the output of the whole pass, and events published by
+           other shards: one write per client */
+        sync_output();
 
-    /* configure server address */
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(SERVER_PORT);
-    inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+        counter_add(&stats->passes, 1);
+        counter_add(&stats->events, handled);
+        histogram_add(&stats->loop_ns, now_ns() - t);
+    }
+}
 
-    /* bind socket to address */
-    if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind"); exit(1);
+#endif
+
+/* the stats, per name */
+static const struct {
+    const char *name;
+    size_t offset;
+} stat_counters[] = {
+    { "clients",        offsetof(ShardStats, clients) },
+    { "handshakes",     offsetof(ShardStats, handshakes) },
+    { "accepted",       offsetof(ShardStats, accepted) },
+    { "rejected",       offsetof(ShardStats, rejected) },
+    { "disconnects",    offsetof(ShardStats, disconnects) },
+    { "timeouts",       offsetof(ShardStats, timeouts) },
+    { "idle_timeouts",  offsetof(ShardStats, idle_timeouts) },
+    { "pings",          offsetof(ShardStats, pings) },
+    { "passes",         offsetof(ShardStats, passes) },
+    { "events",         offsetof(ShardStats, events) },
+    { "msgs_in",        offsetof(ShardStats, msgs_in) },
+    { "bytes_in",       offsetof(ShardStats, bytes_in) },
+    { "recvs",          offsetof(ShardStats, recvs) },
+    { "budget_hits",    offsetof(ShardStats, budget_hits) },
+    { "broadcasts",     offsetof(ShardStats, broadcasts) },
+    { "deliveries",     offsetof(ShardStats, deliveries) },
+    { "slow_drops",     offsetof(ShardStats, slow_drops) },
+    { "slow_clients",   offsetof(ShardStats, slow_clients) },
+    { "slow_skipped",   offsetof(ShardStats, slow_skipped) },
+    { "slow_collapsed", offsetof(ShardStats, slow_collapsed) },
+    { "queued_bytes",   offsetof(ShardStats, queued_bytes) },
+    { "sends",          offsetof(ShardStats, sends) },
+    { "corks",          offsetof(ShardStats, corks) },
+    { "segs_out",       offsetof(ShardStats, segs_out) },
+    { "bytes_out",      offsetof(ShardStats, bytes_out) },
+    { "history_hits",   offsetof(ShardStats, history_hits) },
+    { "history_misses", offsetof(ShardStats, history_misses) },
+    { "history_pages",  offsetof(ShardStats, history_pages) },
+    { "joins",          offsetof(ShardStats, joins) },
+    { "parts",          offsetof(ShardStats, parts) },
+    { "privates",       offsetof(ShardStats, privates) },
+    { "tls_clients",    offsetof(ShardStats, tls_clients) },
+    { "tls_failed",     offsetof(ShardStats, tls_failed) },
+    { "ktls_clients",   offsetof(ShardStats, ktls_clients) },
+    { "zlib_clients",   offsetof(ShardStats, zlib_clients) },
+    { "zlib_in",        offsetof(ShardStats, zlib_in) },
+    { "zlib_out",       offsetof(ShardStats, zlib_out) },
+    { "history_blocks", offsetof(ShardStats, history_blocks) },
+    { "history_block_hits", offsetof(ShardStats, history_block_hits) }
+};
+
+static const struct {
+    const char *name;
+    size_t offset;
+    double scale;       /* ns → us */
+} stat_histograms[] = {
+    { "loop_us",        offsetof(ShardStats, loop_ns),      1e3 },
+    { "broadcast_us",   offsetof(ShardStats, broadcast_ns), 1e3 },
+    { "queue_depth",    offsetof(ShardStats, queue_depth),  1 },
+    { "queue_bytes",    offsetof(ShardStats, queue_bytes),  1 }
+};
+
+/* one counter of every shard added up */
+static uint64_t counter_sum(size_t offset) {
+
+    uint64_t sum = 0;
+    for (int i = 0; i < shard_count; i++)
+        sum += counter_get((Counter *)((char *)&shards[i].stats + offset));
+
+    return sum;
+}
+
+/* every shard's stats added up, and the logger's, as "name value"
+   lines. safe to call from any thread while the shards run. */
+static void metrics_report(FILE *out) {
+
+    fprintf(out, "uptime_s %llu\n",
+            (unsigned long long)((now_ns() - start_time) / 1000000000ull));
+    fprintf(out, "threads %d\n", shard_count);
+    fprintf(out, "event_loop %s\n", loop_name);
+    fprintf(out, "rooms %d\n", atomic_load(&rooms.count));
+
+    for (size_t k = 0; k < sizeof(stat_counters) / sizeof(stat_counters[0]); k++)
+        fprintf(out, "%s %llu\n", stat_counters[k].name,
+                (unsigned long long)counter_sum(stat_counters[k].offset));
+
+    /* what one delivered message costs in syscalls and TCP segments
+       (history replays included) */
+    uint64_t delivered = counter_sum(offsetof(ShardStats, deliveries));
+    if (delivered > 0) {
+        fprintf(out, "sends_per_msg %.3f\n",
+                counter_sum(offsetof(ShardStats, sends)) / (double)delivered);
+        fprintf(out, "segs_per_msg %.3f\n",
+                counter_sum(offsetof(ShardStats, segs_out)) / (double)delivered);
     }
 
-    /* start listening for incoming connections */
-    if (listen(server_fd, SOMAXCONN) < 0) {
-        perror("listen"); exit(1);
+    /* how far the slowest shard is behind the newest event */
+    uint64_t next = atomic_load(&ring.next), lag = 0;
+    for (int i = 0; i < shard_count; i++) {
+        uint64_t pos = atomic_load(&ring.cursors[i].pos);
+        if (next > pos && next - pos > lag)
+            lag = next - pos;
     }
+    fprintf(out, "ring_lag %llu\n", (unsigned long long)lag);
 
-    /* open log file in append mode */
-    FILE *logfile = fopen("chat.log", "a");
-    if (!logfile) { perror("fopen"); exit(1); }
+    for (size_t k = 0; k < sizeof(stat_histograms) / sizeof(stat_histograms[0]); k++) {
 
-    /* create epoll instance */
-    int epfd = epoll_create1(0);
-    if (epfd < 0) { perror("epoll_create1"); exit(1); }
+        Histogram sum;
+        memset(&sum, 0, sizeof(sum));
+        for (int i = 0; i < shard_count; i++)
+            histogram_merge(&sum, (Histogram *)((char *)&shards[i].stats +
+                                                stat_histograms[k].offset));
 
-    /* event structure used for registration */
-    struct epoll_event ev;
+        histogram_print(out, stat_histograms[k].name, &sum,
+                        stat_histograms[k].scale);
+    }
 
-    /* register listening socket in epoll */
-    ev.events = EPOLLIN;          /* we care about read events */
-    ev.data.fd = server_fd;       /* store fd inside event */
+    logger_metrics(&logger, out);
+}
 
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
-        perror("epoll_ctl: server_fd");
-        exit(1);
-    }
+/* the stats report as one string (free it) */
+static char *metrics_text(size_t *len) {
+
+    char *text = NULL;
+    FILE *f = open_memstream(&text, len);
+    if (!f)
+        return NULL;
+
+    metrics_report(f);
+    fclose(f);
+    return text;
+}
 
-    /* array that will receive ready events */
-    struct epoll_event events[MAX_CLIENTS + 1];
+/* local admin socket (--admin): every connection gets the stats
+   report and is closed. served by its own thread, so reading the
+   stats never costs the event loops more than the reads. */
+static void *admin_main(void *arg) {
 
-    printf("server listening...\n");
+    int fd = *(int *)arg;
 
     while (1) {
 
-        /* wait for events */
-        int nfds = epoll_wait(epfd, events, MAX_CLIENTS + 1, -1);
-        if (nfds < 0) {
-            perror("epoll_wait");
+        int cfd = accept(fd, NULL, NULL);
+        if (cfd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                perror("accept: admin");
             continue;
         }
 
-        /* iterate over triggered events */
-        for (int e = 0; e < nfds; e++) {
+        size_t len;
+        char *text = metrics_text(&len);
+        if (text)
+            send_all(cfd, text, len);
 
-            int current_fd = events[e].data.fd;
+        free(text);
+        close(cfd);
+    }
 
-            /* -------- new connection -------- */
+    return NULL;
+}
 
-            if (current_fd == server_fd) {
+static int admin_start(const char *path) {
 
-                /* do not exceed max clients */
-                if (client_count >= MAX_CLIENTS)
-                    continue;
+    static int fd;
+    static pthread_t thread;
 
-                int cfd = accept(server_fd, NULL, NULL);
-                if (cfd < 0)
-                    continue;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
 
-                /* register new client socket in epoll */
-                ev.events = EPOLLIN;
-                ev.data.fd = cfd;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
 
-                if (epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev) < 0) {
-                    perror("epoll_ctl: client_fd");
-                    close(cfd);
-                    continue;
-                }
+    /* a socket file left over from an earlier run */
+    unlink(path);
 
-                /* receive client info struct */
-                Client new_client;
-                if (recv_all(cfd, &new_client, sizeof(Client)) < 0) {
-                    close(cfd);
-                    continue;
-                }
+    /* only the owner may read the stats */
+    mode_t mask = umask(077);
+    int r = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
 
-                /* store new client */
-                clients[client_count].fd = cfd;
-                clients[client_count].info = new_client;
-                client_count++;
+    if (r < 0 || listen(fd, 16) < 0 ||
+        pthread_create(&thread, NULL, admin_main, &fd) != 0) {
+        close(fd);
+        return -1;
+    }
 
-                /* send chat history to the newly connected client */
-                send_file(cfd, "chat.log");
+    pthread_detach(thread);
+    return 0;
+}
 
-                /* create join message */
-                char timestamp[32];
-                make_timestamp(timestamp, sizeof(timestamp));
+/* allow one descriptor per client, those of the open logs (the chat
+   log, ROOM_LOGS room logs, and one a /history on each shard may
+   open for a moment), plus some headroom. only the soft limit can be
+   raised without privileges. */
+static void raise_fd_limit(int clients_wanted) {
 
-                char join_msg[256];
-                snprintf(join_msg, sizeof(join_msg),
-                        "%s:%s joined the chat\n",
-                        timestamp,
-                        new_client.name);
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        return;
 
-                /* print and log join event */
-                printf("%s", join_msg);
-                fprintf(logfile, "%s", join_msg);
-                fflush(logfile);
+    rlim_t logs = 1 + ROOM_LOGS + shard_count;
+    rlim_t want = (rlim_t)clients_wanted + logs * SEGLOG_FDS + 64;
+    if (rl.rlim_cur >= want)
+        return;
 
-                /* notify everyone */
-                broadcast(join_msg, strlen(join_msg));
-            }
-            /* -------- client activity -------- */
-            else {
+    rl.rlim_cur = (rl.rlim_max < want) ? rl.rlim_max : want;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+        perror("setrlimit");
 
-                /* find client index by fd */
-                int i;
-                for (i = 0; i < client_count; i++) {
-                    if (clients[i].fd == current_fd)
-                        break;
-                }
+    if (rl.rlim_cur < want)
+        fprintf(stderr, "warning: fd limit %lu is below --max-clients %d\n",
+                (unsigned long)rl.rlim_cur, clients_wanted);
+}
 
-                if (i == client_count)
-                    continue;
+/* thread body of one shard: own client table, own event loop */
+static void *shard_main(void *arg) {
+
+    self = arg;
+    stats = &self->stats;
+
+    /* every shard takes an equal share of the client limit */
+    int limit = (max_clients + shard_count - 1) / shard_count;
+
+    if (conntable_init(&table, limit) < 0) {
+        perror("conntable_init");
+        exit(1);
+    }
 
-                char buf[BUFFER_SIZE];
+    run_loop();
+    return NULL;
+}
+
+/* fill every shard's lobby cache with the tail of the log, so the
+   first joins after a restart are served from memory too. the other
+   rooms start out empty. */
+static int seed_caches(void) {
 
-                /* read incoming data */
-                ssize_t n = recv(current_fd, buf, sizeof(buf) - 1, 0);
+    SegPos pos;
+    off_t bytes;
+    uint64_t first = seglog_window(&chatlog, UINT64_MAX, cache_msgs,
+                                   (size_t)-1, &pos, &bytes);
 
-                /* ----- client disconnected ----- */
-                if (n <= 0) {
+    size_t len = bytes;
+    char *text = malloc(len ? len : 1);
 
-                    char timestamp[32];
-                    make_timestamp(timestamp, sizeof(timestamp));
+    if (!text || seglog_read(&chatlog, &pos, text, len) < 0) {
+        seglog_release(&pos);
+        free(text);
+        return -1;
+    }
 
-                    char leave_msg[256];
-                    snprintf(leave_msg, sizeof(leave_msg),
-                            "%s:%s left the chat\n",
-                            timestamp,
-                            clients[i].info.name);
+    seglog_release(&pos);
 
-                    /* print and log leave event */
-                    printf("%s", leave_msg);
-                    fprintf(logfile, "%s", leave_msg);
-                    fflush(logfile);
+    /* one buffer per logged line, shared by all shards */
+    for (size_t at = 0; at < len; ) {
 
-                    /* notify others */
-                    broadcast(leave_msg, strlen(leave_msg));
+        char *nl = memchr(text + at, '\n', len - at);
+        size_t line = nl ? (size_t)(nl - (text + at)) + 1 : len - at;
 
-                    /* remove from epoll */
-                    epoll_ctl(epfd, EPOLL_CTL_DEL, current_fd, NULL);
+        MsgBuf *m = msgbuf_new(FRAME_TEXT, text + at, line);
+        if (m) {
+            for (int k = 0; k < shard_count; k++)
+                msgcache_push(room_cache(lobby, k), m);
+            msgbuf_unref(m);
+        }
 
-                    /* close socket */
-                    close(current_fd);
+        at += line;
+    }
 
-                    /* keep array compact */
-                    clients[i] = clients[client_count - 1];
-                    client_count--;
-                    continue;
-                }
+    /* only a window that reaches the oldest kept message is complete */
+    for (int k = 0; k < shard_count; k++)
+        room_cache(lobby, k)->whole = room_cache(lobby, k)->whole &&
+                                      first == seglog_begin(&chatlog);
 
-                /* ----- normal chat message ----- */
+    free(text);
+    return 0;
+}
+
+#ifdef USE_SSL
+#define TLS_USAGE \
+    "  -x, --tls-cert FILE   speak TLS, with this certificate (PEM)\n" \
+    "  -k, --tls-key FILE    its private key (default: in the cert file)\n"
+#define TLS_OPTIONS "x:k:"
+#else
+#define TLS_USAGE ""
+#define TLS_OPTIONS ""
+#endif
+
+#ifdef HAVE_ZLIB
+#define ZLIB_USAGE \
+    "  -z, --compress LEVEL  zlib level for clients that ask for it, 1 to 9\n" \
+    "                        (default 1), 0: never compress\n"
+#define ZLIB_OPTIONS "z:"
+#else
+#define ZLIB_USAGE ""
+#define ZLIB_OPTIONS ""
+#endif
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -m, --max-clients N   most simultaneous clients (default %d)\n"
+            "  -t, --threads N       event loop threads (default 1)\n"
+            "  -H, --history N       messages replayed to a new client (default %d)\n"
+            "  -b, --history-bytes N at most N bytes of history (default %d)\n"
+            "  -c, --cache N         recent messages kept in memory (default %d)\n"
+            "  -W, --high-water N    unsent bytes per client before the slow\n"
+            "                        client policy applies (default %d)\n"
+            "  -w, --low-water N     where a slow client is let off (default\n"
+            "                        half the high water mark)\n"
+            "  -P, --slow-policy P   disconnect (default), drop the oldest chat\n"
+            "                        lines, or collapse joins and leaves first\n"
+            "  -s, --sync MODE       log durability: none, batch, or fsync\n"
+            "                        every MODE ms (default none)\n"
+            "  -L, --log-dir DIR     directory of the log segments (default logs)\n"
+            "  -S, --segment SIZE    new log segment every SIZE bytes, or daily\n"
+            "                        (default %d)\n"
+            "  -R, --retain N        keep at most N log segments (default all)\n"
+            "  -D, --retain-days N   drop log segments older than N days\n"
+            "  -C, --compact SIZE    merge closed segments up to SIZE bytes\n"
+            "  -T, --timestamp FMT   chat (default), ms, date or iso\n"
+            "  -e, --event-loop NAME select, poll, epoll, epoll-et or uring\n"
+            "                        (default uring where supported, else epoll)\n"
+            "  -A, --admin PATH      serve the stats on this unix socket\n"
+            "  -i, --ping SECS       ping clients quiet this long (default %d),\n"
+            "                        0: never, and no TCP keepalive either\n"
+            "  -I, --idle SECS       drop clients silent this long (default %d),\n"
+            "                        0: never. only clients that answer pings\n"
+            "  -F, --flush-delay MS  write output this much later, batched with\n"
+            "                        what follows (default 0: at once)\n"
+            TLS_USAGE
+            ZLIB_USAGE,
+            prog, MAX_CLIENTS, HISTORY_MESSAGES, HISTORY_BYTES, RECENT_CACHE,
+            HIGH_WATER, SEGMENT_BYTES, PING_INTERVAL, IDLE_TIMEOUT);
+}
 
-                buf[n] = '\0';
+/* --ping and --idle: whole seconds, as ms that fit an int.
+   -1 if arg is not such a number. */
+static int secs_to_ms(const char *arg) {
 
-                char timestamp[32];
-                make_timestamp(timestamp, sizeof(timestamp));
+    char *end;
+    errno = 0;
+    long secs = strtol(arg, &end, 10);
 
-                char formatted[BUFFER_SIZE + 128];
-                snprintf(formatted, sizeof(formatted),
-                        "%s:%s → %s\n",
-                        timestamp,
-                        clients[i].info.name,
-                        buf);
+    if (end == arg || *end || errno || secs < 0 || secs > INT_MAX / 1000)
+        return -1;
 
-                printf("%s", formatted);
-                fprintf(logfile, "%s", formatted);
-                fflush(logfile);
+    return (int)secs * 1000;
+}
 
-                broadcast(formatted, strlen(formatted));
+int main(int argc, char **argv) {
+
+    static const struct option options[] = {
+        { "max-clients", required_argument, NULL, 'm' },
+        { "threads",     required_argument, NULL, 't' },
+        { "history",     required_argument, NULL, 'H' },
+        { "history-bytes", required_argument, NULL, 'b' },
+        { "cache",       required_argument, NULL, 'c' },
+        { "high-water",  required_argument, NULL, 'W' },
+        { "low-water",   required_argument, NULL, 'w' },
+        { "slow-policy", required_argument, NULL, 'P' },
+        { "sync",        required_argument, NULL, 's' },
+        { "log-dir",     required_argument, NULL, 'L' },
+        { "segment",     required_argument, NULL, 'S' },
+        { "retain",      required_argument, NULL, 'R' },
+        { "retain-days", required_argument, NULL, 'D' },
+        { "compact",     required_argument, NULL, 'C' },
+        { "timestamp",   required_argument, NULL, 'T' },
+        { "event-loop",  required_argument, NULL, 'e' },
+        { "admin",       required_argument, NULL, 'A' },
+        { "ping",        required_argument, NULL, 'i' },
+        { "idle",        required_argument, NULL, 'I' },
+        { "flush-delay", required_argument, NULL, 'F' },
+#ifdef USE_SSL
+        { "tls-cert",    required_argument, NULL, 'x' },
+        { "tls-key",     required_argument, NULL, 'k' },
+#endif
+#ifdef HAVE_ZLIB
+        { "compress",    required_argument, NULL, 'z' },
+#endif
+        { "help",        no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    /* event loop asked for, NULL: the best one available */
+    const char *event_loop = NULL;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "m:t:H:b:c:W:w:P:s:L:S:R:D:C:T:e:A:i:I:F:" TLS_OPTIONS ZLIB_OPTIONS "h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            max_clients = atoi(optarg);
+            if (max_clients <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            shard_count = atoi(optarg);
+            if (shard_count <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'H':
+            if (atoi(optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            history_msgs = atoi(optarg);
+            break;
+        case 'b':
+            if (atol(optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            history_bytes = atol(optarg);
+            break;
+        case 'c':
+            if (atoi(optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            cache_msgs = atoi(optarg);
+            break;
+        case 'W':
+            if (atol(optarg) <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            high_water = atol(optarg);
+            break;
+        case 'w':
+            if (atol(optarg) <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            low_water = atol(optarg);
+            break;
+        case 'P':
+            if (strcmp(optarg, "disconnect") == 0) {
+                slow_policy = SLOW_DISCONNECT;
+            } else if (strcmp(optarg, "drop") == 0) {
+                slow_policy = SLOW_DROP;
+            } else if (strcmp(optarg, "collapse") == 0) {
+                slow_policy = SLOW_COLLAPSE;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            if (strcmp(optarg, "none") == 0) {
+                log_sync = LOG_SYNC_NONE;
+            } else if (strcmp(optarg, "batch") == 0) {
+                log_sync = LOG_SYNC_BATCH;
+            } else if (atoi(optarg) > 0) {
+                log_sync = LOG_SYNC_INTERVAL;
+                log_sync_ms = atoi(optarg);
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'L':
+            log_dir = optarg;
+            break;
+        case 'S':
+            if (strcmp(optarg, "daily") == 0) {
+                log_cfg.daily = 1;
+                log_cfg.segment_bytes = 0;
+            } else if (atoll(optarg) > 0) {
+                log_cfg.daily = 0;
+                log_cfg.segment_bytes = atoll(optarg);
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'R':
+            if (atoi(optarg) < 0) {
+                usage(argv[0]);
+                return 1;
             }
+            log_cfg.retain_segments = atoi(optarg);
+            break;
+        case 'D':
+            if (atoi(optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            log_cfg.retain_days = atoi(optarg);
+            break;
+        case 'C':
+            if (atoll(optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            log_cfg.compact_bytes = atoll(optarg);
+            break;
+        case 'T': {
+            static const char *names[] = {
+                [TS_CHAT] = "chat", [TS_MS] = "ms",
+                [TS_DATE] = "date", [TS_ISO] = "iso"
+            };
+            timestamp_format = -1;
+            for (int k = 0; k < (int)(sizeof(names) / sizeof(names[0])); k++)
+                if (strcmp(optarg, names[k]) == 0)
+                    timestamp_format = k;
+            if (timestamp_format < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        }
+        case 'e':
+            if (strcmp(optarg, "uring") != 0 && poller_backend(optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            event_loop = optarg;
+            break;
+        case 'A':
+            admin_path = optarg;
+            break;
+        case 'i':
+            ping_ms = secs_to_ms(optarg);
+            if (ping_ms < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'I':
+            idle_ms = secs_to_ms(optarg);
+            if (idle_ms < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'F':
+            if (atoi(optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            flush_delay_ms = atoi(optarg);
+            break;
+        case 'x':
+            tls_cert = optarg;
+            break;
+        case 'k':
+            tls_key = optarg;
+            break;
+        case 'z':
+            compress_level = atoi(optarg);
+            if (compress_level < 0 || compress_level > 9) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
         }
     }
-}
 
-int main(void) {
-    run_server_select();
-    // run_server_poll();
-    // run_server_epoll();
+    if (low_water == 0)
+        low_water = high_water / 2;
+
+    if (low_water >= high_water) {
+        fprintf(stderr, "--low-water must be below --high-water\n");
+        return 1;
+    }
+
+    /* a client must get its ping, and time to answer it */
+    if (ping_ms > 0 && idle_ms > 0 && idle_ms <= ping_ms) {
+        fprintf(stderr, "--idle must be above --ping\n");
+        return 1;
+    }
+
+#ifdef USE_SSL
+    if (tls_cert && tls_server_init(tls_cert, tls_key ? tls_key : tls_cert) < 0)
+        return 1;
+#endif
+
+    raise_fd_limit(max_clients);
+
+    start_time = now_ns();
+
+    /* SIGINT and SIGTERM are taken by sigwait() below; every thread
+       started from here on inherits the mask */
+    sigset_t quit;
+    sigemptyset(&quit);
+    sigaddset(&quit, SIGINT);
+    sigaddset(&quit, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &quit, NULL);
+
+    /* chat events are echoed by the logger with plain write()s;
+       keep our own lines from lingering in the stdio buffer */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    /* open the log. only segment sizes and index lengths are read,
+       so startup does not depend on how much history there is.
+       a chat.log from before segments becomes the first segment. */
+    if (seglog_open(&chatlog, log_dir, "chat.log", &log_cfg) < 0) {
+        perror(log_dir);
+        return 1;
+    }
+
+    log_base = seglog_end(&chatlog);
+
+    if (nameindex_init(&names) < 0) {
+        perror("nameindex_init");
+        return 1;
+    }
+
+    if (room_table_init(&rooms, shard_count) < 0 ||
+        !(lobby = room_get(&rooms, "#lobby", cache_msgs, 1))) {
+        perror("rooms");
+        return 1;
+    }
+
+    if (logger_init(&logger, &chatlog, LOG_QUEUE, log_sync, log_sync_ms,
+                    STDOUT_FILENO) < 0) {
+        perror("logger");
+        return 1;
+    }
+
+    logger_route(&logger, room_log, NULL);
+
+    if (logger_start(&logger) < 0) {
+        perror("logger");
+        return 1;
+    }
+
+    if (ring_init(&ring, RING_SIZE, shard_count) < 0) {
+        perror("ring_init");
+        return 1;
+    }
+
+    /* event loop every shard runs: the one asked for, else the
+       completion based loop whenever the running kernel can do it,
+       else epoll */
+    run_loop = run_server_poller;
+
+    if (event_loop && strcmp(event_loop, "uring") != 0) {
+        poller_kind = poller_backend(event_loop);
+    } else {
+#ifdef HAVE_LIBURING
+        /* the TLS handshake and records run on readiness loops only */
+        if (uring_supported() && !tls_cert)
+            run_loop = run_server_uring;
+#endif
+        if (event_loop && run_loop == run_server_poller) {
+            fprintf(stderr, tls_cert ? "io_uring does not do TLS\n"
+                                     : "io_uring is not available\n");
+            return 1;
+        }
+    }
+
+    loop_name = run_loop == run_server_poller ? poller_name(poller_kind)
+                                              : "io_uring";
+
+    shards = calloc(shard_count, sizeof(*shards));
+    if (!shards) { perror("calloc"); return 1; }
+
+    for (int k = 0; k < shard_count; k++) {
+
+        shards[k].id = k;
+        atomic_init(&shards[k].sleeping, 0);
+
+        shards[k].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shards[k].wake_fd < 0) { perror("eventfd"); return 1; }
+    }
+
+    if (seed_caches() < 0) {
+        perror("seed_caches");
+        return 1;
+    }
+
+    for (int k = 0; k < shard_count; k++) {
+        if (pthread_create(&shards[k].thread, NULL, shard_main, &shards[k]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+    }
+
+    if (admin_path && admin_start(admin_path) < 0) {
+        perror(admin_path);
+        return 1;
+    }
+
+    /* run until told to stop, then leave the stats behind and make
+       sure everything queued for the log is written. the sockets
+       close with the process. */
+    int sig;
+    sigwait(&quit, &sig);
+
+    fprintf(stderr, "\n%s, shutting down\n", strsignal(sig));
+    metrics_report(stderr);
+
+    logger_stop(&logger);
+
+    if (admin_path)
+        unlink(admin_path);
 
     return 0;
 }
\ No newline at end of file
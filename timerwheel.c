@@ -0,0 +1,201 @@
+#include "timerwheel.h"
+
+/* ticks one slot of a level spans */
+#define SPAN(l) ((uint64_t)1 << (WHEEL_BITS * (l)))
+
+/* the farthest a timer can be placed ahead */
+#define HORIZON (SPAN(WHEEL_LEVELS) - 1)
+
+static void list_init(Timer *head) {
+    head->prev = head->next = head;
+}
+
+void timerwheel_init(TimerWheel *w, uint64_t now) {
+
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        for (int s = 0; s < WHEEL_SLOTS; s++)
+            list_init(&w->slots[l][s]);
+        w->used[l] = 0;
+    }
+
+    w->tick = now;
+    w->count = 0;
+}
+
+void timer_init(Timer *t, void (*fire)(void *arg), void *arg) {
+    t->prev = t->next = NULL;
+    t->expires = 0;
+    t->level = t->slot = 0;
+    t->fire = fire;
+    t->arg = arg;
+}
+
+/* put t into the slot its expiry falls in, seen from w->tick: the
+   lowest level whose 64 slots reach that far */
+static void place(TimerWheel *w, Timer *t) {
+
+    uint64_t at = t->expires > w->tick ? t->expires : w->tick;
+    uint64_t delta = at - w->tick;
+
+    /* too far: wait in the last level and be placed again later */
+    if (delta > HORIZON)
+        at = w->tick + HORIZON;
+
+    int l = 0;
+    while (l < WHEEL_LEVELS - 1 && (at - w->tick) >= SPAN(l + 1))
+        l++;
+
+    int s = (at >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1);
+    Timer *head = &w->slots[l][s];
+
+    t->level = l;
+    t->slot = s;
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+
+    w->used[l] |= (uint64_t)1 << s;
+    w->count++;
+}
+
+/* take t out of its slot */
+static void unlink_timer(TimerWheel *w, Timer *t) {
+
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+
+    Timer *head = &w->slots[t->level][t->slot];
+    if (head->next == head)
+        w->used[t->level] &= ~((uint64_t)1 << t->slot);
+
+    w->count--;
+}
+
+void timer_set(TimerWheel *w, Timer *t, uint64_t at) {
+
+    if (timer_pending(t))
+        unlink_timer(w, t);
+
+    t->expires = at;
+    place(w, t);
+}
+
+void timer_cancel(TimerWheel *w, Timer *t) {
+    if (timer_pending(t))
+        unlink_timer(w, t);
+}
+
+/* move the timers of a slot to the list at out, leaving it empty */
+static void take_slot(TimerWheel *w, int l, int s, Timer *out) {
+
+    Timer *head = &w->slots[l][s];
+
+    list_init(out);
+    if (head->next == head)
+        return;
+
+    out->next = head->next;
+    out->prev = head->prev;
+    out->next->prev = out;
+    out->prev->next = out;
+
+    list_init(head);
+    w->used[l] &= ~((uint64_t)1 << s);
+}
+
+/* the next timer of a list taken with take_slot, or NULL. it is
+   off every list and no longer counted. */
+static Timer *take_next(TimerWheel *w, Timer *list) {
+
+    Timer *t = list->next;
+    if (t == list)
+        return NULL;
+
+    list->next = t->next;
+    t->next->prev = list;
+    t->prev = t->next = NULL;
+
+    w->count--;
+    return t;
+}
+
+/* everything due at tick now: runs of higher levels that start here
+   move down (highest first, so they can go on down), then the level
+   0 slot fires */
+static void run_tick(TimerWheel *w, uint64_t now) {
+
+    Timer list, *t;
+
+    for (int l = WHEEL_LEVELS - 1; l > 0; l--) {
+
+        if (now & (SPAN(l) - 1))
+            continue;
+
+        take_slot(w, l, (now >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1), &list);
+        while ((t = take_next(w, &list)))
+            place(w, t);
+    }
+
+    take_slot(w, 0, now & (WHEEL_SLOTS - 1), &list);
+
+    /* what a timer sets while firing goes after this tick */
+    w->tick = now + 1;
+
+    /* a timer firing may cancel another one still on this list */
+    while ((t = take_next(w, &list)))
+        t->fire(t->arg);
+}
+
+void timerwheel_advance(TimerWheel *w, uint64_t now) {
+
+    while (w->tick <= now) {
+
+        if (w->count == 0) {
+            w->tick = now + 1;
+            return;
+        }
+
+        /* with levels below l empty nothing happens until the next
+           run of level l starts: jump there */
+        uint64_t step = 1;
+        for (int l = 0; l < WHEEL_LEVELS - 1 && !w->used[l]; l++)
+            step = SPAN(l + 1);
+
+        if (w->tick & (step - 1)) {
+            uint64_t next = (w->tick | (step - 1)) + 1;
+            w->tick = next <= now ? next : now + 1;
+            continue;
+        }
+
+        run_tick(w, w->tick);
+    }
+}
+
+int64_t timerwheel_timeout(const TimerWheel *w, uint64_t now) {
+
+    if (w->count == 0)
+        return -1;
+
+    uint64_t next = UINT64_MAX;
+
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+
+        if (!w->used[l])
+            continue;
+
+        /* the first run of this level not started yet, and from
+           there the nearest slot with timers */
+        uint64_t run = (w->tick + SPAN(l) - 1) >> (WHEEL_BITS * l);
+        unsigned r = run & (WHEEL_SLOTS - 1);
+        uint64_t bits = r ? (w->used[l] >> r) | (w->used[l] << (64 - r))
+                          : w->used[l];
+
+        uint64_t at = (run + __builtin_ctzll(bits)) << (WHEEL_BITS * l);
+        if (at < next)
+            next = at;
+    }
+
+    return next > now ? (int64_t)(next - now) : 0;
+}
@@ -0,0 +1,68 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* timers for an event loop: a hierarchical timing wheel.
+
+   time goes in ticks of one millisecond. level 0 has a slot for
+   each of the next 64 ticks, level 1 a slot for each of the next 64
+   runs of 64 ticks, and so on; 4 levels reach 2^24 ms (4.6 hours),
+   later timers wait in the last level and are placed again when they
+   come up. a timer is a list node living in whatever it times (a
+   connection, say), so setting, moving and cancelling one are a few
+   pointer stores, with no allocation and no search.
+
+   when the loop advances the wheel, a level 0 slot's timers fire
+   as its tick comes, and a higher slot's timers move down a level as
+   its run starts: a timer is touched once per level at most. ticks
+   with nothing to do are skipped, so an idle wheel costs nothing
+   however many timers wait in it. */
+
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+typedef struct Timer {
+    struct Timer *prev, *next;  /* in its slot, NULL if not set */
+    uint64_t expires;           /* tick it fires at */
+    uint8_t level, slot;        /* where it waits */
+    void (*fire)(void *arg);
+    void *arg;
+} Timer;
+
+typedef struct {
+    Timer slots[WHEEL_LEVELS][WHEEL_SLOTS];  /* list heads */
+    uint64_t used[WHEEL_LEVELS];    /* bit s: slot s has timers */
+    uint64_t tick;                  /* the next tick to run */
+    unsigned count;                 /* timers set */
+} TimerWheel;
+
+/* an empty wheel whose clock starts at now (ms) */
+void timerwheel_init(TimerWheel *w, uint64_t now);
+
+/* a timer that calls fire(arg) when it expires; not set yet */
+void timer_init(Timer *t, void (*fire)(void *arg), void *arg);
+
+/* fire t at time at (ms), or at the next tick if that has passed.
+   a timer that is set already is moved. */
+void timer_set(TimerWheel *w, Timer *t, uint64_t at);
+
+/* unset t (no-op if it is not set) */
+void timer_cancel(TimerWheel *w, Timer *t);
+
+static inline int timer_pending(const Timer *t) {
+    return t->next != NULL;
+}
+
+/* run the clock up to now (ms), firing every timer due. a timer
+   may set or cancel any timer, itself included, while it fires. */
+void timerwheel_advance(TimerWheel *w, uint64_t now);
+
+/* ms from now until the wheel next has something to do, 0 if it
+   is due already, -1 if no timer is set. for timers beyond level 0
+   that is when they move down, which is never after they expire. */
+int64_t timerwheel_timeout(const TimerWheel *w, uint64_t now);
+
+#endif
@@ -0,0 +1,345 @@
+#include "tls.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+/* plaintext staged without kTLS: one full record */
+#define TLS_RECORD 16384
+
+struct Tls {
+    SSL *ssl;
+    int fd;
+    int server;
+    int ktls_send;
+    int ktls_recv;
+    char *out;          /* the staged record, allocated on first use */
+    size_t out_off;     /* bytes of it SSL_write() took */
+    size_t out_len;
+};
+
+/* one context for every connection; SSL_new() on it is thread safe */
+static SSL_CTX *ctx;
+
+static SSL_CTX *new_ctx(const SSL_METHOD *method) {
+
+    /* OpenSSL writes with plain send(), which raises SIGPIPE on a
+       connection the peer already closed */
+    signal(SIGPIPE, SIG_IGN);
+
+    SSL_CTX *x = SSL_CTX_new(method);
+    if (!x)
+        return NULL;
+
+    SSL_CTX_set_min_proto_version(x, TLS1_2_VERSION);
+
+    /* a staged record is written out piece by piece */
+    SSL_CTX_set_mode(x, SSL_MODE_ENABLE_PARTIAL_WRITE);
+
+    /* take all the socket has in one recv(), not one record per
+       call: a busy sender costs one wakeup, not one per message */
+    SSL_CTX_set_read_ahead(x, 1);
+
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(x, SSL_OP_ENABLE_KTLS);
+#endif
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    /* a peer that just closes the connection has left, nothing more */
+    SSL_CTX_set_options(x, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+
+    /* AES-GCM first for TLS 1.2: that is what the kernel can do */
+    SSL_CTX_set_cipher_list(x, "ECDHE+AESGCM:ECDHE+CHACHA20:HIGH:!aNULL:!MD5");
+
+    return x;
+}
+
+int tls_server_init(const char *cert, const char *key) {
+
+    ctx = new_ctx(TLS_server_method());
+
+    if (!ctx ||
+        SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        fprintf(stderr, "tls: cannot use %s / %s\n", cert, key);
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+
+    /* no session resumption, so no tickets follow the handshake: the
+       first record after it is already ours */
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_num_tickets(ctx, 0);
+
+    return 0;
+}
+
+int tls_client_init(const char *ca, int verify) {
+
+    ctx = new_ctx(TLS_client_method());
+    if (!ctx) {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+
+    if (!verify)
+        return 0;
+
+    if ((ca ? SSL_CTX_load_verify_locations(ctx, ca, NULL)
+            : SSL_CTX_set_default_verify_paths(ctx)) != 1) {
+        fprintf(stderr, "tls: cannot load %s\n", ca ? ca : "the system certificates");
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    return 0;
+}
+
+Tls *tls_new(int fd, int server, const char *host) {
+
+    Tls *t = calloc(1, sizeof(*t));
+    if (!t)
+        return NULL;
+
+    t->ssl = SSL_new(ctx);
+    if (!t->ssl || SSL_set_fd(t->ssl, fd) != 1) {
+        tls_free(t);
+        return NULL;
+    }
+
+    t->fd = fd;
+    t->server = server;
+
+    if (server) {
+        SSL_set_accept_state(t->ssl);
+        return t;
+    }
+
+    SSL_set_connect_state(t->ssl);
+
+    /* the certificate has to name the server, by address or by name */
+    if (host && X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(t->ssl), host) != 1) {
+        SSL_set_tlsext_host_name(t->ssl, host);
+        SSL_set1_host(t->ssl, host);
+    }
+
+    return t;
+}
+
+void tls_free(Tls *t) {
+
+    if (!t)
+        return;
+
+    SSL_free(t->ssl);
+    free(t->out);
+    free(t);
+}
+
+int tls_handshake(Tls *t, int *want_write) {
+
+    ERR_clear_error();
+
+    int r = SSL_do_handshake(t->ssl);
+
+    if (r == 1) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+        t->ktls_send = BIO_get_ktls_send(SSL_get_wbio(t->ssl)) > 0;
+        t->ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(t->ssl)) > 0;
+#endif
+        return 1;
+    }
+
+    switch (SSL_get_error(t->ssl, r)) {
+    case SSL_ERROR_WANT_READ:
+        *want_write = 0;
+        return 0;
+    case SSL_ERROR_WANT_WRITE:
+        *want_write = 1;
+        return 0;
+    }
+
+    /* a server sees scanners and impatient peers; only the client
+       has someone to tell why */
+    if (!t->server) {
+        long v = SSL_get_verify_result(t->ssl);
+        if (v != X509_V_OK)
+            fprintf(stderr, "tls: %s\n", X509_verify_cert_error_string(v));
+        else
+            ERR_print_errors_fp(stderr);
+    }
+
+    return -1;
+}
+
+int tls_ktls_send(const Tls *t) {
+    return t->ktls_send;
+}
+
+int tls_ktls_recv(const Tls *t) {
+    return t->ktls_recv;
+}
+
+/* one SSL_read(), as recv() would return it */
+static ssize_t read_record(Tls *t, void *buf, size_t len) {
+
+    ERR_clear_error();
+    errno = 0;
+
+    int r = SSL_read(t->ssl, buf, len > INT_MAX ? INT_MAX : (int)len);
+    if (r > 0)
+        return r;
+
+    switch (SSL_get_error(t->ssl, r)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_SYSCALL:
+        /* no errno: the connection just ended */
+        return errno ? -1 : 0;
+    }
+
+    errno = EPROTO;
+    return -1;
+}
+
+ssize_t tls_recv(Tls *t, void *buf, size_t len) {
+
+    /* SSL_read() returns one record at most. like recv(), take all
+       there is, so a burst of small messages is handled (and fanned
+       out) as one batch, not one message at a time. only what is
+       buffered already: a blocking socket must not wait for more. */
+    size_t got = 0;
+
+    while (got < len && (got == 0 || SSL_has_pending(t->ssl))) {
+
+        ssize_t n = read_record(t, (char *)buf + got, len - got);
+        if (n <= 0) {
+            /* an error or the end shows up again on the next call */
+            if (got > 0)
+                break;
+            return n;
+        }
+
+        got += n;
+    }
+
+    return got;
+}
+
+int tls_pending(const Tls *t) {
+    return SSL_has_pending(t->ssl);
+}
+
+int tls_flush(Tls *t) {
+
+    while (t->out_off < t->out_len) {
+
+        ERR_clear_error();
+
+        /* after a WANT_* the same bytes have to be offered again */
+        int r = SSL_write(t->ssl, t->out + t->out_off,
+                          (int)(t->out_len - t->out_off));
+        if (r > 0) {
+            t->out_off += r;
+            continue;
+        }
+
+        int e = SSL_get_error(t->ssl, r);
+        if (e == SSL_ERROR_WANT_WRITE || e == SSL_ERROR_WANT_READ)
+            return 1;
+
+        errno = EPIPE;
+        return -1;
+    }
+
+    t->out_off = t->out_len = 0;
+    return 0;
+}
+
+/* make room in the staging buffer: -1 (errno EAGAIN if the socket is
+   full) unless the last record went out */
+static int stage_ready(Tls *t) {
+
+    int r = tls_flush(t);
+    if (r > 0)
+        errno = EAGAIN;
+    if (r != 0)
+        return -1;
+
+    if (!t->out && !(t->out = malloc(TLS_RECORD)))
+        return -1;
+
+    return 0;
+}
+
+ssize_t tls_sendmsg(Tls *t, const struct iovec *iov, int n, int flags) {
+
+    /* the kernel encrypts: one syscall for the whole batch */
+    if (t->ktls_send) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (struct iovec *)iov;
+        msg.msg_iovlen = n;
+        return sendmsg(t->fd, &msg, MSG_NOSIGNAL | flags);
+    }
+
+    if (stage_ready(t) < 0)
+        return -1;
+
+    /* as much of the batch as fits one record, in one SSL_write() */
+    size_t len = 0;
+    for (int k = 0; k < n && len < TLS_RECORD; k++) {
+        size_t take = iov[k].iov_len < TLS_RECORD - len
+                    ? iov[k].iov_len : TLS_RECORD - len;
+        memcpy(t->out + len, iov[k].iov_base, take);
+        len += take;
+    }
+
+    t->out_off = 0;
+    t->out_len = len;
+
+    /* taken either way; a full socket gets the rest with tls_flush() */
+    if (tls_flush(t) < 0)
+        return -1;
+
+    return len;
+}
+
+ssize_t tls_sendfile(Tls *t, int fd, off_t *off, size_t len) {
+
+    /* straight from the page cache, encrypted by the kernel */
+    if (t->ktls_send)
+        return sendfile(t->fd, fd, off, len);
+
+    if (stage_ready(t) < 0)
+        return -1;
+
+    ssize_t n = pread(fd, t->out, len < TLS_RECORD ? len : TLS_RECORD, *off);
+    if (n <= 0)
+        return n;
+
+    *off += n;
+    t->out_off = 0;
+    t->out_len = n;
+
+    if (tls_flush(t) < 0)
+        return -1;
+
+    return n;
+}
@@ -0,0 +1,69 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* encrypted connections (OpenSSL), built in with `make USE_SSL=1`.
+
+   the handshake runs in user space, right after connect/accept and
+   before the Client hello. after it the record layer is handed to the
+   kernel (kTLS) when the kernel and the negotiated cipher allow it.
+   with kTLS for sending the socket encrypts whatever is written to
+   it, so batched sendmsg() fan-out and sendfile() history replay
+   work as on a plain socket, without a copy through user space.
+
+   without kTLS, output is copied into a staging buffer of one
+   record and written with SSL_write(); a record the socket does not
+   take stays there until tls_flush(). input always goes through
+   SSL_read(), which uses kTLS receive by itself when it is on. */
+
+typedef struct Tls Tls;
+
+/* the server side: certificate chain and private key (PEM).
+   returns -1 (with the reason printed) if they cannot be loaded. */
+int  tls_server_init(const char *cert, const char *key);
+
+/* the client side. peers are verified against ca (a PEM file, e.g.
+   the server's self-signed certificate), or the system's
+   certificates if ca is NULL; not at all if verify is 0. */
+int  tls_client_init(const char *ca, int verify);
+
+/* a TLS session on connected socket fd. host is the name or address
+   the client expects in the server's certificate (NULL on the
+   server). the socket may be blocking or not. NULL if out of memory. */
+Tls *tls_new(int fd, int server, const char *host);
+void tls_free(Tls *t);
+
+/* drive the handshake. returns 1 once it is done, 0 while it waits
+   for the peer (*want_write: for write space rather than input),
+   -1 if it failed. */
+int  tls_handshake(Tls *t, int *want_write);
+
+/* the kernel encrypts what is sent / decrypts what is received */
+int  tls_ktls_send(const Tls *t);
+int  tls_ktls_recv(const Tls *t);
+
+/* like recv(): bytes read, 0 when the peer closed, -1 with errno
+   EAGAIN if nothing is decrypted yet */
+ssize_t tls_recv(Tls *t, void *buf, size_t len);
+
+/* input TLS took from the socket but nobody read yet (the socket
+   is not readable for it), so read again while this is non-zero and
+   tls_recv() returns data */
+int  tls_pending(const Tls *t);
+
+/* like sendmsg(): returns the bytes taken, which are sent or staged
+   (see tls_flush), -1 with errno EAGAIN if nothing could be taken.
+   flags (MSG_MORE) only apply to kTLS sends. */
+ssize_t tls_sendmsg(Tls *t, const struct iovec *iov, int n, int flags);
+
+/* like sendfile(), with the same rules as tls_sendmsg */
+ssize_t tls_sendfile(Tls *t, int fd, off_t *off, size_t len);
+
+/* write staged output. returns 0 once there is none, 1 if the
+   socket is full, -1 on error. */
+int  tls_flush(Tls *t);
+
+#endif
@@ -0,0 +1,237 @@
+#include "zstream.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/* raw deflate (no zlib header or checksum, so blocks can be spliced
+   in), with a 4 KiB window and small hash tables: about 40 KiB per
+   stream. that still reaches back over the last few dozen chat
+   lines, which is where the repetition is. */
+#define ZOUT_WINDOW_BITS 12
+#define ZOUT_MEM_LEVEL   5
+
+/* the client accepts any window */
+#define ZIN_WINDOW_BITS  15
+
+/* output space is added this much at a time */
+#define ZOUT_CHUNK 4096
+
+/* a drained output buffer larger than this is given back, so idle
+   connections do not keep the memory of a large history replay */
+#define ZOUT_KEEP (16 * 1024)
+
+struct ZOut {
+    z_stream zs;
+    char *out;          /* compressed bytes not sent yet */
+    size_t off;         /* of them sent */
+    size_t len;
+    size_t cap;
+};
+
+struct ZIn {
+    z_stream zs;
+    char *out;          /* decompressed bytes not taken yet */
+    size_t off;
+    size_t len;
+    size_t cap;
+};
+
+/* at least min free bytes at the end of a buffer */
+static int reserve(char **buf, size_t *off, size_t *len, size_t *cap,
+                   size_t min) {
+
+    /* move what is left to the front first */
+    if (*off > 0) {
+        memmove(*buf, *buf + *off, *len - *off);
+        *len -= *off;
+        *off = 0;
+    }
+
+    if (*cap - *len >= min)
+        return 0;
+
+    size_t c = *cap ? *cap : ZOUT_CHUNK;
+    while (c - *len < min)
+        c *= 2;
+
+    char *b = realloc(*buf, c);
+    if (!b)
+        return -1;
+
+    *buf = b;
+    *cap = c;
+    return 0;
+}
+
+ZOut *zout_new(int level) {
+
+    ZOut *z = calloc(1, sizeof(*z));
+    if (!z)
+        return NULL;
+
+    if (deflateInit2(&z->zs, level, Z_DEFLATED, -ZOUT_WINDOW_BITS,
+                     ZOUT_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(z);
+        return NULL;
+    }
+
+    return z;
+}
+
+void zout_free(ZOut *z) {
+
+    if (!z)
+        return;
+
+    deflateEnd(&z->zs);
+    free(z->out);
+    free(z);
+}
+
+void zout_reset(ZOut *z) {
+    deflateReset(&z->zs);
+    z->off = z->len = 0;
+}
+
+ssize_t zout_write(ZOut *z, const struct iovec *iov, int n, int full) {
+
+    size_t before = z->len - z->off;
+
+    /* nothing to add still flushes */
+    struct iovec none = { NULL, 0 };
+    if (n == 0) {
+        iov = &none;
+        n = 1;
+    }
+
+    for (int k = 0; k < n; k++) {
+
+        z->zs.next_in = iov[k].iov_base;
+        z->zs.avail_in = iov[k].iov_len;
+
+        /* the flush goes with the last buffer */
+        int flush = k + 1 < n ? Z_NO_FLUSH : full ? Z_FULL_FLUSH : Z_SYNC_FLUSH;
+
+        /* a flush is complete once deflate() leaves output space over */
+        do {
+            if (reserve(&z->out, &z->off, &z->len, &z->cap, ZOUT_CHUNK) < 0)
+                return -1;
+
+            z->zs.next_out = (Bytef *)z->out + z->len;
+            z->zs.avail_out = z->cap - z->len;
+
+            deflate(&z->zs, flush);
+
+            z->len = z->cap - z->zs.avail_out;
+
+        } while (z->zs.avail_in > 0 || z->zs.avail_out == 0);
+    }
+
+    return z->len - z->off - before;
+}
+
+int zout_append(ZOut *z, const void *data, size_t len) {
+
+    if (reserve(&z->out, &z->off, &z->len, &z->cap, len) < 0)
+        return -1;
+
+    memcpy(z->out + z->len, data, len);
+    z->len += len;
+    return 0;
+}
+
+const char *zout_pending(const ZOut *z, size_t *len) {
+    *len = z->len - z->off;
+    return *len ? z->out + z->off : NULL;
+}
+
+void zout_consume(ZOut *z, size_t n) {
+
+    z->off += n;
+    if (z->off < z->len)
+        return;
+
+    z->off = z->len = 0;
+
+    if (z->cap > ZOUT_KEEP) {
+        free(z->out);
+        z->out = NULL;
+        z->cap = 0;
+    }
+}
+
+ZIn *zin_new(void) {
+
+    ZIn *z = calloc(1, sizeof(*z));
+    if (!z)
+        return NULL;
+
+    if (inflateInit2(&z->zs, -ZIN_WINDOW_BITS) != Z_OK) {
+        free(z);
+        return NULL;
+    }
+
+    return z;
+}
+
+void zin_free(ZIn *z) {
+
+    if (!z)
+        return;
+
+    inflateEnd(&z->zs);
+    free(z->out);
+    free(z);
+}
+
+int zin_feed(ZIn *z, const void *data, size_t len) {
+
+    z->zs.next_in = (Bytef *)data;
+    z->zs.avail_in = len;
+
+    /* all of it: the server flushes every batch, so whatever arrived
+       decompresses completely */
+    do {
+
+        if (reserve(&z->out, &z->off, &z->len, &z->cap, ZOUT_CHUNK) < 0)
+            return -1;
+
+        z->zs.next_out = (Bytef *)z->out + z->len;
+        z->zs.avail_out = z->cap - z->len;
+
+        int r = inflate(&z->zs, Z_SYNC_FLUSH);
+
+        z->len = z->cap - z->zs.avail_out;
+
+        /* no progress: the rest of a block is still on its way */
+        if (r == Z_BUF_ERROR)
+            break;
+
+        /* the stream never ends while the connection lasts */
+        if (r != Z_OK)
+            return -1;
+
+    } while (z->zs.avail_in > 0 || z->zs.avail_out == 0);
+
+    return 0;
+}
+
+size_t zin_ready(const ZIn *z) {
+    return z->len - z->off;
+}
+
+size_t zin_take(ZIn *z, void *buf, size_t len) {
+
+    size_t n = z->len - z->off;
+    if (n > len)
+        n = len;
+
+    memcpy(buf, z->out + z->off, n);
+    z->off += n;
+
+    if (z->off == z->len)
+        z->off = z->len = 0;
+
+    return n;
+}
@@ -0,0 +1,61 @@
+#ifndef ZSTREAM_H
+#define ZSTREAM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* compression of what the server sends (zlib), for clients that ask
+   for it in their hello (HELLO_ZLIB). built in when zlib is installed.
+
+   everything after the server's answer to the hello is one raw
+   deflate stream per connection: the history replay and every frame
+   after it. each batch written to it ends with a flush, so the client
+   can decompress and show it at once.
+
+   a block compressed on its own, from a fresh stream, may be copied
+   into a connection's stream right after a full flush: it refers to
+   nothing before it, and nothing after it refers back into it. that
+   is how a history block is compressed once and sent to every client
+   that joins. */
+
+typedef struct ZOut ZOut;
+
+/* level 1 (fastest) to 9 (smallest). the window is kept small: a
+   stream costs a few dozen KiB per connection, not a few hundred.
+   NULL if out of memory. */
+ZOut *zout_new(int level);
+void  zout_free(ZOut *z);
+
+/* start a fresh stream; what is pending is dropped */
+void  zout_reset(ZOut *z);
+
+/* compress n buffers onto the pending output and flush. with full
+   set, a block may be appended next (see zout_append). returns the
+   compressed bytes added, -1 if out of memory. */
+ssize_t zout_write(ZOut *z, const struct iovec *iov, int n, int full);
+
+/* copy a block compressed on its own to the pending output */
+int   zout_append(ZOut *z, const void *data, size_t len);
+
+/* compressed bytes not sent yet (NULL if none), and sent */
+const char *zout_pending(const ZOut *z, size_t *len);
+void  zout_consume(ZOut *z, size_t n);
+
+/* the client side */
+typedef struct ZIn ZIn;
+
+ZIn  *zin_new(void);
+void  zin_free(ZIn *z);
+
+/* decompress len bytes as received; the output is kept until it is
+   taken. returns -1 if the input is not a valid stream. */
+int   zin_feed(ZIn *z, const void *data, size_t len);
+
+/* decompressed bytes not taken yet */
+size_t zin_ready(const ZIn *z);
+
+/* take up to len of them; returns how many */
+size_t zin_take(ZIn *z, void *buf, size_t len);
+
+#endif